@@ -27,13 +27,22 @@
  * 02/09/21 - Chenxi Zhou: Created                                               *
  *                                                                               *
  *********************************************************************************/
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
 #include <unistd.h>
 #include <sys/resource.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define BIN_COLS_SSE2
+#endif
 
+#include "ksort.h"
 #include "asset.h"
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
@@ -194,19 +203,1275 @@ uint64_t linear_scale(uint64_t g, int *scale, uint64_t max_g)
     return g;
 }
 
-void write_bin_header(FILE *fo)
+// k-th smallest of n values by quickselect with median of three pivots
+// values are partially reordered: a[0, k) <= a[k] <= a[k + 1, n)
+#define SELECT_INIT(name, type_t) \
+    static type_t select_##name(type_t *a, long n, long k) \
+    { \
+        long lo, hi, mid, i, j; \
+        type_t p, t; \
+        lo = 0; \
+        hi = n - 1; \
+        while (lo < hi) { \
+            mid = lo + (hi - lo) / 2; \
+            if (a[mid] < a[lo]) { t = a[mid]; a[mid] = a[lo]; a[lo] = t; } \
+            if (a[hi] < a[lo]) { t = a[hi]; a[hi] = a[lo]; a[lo] = t; } \
+            if (a[hi] < a[mid]) { t = a[hi]; a[hi] = a[mid]; a[mid] = t; } \
+            p = a[mid]; \
+            i = lo; \
+            j = hi; \
+            while (i <= j) { \
+                while (a[i] < p) ++i; \
+                while (p < a[j]) --j; \
+                if (i <= j) { \
+                    t = a[i]; a[i] = a[j]; a[j] = t; \
+                    ++i; \
+                    --j; \
+                } \
+            } \
+            if (k <= j) \
+                hi = j; \
+            else if (k >= i) \
+                lo = i; \
+            else \
+                break; \
+        } \
+        return a[k]; \
+    }
+
+SELECT_INIT(double, double)
+SELECT_INIT(int32, int32_t)
+
+// median of n values in linear time, values are reordered
+double median_double(double *a, uint32_t n)
+{
+    uint32_t i;
+    double m, m1;
+
+    if (n == 0)
+        return .0;
+    m = select_double(a, n, n / 2);
+    if (n & 1)
+        return m;
+    // the lower middle value is the largest one before n / 2
+    m1 = a[0];
+    for (i = 1; i < n / 2; ++i)
+        if (a[i] > m1)
+            m1 = a[i];
+    return (m + m1) / 2;
+}
+
+double median_int32(int32_t *a, uint32_t n)
+{
+    uint32_t i;
+    int32_t m, m1;
+
+    if (n == 0)
+        return .0;
+    m = select_int32(a, n, n / 2);
+    if (n & 1)
+        return m;
+    m1 = a[0];
+    for (i = 1; i < n / 2; ++i)
+        if (a[i] > m1)
+            m1 = a[i];
+    return (m + m1) / 2.;
+}
+
+void write_bin_header(FILE *fo, int version)
 {
     int64_t magic_number = BIN_H;
     int64_t bin_version = BIN_V;
     magic_number |= bin_version;
+    if (version == 2)
+        magic_number = BIN_H2;
     fwrite(&magic_number, sizeof(int64_t), 1, fo);
 }
 
-int is_valid_bin_header(int64_t n)
+static void write_bin_header_mem(uint8_t *p)
 {
     int64_t magic_number = BIN_H;
     int64_t bin_version = BIN_V;
     magic_number |= bin_version;
-    return n == magic_number;
+    memcpy(p, &magic_number, sizeof(int64_t));
+}
+
+// return the BIN version, or 0 if not a valid BIN header
+int bin_header_version(int64_t n)
+{
+    int64_t magic_number = BIN_H;
+    int64_t bin_version = BIN_V;
+    magic_number |= bin_version;
+    if (n == magic_number)
+        return 1;
+    if (n == BIN_H2)
+        return 2;
+    return 0;
+}
+
+int is_valid_bin_header(int64_t n)
+{
+    return bin_header_version(n) > 0;
+}
+
+static inline uint8_t *put_varint(uint8_t *p, int64_t x)
+{
+    uint64_t u;
+    u = (uint64_t) x << 1 ^ (uint64_t) (x >> 63); // zigzag
+    while (u >= 0x80) {
+        *p++ = (uint8_t) u | 0x80;
+        u >>= 7;
+    }
+    *p++ = (uint8_t) u;
+    return p;
+}
+
+static inline const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, int64_t *x)
+{
+    uint64_t u;
+    int s;
+    u = 0;
+    s = 0;
+    while (p < end && s < 64) {
+        u |= (uint64_t) (*p & 0x7f) << s;
+        if (!(*p++ & 0x80)) {
+            *x = (int64_t) (u >> 1) ^ -(int64_t) (u & 1);
+            return p;
+        }
+        s += 7;
+    }
+    return 0;
+}
+
+bin_writer_t *bin_writer_open(const char *f, int version)
+{
+    bin_writer_t *w;
+
+    // an index of an earlier file of the same name does not apply any more
+    bin_idx_remove(f);
+    w = (bin_writer_t *) calloc(1, sizeof(bin_writer_t));
+    w->fp = fopen(f, "w");
+    if (w->fp == NULL) {
+        fprintf(stderr, "[E::%s] cannot open file %s for writing\n", __func__, f);
+        free(w);
+        return 0;
+    }
+    w->version = version == 2? 2 : 1;
+    w->i0 = (uint32_t *) malloc(BIN_BLOCK_SIZE * sizeof(uint32_t));
+    w->p0 = (uint32_t *) malloc(BIN_BLOCK_SIZE * sizeof(uint32_t));
+    w->i1 = (uint32_t *) malloc(BIN_BLOCK_SIZE * sizeof(uint32_t));
+    w->p1 = (uint32_t *) malloc(BIN_BLOCK_SIZE * sizeof(uint32_t));
+    w->q = (uint8_t *) malloc(BIN_BLOCK_SIZE * sizeof(uint8_t));
+    // version 1 records or version 2 block with at most 10 bytes for each varint
+    w->buf = (uint8_t *) malloc(8 + (long) BIN_BLOCK_SIZE * 41);
+    write_bin_header(w->fp, w->version);
+    w->off = sizeof(int64_t);
+
+    return w;
+}
+
+static void bin_writer_flush(bin_writer_t *w)
+{
+    uint32_t i, n, l;
+    uint8_t *p;
+
+    n = w->n;
+    if (n == 0)
+        return;
+
+    p = w->buf;
+    if (w->version == 1) {
+        for (i = 0; i < n; ++i) {
+            memcpy(p, &w->i0[i], 4);
+            memcpy(p + 4, &w->p0[i], 4);
+            memcpy(p + 8, &w->i1[i], 4);
+            memcpy(p + 12, &w->p1[i], 4);
+            p[16] = w->q[i];
+            p += BIN_RECORD_SIZE;
+        }
+    } else {
+        p += 8;
+        for (i = 0; i < n; ++i)
+            p = put_varint(p, (int64_t) w->i0[i] - (i? w->i0[i - 1] : 0));
+        for (i = 0; i < n; ++i)
+            p = put_varint(p, (int64_t) w->p0[i] - (i && w->i0[i] == w->i0[i - 1]? w->p0[i - 1] : 0));
+        for (i = 0; i < n; ++i)
+            p = put_varint(p, (int64_t) w->i1[i] - w->i0[i]);
+        for (i = 0; i < n; ++i)
+            p = put_varint(p, (int64_t) w->p1[i] - (w->i1[i] == w->i0[i]? w->p0[i] : 0));
+        memcpy(p, w->q, n);
+        p += n;
+        l = p - w->buf - 8;
+        memcpy(w->buf, &n, 4);
+        memcpy(w->buf + 4, &l, 4);
+    }
+    fwrite(w->buf, 1, p - w->buf, w->fp);
+    w->off += p - w->buf;
+    w->rec_c += n;
+    w->n = 0;
+}
+
+// get the position of the next record to add
+// a version 2 record is located by the offset of its block and the number of records before it in the block
+void bin_writer_tell(bin_writer_t *w, uint64_t *off, uint32_t *skip)
+{
+    if (w->version == 1) {
+        *off = w->off + (uint64_t) w->n * BIN_RECORD_SIZE;
+        *skip = 0;
+    } else {
+        *off = w->off;
+        *skip = w->n;
+    }
+}
+
+void bin_writer_add(bin_writer_t *w, uint32_t i0, uint32_t p0, uint32_t i1, uint32_t p1, uint8_t q)
+{
+    w->i0[w->n] = i0;
+    w->p0[w->n] = p0;
+    w->i1[w->n] = i1;
+    w->p1[w->n] = p1;
+    w->q[w->n] = q;
+    if (++w->n == BIN_BLOCK_SIZE)
+        bin_writer_flush(w);
+}
+
+// return nonzero on write error
+int bin_writer_close(bin_writer_t *w)
+{
+    int ret;
+
+    bin_writer_flush(w);
+    ret = ferror(w->fp);
+    if (fclose(w->fp))
+        ret = 1;
+    free(w->i0);
+    free(w->p0);
+    free(w->i1);
+    free(w->p1);
+    free(w->q);
+    free(w->buf);
+    free(w);
+
+    return ret;
+}
+
+// decode a version 2 block of n records into version 1 records
+// return 0 if the block is corrupted
+static int bin_block_decode(const uint8_t *p, uint32_t l, uint32_t n, uint8_t *out)
+{
+    uint32_t i, x;
+    int64_t v;
+    const uint8_t *end;
+    uint8_t *rec;
+
+    end = p + l;
+    // i0
+    x = 0;
+    for (i = 0, rec = out; i < n; ++i, rec += BIN_RECORD_SIZE) {
+        if (!(p = get_varint(p, end, &v)))
+            return 0;
+        x += v;
+        memcpy(rec, &x, 4);
+    }
+    // p0
+    for (i = 0, rec = out; i < n; ++i, rec += BIN_RECORD_SIZE) {
+        if (!(p = get_varint(p, end, &v)))
+            return 0;
+        if (i && !memcmp(rec, rec - BIN_RECORD_SIZE, 4)) {
+            memcpy(&x, rec - BIN_RECORD_SIZE + 4, 4);
+            x += v;
+        } else {
+            x = v;
+        }
+        memcpy(rec + 4, &x, 4);
+    }
+    // i1
+    for (i = 0, rec = out; i < n; ++i, rec += BIN_RECORD_SIZE) {
+        if (!(p = get_varint(p, end, &v)))
+            return 0;
+        memcpy(&x, rec, 4);
+        x += v;
+        memcpy(rec + 8, &x, 4);
+    }
+    // p1
+    for (i = 0, rec = out; i < n; ++i, rec += BIN_RECORD_SIZE) {
+        if (!(p = get_varint(p, end, &v)))
+            return 0;
+        if (!memcmp(rec, rec + 8, 4)) {
+            memcpy(&x, rec + 4, 4);
+            x += v;
+        } else {
+            x = v;
+        }
+        memcpy(rec + 12, &x, 4);
+    }
+    // q
+    if (end - p != n)
+        return 0;
+    for (i = 0, rec = out; i < n; ++i, rec += BIN_RECORD_SIZE)
+        rec[16] = *p++;
+
+    return 1;
+}
+
+#define BIN_ADV_SIZE 0x4000000 // release mapped pages every 64MB
+
+// in-memory link store
+// records of a BIN file passing the mapping quality filter are held as a version 1 image sorted and indexed by contig pair
+// readers of the file are served from memory while the store is loaded
+typedef struct {
+    char *f; // BIN file the records are loaded from
+    uint8_t *map; // header and records
+    size_t size;
+    bin_idx_t *idx;
+} bin_mem_t;
+
+static bin_mem_t *bin_mem = 0;
+
+static bin_reader_t *bin_mem_reader_open(bin_mem_t *mem)
+{
+    bin_reader_t *r;
+    r = (bin_reader_t *) calloc(1, sizeof(bin_reader_t));
+    r->mem = 1;
+    r->map = mem->map;
+    r->size = mem->size;
+    memcpy(&r->magic_number, r->map, sizeof(int64_t));
+    r->off = sizeof(int64_t);
+    r->version = 1;
+    r->idx = mem->idx;
+    return r;
+}
+
+// open a BIN file and check the header
+// return NULL if the file cannot be opened or is not a valid BIN file
+bin_reader_t *bin_reader_open(const char *f)
+{
+    bin_reader_t *r;
+    struct stat st;
+    void *map;
+    char *idx;
+
+    if (bin_mem && strcmp(bin_mem->f, f) == 0)
+        return bin_mem_reader_open(bin_mem);
+
+    r = (bin_reader_t *) calloc(1, sizeof(bin_reader_t));
+    r->fp = fopen(f, "r");
+    if (r->fp == NULL) {
+        fprintf(stderr, "[E::%s] cannot open file %s for reading\n", __func__, f);
+        free(r);
+        return 0;
+    }
+
+    if (!fstat(fileno(r->fp), &st) && S_ISREG(st.st_mode) && st.st_size >= (off_t) sizeof(int64_t)) {
+        map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fileno(r->fp), 0);
+        if (map != MAP_FAILED) {
+            r->map = (uint8_t *) map;
+            r->size = st.st_size;
+            madvise(r->map, r->size, MADV_SEQUENTIAL);
+        }
+    }
+
+    if (r->map) {
+        memcpy(&r->magic_number, r->map, sizeof(int64_t));
+        r->off = sizeof(int64_t);
+    } else if (fread(&r->magic_number, sizeof(int64_t), 1, r->fp) != 1) {
+        r->magic_number = 0;
+    }
+
+    r->version = bin_header_version(r->magic_number);
+    if (!r->version) {
+        fprintf(stderr, "[E::%s] not a valid BIN file\n", __func__);
+        bin_reader_close(r);
+        return 0;
+    }
+
+    if (r->map) {
+        // the index is only useful if records can be accessed randomly
+        idx = (char *) malloc(strlen(f) + 5);
+        sprintf(idx, "%s.idx", f);
+        r->idx = bin_idx_load(idx, fileno(r->fp));
+        free(idx);
+    }
+
+    return r;
+}
+
+// get the next block header of a version 2 file
+// return 1 if a block header is available, 0 at the end of file and -1 on error
+static int bin_reader_block(bin_reader_t *r, uint32_t *n, uint32_t *l)
+{
+    uint32_t h[2];
+    size_t m;
+
+    if (r->map) {
+        if (r->off == r->size)
+            return 0;
+        if (r->size - r->off < 8)
+            return -1;
+        memcpy(h, r->map + r->off, 8);
+        if (r->size - r->off - 8 < h[1])
+            return -1;
+    } else {
+        if (!r->blk_h) {
+            if (r->blk == 0)
+                r->blk = (uint8_t *) malloc(8);
+            m = fread(r->blk, 1, 8, r->fp);
+            if (m != 8)
+                return m == 0 && !ferror(r->fp)? 0 : -1;
+            r->blk_h = 1;
+        }
+        memcpy(h, r->blk, 8);
+    }
+    *n = h[0];
+    *l = h[1];
+    if (h[0] > BIN_BLOCK_SIZE)
+        return -1;
+
+    return 1;
+}
+
+static long bin_reader_read2(bin_reader_t *r, uint8_t **rec, long n)
+{
+    uint32_t b, l;
+    long k;
+    int ret;
+    const uint8_t *p;
+
+    r->dec_n = 0;
+    k = 0;
+    while ((ret = bin_reader_block(r, &b, &l)) > 0) {
+        if (k > 0 && k + b > n)
+            break;
+        if (r->m < (size_t) (k + b)) {
+            r->m = MAX((size_t) n, (size_t) (k + b));
+            r->buf = (uint8_t *) realloc(r->buf, r->m * BIN_RECORD_SIZE);
+        }
+        if (r->map) {
+            p = r->map + r->off + 8;
+            r->off += 8 + l;
+        } else {
+            r->blk = (uint8_t *) realloc(r->blk, 8 + l);
+            if (fread(r->blk + 8, 1, l, r->fp) != l) {
+                ret = -1;
+                break;
+            }
+            p = r->blk + 8;
+            r->blk_h = 0;
+        }
+        if (!bin_block_decode(p, l, b, r->buf + k * BIN_RECORD_SIZE)) {
+            ret = -1;
+            break;
+        }
+        k += b;
+    }
+
+    if (ret < 0) {
+        fprintf(stderr, "[E::%s] corrupted BIN file\n", __func__);
+        r->error = 1;
+        return -1;
+    }
+    *rec = r->buf;
+
+    return k;
+}
+
+// decode the version 2 block at the current offset into the buffer unless it is decoded already
+// the offset is left at the block
+// return the number of records of the block, 0 at the end of file or -1 on error
+static long bin_reader_decode(bin_reader_t *r)
+{
+    long m;
+    size_t off;
+    uint8_t *rec;
+
+    if (r->dec_n && r->dec_off == r->off)
+        return r->dec_n;
+    off = r->off;
+    m = bin_reader_read2(r, &rec, 1);
+    if (m > 0) {
+        r->dec_off = off;
+        r->dec_end = r->off;
+        r->dec_n = m;
+    }
+    r->off = off;
+
+    return m;
+}
+
+static long bin_reader_read1(bin_reader_t *r, uint8_t **rec, long n)
+{
+    size_t m;
+    long k;
+
+    if (r->map && !r->mem) {
+        // release pages of records consumed by previous calls to keep the resident size small
+        while (r->adv + BIN_ADV_SIZE <= r->off) {
+            madvise(r->map + r->adv, BIN_ADV_SIZE, MADV_DONTNEED);
+            r->adv += BIN_ADV_SIZE;
+        }
+    }
+
+    if (r->version == 2) {
+        // blocks larger than n are returned in parts
+        if (r->buf_i == r->buf_n) {
+            k = bin_reader_read2(r, rec, n);
+            if (k <= 0)
+                return k;
+            r->buf_i = 0;
+            r->buf_n = k;
+        }
+        m = MIN((size_t) n, r->buf_n - r->buf_i);
+        *rec = r->buf + r->buf_i * BIN_RECORD_SIZE;
+        r->buf_i += m;
+        return (long) m;
+    }
+
+    if (r->map) {
+        m = MIN((size_t) n, (r->size - r->off) / BIN_RECORD_SIZE);
+        *rec = r->map + r->off;
+        r->off += m * BIN_RECORD_SIZE;
+        return (long) m;
+    }
+
+    if (r->m < (size_t) n) {
+        r->m = n;
+        r->buf = (uint8_t *) realloc(r->buf, r->m * BIN_RECORD_SIZE);
+    }
+    m = fread(r->buf, BIN_RECORD_SIZE, n, r->fp);
+    if (m < (size_t) n && ferror(r->fp)) {
+        r->error = 1;
+        return -1;
+    }
+    *rec = r->buf;
+
+    return (long) m;
+}
+
+// get the next at most n records
+// fewer records may be returned for version 2 files or selected runs before the end of the file
+// return the number of records, 0 at the end of file or -1 on a read error
+// *rec is valid until the next call
+long bin_reader_read(bin_reader_t *r, uint8_t **rec, long n)
+{
+    long j, k, m;
+    uint8_t *p;
+    bin_idx_ent_t *run;
+
+    if (!r->sel)
+        return bin_reader_read1(r, rec, n);
+
+    do {
+        if (r->sel_r == 0) {
+            if (r->sel_i == r->sel_n)
+                return 0;
+            run = &r->sel[r->sel_i++];
+            r->off = run->off;
+            r->skip = run->skip;
+            r->sel_r = run->n;
+        }
+
+        if (r->version == 2) {
+            // serve the run from the decoded block, each block is decoded once for all runs inside it
+            m = bin_reader_decode(r);
+            if (m <= (long) r->skip) {
+                if (m >= 0)
+                    fprintf(stderr, "[E::%s] BIN index does not match the file\n", __func__);
+                r->error = 1;
+                return -1;
+            }
+            p = r->buf + (size_t) r->skip * BIN_RECORD_SIZE;
+            m = MIN(MIN((uint64_t) (m - r->skip), r->sel_r), (uint64_t) n);
+            j = 0;
+            if (r->sel_mq) {
+                // records of each contig pair in a run are sorted by mapping quality
+                // skip the records below the cutoff at the end of a pair and stop at the records of the next pair
+                for (j = 0; j < m && p[j * BIN_RECORD_SIZE + 16] < r->sel_mq; ++j) {}
+                for (k = j; k < m && p[k * BIN_RECORD_SIZE + 16] >= r->sel_mq; ++k) {}
+                m = k;
+            }
+            *rec = p + (size_t) j * BIN_RECORD_SIZE;
+            r->skip += m;
+            r->sel_r -= m;
+            if (r->skip == r->dec_n) {
+                // the rest of the run starts at the next block
+                r->off = r->dec_end;
+                r->skip = 0;
+            }
+            m -= j;
+        } else {
+            m = bin_reader_read1(r, rec, MIN((uint64_t) n, r->sel_r));
+            if (m <= 0) {
+                fprintf(stderr, "[E::%s] BIN index does not match the file\n", __func__);
+                r->error = 1;
+                return -1;
+            }
+            r->sel_r -= m;
+        }
+    } while (m == 0);
+
+    return m;
+}
+
+// number of records of an index entry with mapping quality no less than mq
+// found by binary search for mapped version 1 files, e->n otherwise
+static uint64_t bin_idx_ent_count(bin_reader_t *r, bin_idx_ent_t *e, uint8_t mq)
+{
+    uint64_t lo, hi, mid;
+    uint8_t *q;
+
+    if (mq == 0 || !r->map || r->version != 1)
+        return e->n;
+    q = r->map + e->off + 16;
+    lo = 0;
+    hi = e->n;
+    while (lo < hi) {
+        mid = (lo + hi) >> 1;
+        if (q[mid * BIN_RECORD_SIZE] >= mq)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// restrict reading to records of the contig pairs (c0, c1) for which keep returns nonzero, all pairs if keep is NULL
+// and to records with mapping quality no less than mq
+// adjacent index entries are merged into runs unless a run ends at the mapping quality cutoff found by binary search
+// return the number of selected records, an upper bound if the cutoff is applied while reading,
+// or -1 if the file is not indexed
+long bin_reader_select(bin_reader_t *r, int (*keep)(uint32_t c0, uint32_t c1, void *data), void *data, uint8_t mq)
+{
+    uint64_t i, k, c;
+    long n;
+    int merge;
+    bin_idx_ent_t *e;
+
+    if (!r->idx)
+        return -1;
+
+    free(r->sel);
+    r->sel = (bin_idx_ent_t *) malloc(MAX(1, r->idx->n) * sizeof(bin_idx_ent_t));
+    // records of version 2 files below the cutoff are skipped while reading
+    r->sel_mq = r->version == 2? mq : 0;
+    n = 0;
+    k = 0;
+    merge = 0;
+    for (i = 0; i < r->idx->n; ++i) {
+        e = &r->idx->a[i];
+        if (keep && !keep(e->c0, e->c1, data)) {
+            merge = 0;
+            continue;
+        }
+        c = bin_idx_ent_count(r, e, mq);
+        if (c == 0) {
+            merge = 0;
+            continue;
+        }
+        if (merge) {
+            r->sel[k - 1].n += c;
+        } else {
+            r->sel[k] = *e;
+            r->sel[k++].n = c;
+        }
+        merge = c == e->n;
+        n += c;
+    }
+    r->sel_n = k;
+    r->sel_i = 0;
+    r->sel_r = 0;
+    r->buf_i = r->buf_n = 0;
+
+    return n;
+}
+
+// number of records of a BIN file from the index, the file size (version 1) or the block headers (version 2)
+// no records are decoded and the reader is left at the same position
+// return -1 if the records cannot be counted, e.g., for pipes
+long bin_reader_count(bin_reader_t *r)
+{
+    uint64_t i;
+    uint32_t b, l;
+    size_t off;
+    long n;
+    int ret;
+
+    n = 0;
+    if (r->idx) {
+        for (i = 0; i < r->idx->n; ++i)
+            n += r->idx->a[i].n;
+    } else if (!r->map) {
+        return -1;
+    } else if (r->version == 1) {
+        n = (r->size - sizeof(int64_t)) / BIN_RECORD_SIZE;
+    } else {
+        off = r->off;
+        r->off = sizeof(int64_t);
+        while ((ret = bin_reader_block(r, &b, &l)) > 0) {
+            n += b;
+            r->off += 8 + l;
+        }
+        r->off = off;
+        if (ret < 0)
+            return -1;
+    }
+
+    return n;
+}
+
+void bin_reader_close(bin_reader_t *r)
+{
+    if (!r->mem) {
+        if (r->map)
+            munmap(r->map, r->size);
+        fclose(r->fp);
+        bin_idx_destroy(r->idx);
+    }
+    free(r->buf);
+    free(r->blk);
+    free(r->sel);
+    free(r);
+}
+
+
+void bin_cols_init(bin_cols_t *cols, uint32_t m)
+{
+    cols->n = 0;
+    cols->m = m;
+    cols->c0 = (uint32_t *) malloc(m * sizeof(uint32_t));
+    cols->p0 = (uint32_t *) malloc(m * sizeof(uint32_t));
+    cols->c1 = (uint32_t *) malloc(m * sizeof(uint32_t));
+    cols->p1 = (uint32_t *) malloc(m * sizeof(uint32_t));
+    cols->q = (uint8_t *) malloc(m);
+}
+
+void bin_cols_destroy(bin_cols_t *cols)
+{
+    free(cols->c0);
+    free(cols->p0);
+    free(cols->c1);
+    free(cols->p1);
+    free(cols->q);
+}
+
+static uint32_t bin_cols_decode_scalar(bin_cols_t *cols, const uint8_t *rec, uint32_t n, uint8_t mq, uint32_t k)
+{
+    uint32_t i, v[4];
+
+    for (i = 0; i < n; ++i, rec += BIN_RECORD_SIZE) {
+        if (rec[16] < mq)
+            continue;
+        memcpy(v, rec, 16);
+        cols->c0[k] = v[0];
+        cols->p0[k] = v[1];
+        cols->c1[k] = v[2];
+        cols->p1[k] = v[3];
+        cols->q[k++] = rec[16];
+    }
+    return k;
+}
+
+#ifdef BIN_COLS_SSE2
+// groups of 4 records are transposed in registers if all of them pass the filter
+// other groups are left to the scalar loop
+static uint32_t bin_cols_decode_sse2(bin_cols_t *cols, const uint8_t *rec, uint32_t n, uint8_t mq, uint32_t k)
+{
+    uint32_t i;
+    __m128i r0, r1, r2, r3, t0, t1, t2, t3;
+
+    for (i = 0; i + 4 <= n; i += 4, rec += 4 * BIN_RECORD_SIZE) {
+        if (rec[16] < mq || rec[33] < mq || rec[50] < mq || rec[67] < mq) {
+            k = bin_cols_decode_scalar(cols, rec, 4, mq, k);
+            continue;
+        }
+        r0 = _mm_loadu_si128((const __m128i *) rec);
+        r1 = _mm_loadu_si128((const __m128i *) (rec + 17));
+        r2 = _mm_loadu_si128((const __m128i *) (rec + 34));
+        r3 = _mm_loadu_si128((const __m128i *) (rec + 51));
+        t0 = _mm_unpacklo_epi32(r0, r1); // c0 c0 p0 p0
+        t1 = _mm_unpacklo_epi32(r2, r3);
+        t2 = _mm_unpackhi_epi32(r0, r1); // c1 c1 p1 p1
+        t3 = _mm_unpackhi_epi32(r2, r3);
+        _mm_storeu_si128((__m128i *) (cols->c0 + k), _mm_unpacklo_epi64(t0, t1));
+        _mm_storeu_si128((__m128i *) (cols->p0 + k), _mm_unpackhi_epi64(t0, t1));
+        _mm_storeu_si128((__m128i *) (cols->c1 + k), _mm_unpacklo_epi64(t2, t3));
+        _mm_storeu_si128((__m128i *) (cols->p1 + k), _mm_unpackhi_epi64(t2, t3));
+        cols->q[k] = rec[16];
+        cols->q[k + 1] = rec[33];
+        cols->q[k + 2] = rec[50];
+        cols->q[k + 3] = rec[67];
+        k += 4;
+    }
+    return bin_cols_decode_scalar(cols, rec, n - i, mq, k);
+}
+#endif
+
+// decode n records with mapping quality no less than mq into columns
+// cols must hold at least n records
+// return the number of records kept
+uint32_t bin_cols_decode(bin_cols_t *cols, const uint8_t *rec, uint32_t n, uint8_t mq)
+{
+    assert(n <= cols->m);
+#ifdef BIN_COLS_SSE2
+    cols->n = bin_cols_decode_sse2(cols, rec, n, mq, 0);
+#else
+    cols->n = bin_cols_decode_scalar(cols, rec, n, mq, 0);
+#endif
+    return cols->n;
+}
+
+// get the fingerprint of an open BIN file
+// the CRC32 covers the header and the first block, or the first BIN_BLOCK_SIZE records of a version 1 file
+// return nonzero on error
+static int bin_stamp_get(int fd, bin_stamp_t *s)
+{
+    struct stat st;
+    int64_t magic_number;
+    uint32_t h[2];
+    uint8_t *buf;
+    size_t l;
+    ssize_t m;
+
+    if (fstat(fd, &st))
+        return 1;
+    s->size = st.st_size;
+    s->ino = st.st_ino;
+    s->mtime = st.st_mtime;
+    if (pread(fd, &magic_number, sizeof(int64_t), 0) != sizeof(int64_t))
+        return 1;
+    if (bin_header_version(magic_number) == 2)
+        l = pread(fd, h, 8, sizeof(int64_t)) == 8? 8 + (size_t) h[1] : 0;
+    else
+        l = (size_t) BIN_BLOCK_SIZE * BIN_RECORD_SIZE;
+    l = MIN(sizeof(int64_t) + l, s->size);
+    buf = (uint8_t *) malloc(l);
+    m = pread(fd, buf, l, 0);
+    s->crc = crc32(crc32(0L, Z_NULL, 0), buf, MAX(m, 0));
+    free(buf);
+
+    return m != (ssize_t) l;
+}
+
+// remove the index of a BIN file, if any
+void bin_idx_remove(const char *f)
+{
+    char *idx;
+
+    idx = (char *) malloc(strlen(f) + 5);
+    sprintf(idx, "%s.idx", f);
+    unlink(idx);
+    free(idx);
+}
+
+// load the index f of the BIN file open as fd
+// return NULL if the index does not exist or was not written for this file
+bin_idx_t *bin_idx_load(const char *f, int fd)
+{
+    FILE *fp;
+    int64_t magic_number;
+    uint64_t i;
+    bin_idx_t *idx;
+    bin_idx_ent_t *e;
+    bin_stamp_t s;
+    int ok;
+    static int warned = 0;
+
+    fp = fopen(f, "r");
+    if (fp == NULL)
+        return 0;
+
+    idx = (bin_idx_t *) calloc(1, sizeof(bin_idx_t));
+    ok = !bin_stamp_get(fd, &s) &&
+        fread(&magic_number, sizeof(int64_t), 1, fp) == 1 && magic_number == BIN_IDX_H &&
+        fread(&idx->stamp.size, sizeof(uint64_t), 1, fp) == 1 && idx->stamp.size == s.size &&
+        fread(&idx->stamp.ino, sizeof(uint64_t), 1, fp) == 1 && idx->stamp.ino == s.ino &&
+        fread(&idx->stamp.mtime, sizeof(int64_t), 1, fp) == 1 && idx->stamp.mtime == s.mtime &&
+        fread(&idx->stamp.crc, sizeof(uint32_t), 1, fp) == 1 && idx->stamp.crc == s.crc &&
+        fread(&idx->n, sizeof(uint64_t), 1, fp) == 1;
+    if (ok) {
+        idx->a = (bin_idx_ent_t *) malloc(MAX(1, idx->n) * sizeof(bin_idx_ent_t));
+        for (i = 0; ok && i < idx->n; ++i) {
+            e = &idx->a[i];
+            ok = fread(&e->c0, sizeof(uint32_t), 1, fp) == 1 &&
+                fread(&e->c1, sizeof(uint32_t), 1, fp) == 1 &&
+                fread(&e->skip, sizeof(uint32_t), 1, fp) == 1 &&
+                fread(&e->off, sizeof(uint64_t), 1, fp) == 1 &&
+                fread(&e->n, sizeof(uint64_t), 1, fp) == 1 &&
+                e->off < idx->stamp.size;
+        }
+    }
+    fclose(fp);
+
+    if (!ok) {
+        if (!warned)
+            fprintf(stderr, "[W::%s] ignored invalid or outdated BIN index %s\n", __func__, f);
+        warned = 1;
+        bin_idx_destroy(idx);
+        return 0;
+    }
+
+    return idx;
+}
+
+static int bin_idx_save(const char *f, bin_idx_t *idx)
+{
+    FILE *fp;
+    int64_t magic_number;
+    uint64_t i;
+    bin_idx_ent_t *e;
+    int ret;
+
+    fp = fopen(f, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "[E::%s] cannot open file %s for writing\n", __func__, f);
+        return 1;
+    }
+    magic_number = BIN_IDX_H;
+    fwrite(&magic_number, sizeof(int64_t), 1, fp);
+    fwrite(&idx->stamp.size, sizeof(uint64_t), 1, fp);
+    fwrite(&idx->stamp.ino, sizeof(uint64_t), 1, fp);
+    fwrite(&idx->stamp.mtime, sizeof(int64_t), 1, fp);
+    fwrite(&idx->stamp.crc, sizeof(uint32_t), 1, fp);
+    fwrite(&idx->n, sizeof(uint64_t), 1, fp);
+    for (i = 0; i < idx->n; ++i) {
+        e = &idx->a[i];
+        fwrite(&e->c0, sizeof(uint32_t), 1, fp);
+        fwrite(&e->c1, sizeof(uint32_t), 1, fp);
+        fwrite(&e->skip, sizeof(uint32_t), 1, fp);
+        fwrite(&e->off, sizeof(uint64_t), 1, fp);
+        fwrite(&e->n, sizeof(uint64_t), 1, fp);
+    }
+    ret = ferror(fp);
+    if (fclose(fp))
+        ret = 1;
+
+    return ret;
+}
+
+void bin_idx_destroy(bin_idx_t *idx)
+{
+    if (!idx)
+        return;
+    free(idx->a);
+    free(idx);
 }
 
+typedef struct {
+    uint64_t x; // i0 << 32 | i1
+    uint64_t y; // p0 << 32 | p1
+    uint8_t q;
+} bin_rec_t;
+
+// intra-contig pairs first, then by contig pair, mapping quality in descending order and positions
+#define bin_rec_inter(a) ((uint32_t) ((a).x >> 32) != (uint32_t) (a).x)
+#define bin_rec_lt(a, b) (bin_rec_inter(a) < bin_rec_inter(b) || (bin_rec_inter(a) == bin_rec_inter(b) && \
+            ((a).x < (b).x || ((a).x == (b).x && ((a).q > (b).q || ((a).q == (b).q && (a).y < (b).y))))))
+KSORT_INIT(bin_rec, bin_rec_t, bin_rec_lt)
+
+// merge heap of sorted runs, the smallest record on top
+typedef struct {
+    bin_rec_t r;
+    uint32_t i; // run index
+} bin_run_t;
+
+static void bin_run_heapdown(bin_run_t *heap, uint32_t i, uint32_t n)
+{
+    uint32_t k;
+    bin_run_t tmp;
+
+    tmp = heap[i];
+    while ((k = (i << 1) + 1) < n) {
+        if (k + 1 < n && bin_rec_lt(heap[k + 1].r, heap[k].r))
+            ++k;
+        if (!bin_rec_lt(heap[k].r, tmp.r))
+            break;
+        heap[i] = heap[k];
+        i = k;
+    }
+    heap[i] = tmp;
+}
+
+static inline void bin_rec_get(bin_rec_t *r, const uint8_t *rec)
+{
+    uint32_t v[4];
+    memcpy(v, rec, 16);
+    r->x = (uint64_t) v[0] << 32 | v[2];
+    r->y = (uint64_t) v[1] << 32 | v[3];
+    r->q = rec[16];
+}
+
+typedef struct {
+    bin_writer_t *w;
+    uint64_t m;
+    bin_idx_t idx;
+} bin_idx_writer_t;
+
+// add a record to the sorted output and start a new index entry at a new contig pair
+static void bin_idx_writer_add(bin_idx_writer_t *iw, bin_rec_t *r)
+{
+    bin_idx_ent_t *e;
+    uint32_t c0, c1;
+
+    c0 = r->x >> 32;
+    c1 = (uint32_t) r->x;
+    e = iw->idx.n? &iw->idx.a[iw->idx.n - 1] : 0;
+    if (!e || e->c0 != c0 || e->c1 != c1) {
+        if (iw->idx.n == iw->m) {
+            iw->m = iw->m? iw->m << 1 : 1024;
+            iw->idx.a = (bin_idx_ent_t *) realloc(iw->idx.a, iw->m * sizeof(bin_idx_ent_t));
+        }
+        e = &iw->idx.a[iw->idx.n++];
+        e->c0 = c0;
+        e->c1 = c1;
+        e->n = 0;
+        bin_writer_tell(iw->w, &e->off, &e->skip);
+    }
+    ++e->n;
+    bin_writer_add(iw->w, c0, r->y >> 32, c1, (uint32_t) r->y, r->q);
+}
+
+// sort a BIN file into the order of bin_rec_lt and write the sorted file and its index <out>.idx
+// records are sorted in chunks of at most mem_limit bytes that are merged from temporary files
+// return nonzero on error
+int bin_sort_file(const char *f, const char *out, int version, long mem_limit)
+{
+    bin_reader_t *r, **runs;
+    bin_writer_t *w;
+    bin_idx_writer_t iw;
+    bin_rec_t *a;
+    bin_run_t *heap;
+    uint8_t *rec;
+    char *tmp;
+    uint64_t i, n, m, max_n;
+    uint32_t j, k, n_runs;
+    long c;
+    FILE *fp;
+    int ret;
+
+    r = bin_reader_open(f);
+    if (r == NULL)
+        return 1;
+
+    max_n = mem_limit < 0? UINT64_MAX : MAX((uint64_t) mem_limit / sizeof(bin_rec_t), 1 << 20);
+    tmp = (char *) malloc(strlen(out) + 16);
+    a = 0;
+    n = m = 0;
+    n_runs = 0;
+    ret = 0;
+    while (1) {
+        c = bin_reader_read(r, &rec, BIN_BLOCK_SIZE);
+        if (c < 0) {
+            ret = 1;
+            break;
+        }
+        for (i = 0; i < (uint64_t) c; ++i, rec += BIN_RECORD_SIZE) {
+            if (n == m) {
+                m = m? MIN(m << 1, max_n) : MIN(1 << 20, max_n);
+                a = (bin_rec_t *) realloc(a, m * sizeof(bin_rec_t));
+            }
+            bin_rec_get(&a[n++], rec);
+            if (n == max_n) {
+                ks_introsort_bin_rec(n, a);
+                sprintf(tmp, "%s.tmp.%04u", out, n_runs++);
+                w = bin_writer_open(tmp, 1);
+                if (w == NULL) {
+                    ret = 1;
+                    break;
+                }
+                for (j = 0; j < n; ++j)
+                    bin_writer_add(w, a[j].x >> 32, a[j].y >> 32, (uint32_t) a[j].x, (uint32_t) a[j].y, a[j].q);
+                if (bin_writer_close(w)) {
+                    fprintf(stderr, "[E::%s] error writing file %s\n", __func__, tmp);
+                    ret = 1;
+                    break;
+                }
+                n = 0;
+            }
+        }
+        if (c == 0 || ret)
+            break;
+    }
+    bin_reader_close(r);
+    if (ret)
+        goto clean;
+
+    memset(&iw, 0, sizeof(bin_idx_writer_t));
+    iw.w = bin_writer_open(out, version);
+    if (iw.w == NULL) {
+        ret = 1;
+        goto clean;
+    }
+
+    if (n_runs == 0) {
+        ks_introsort_bin_rec(n, a);
+        for (i = 0; i < n; ++i)
+            bin_idx_writer_add(&iw, &a[i]);
+    } else {
+        // the last chunk is kept in memory as a run
+        ks_introsort_bin_rec(n, a);
+        runs = (bin_reader_t **) calloc(n_runs, sizeof(bin_reader_t *));
+        heap = (bin_run_t *) malloc((n_runs + 1) * sizeof(bin_run_t));
+        k = 0;
+        for (j = 0; j < n_runs; ++j) {
+            sprintf(tmp, "%s.tmp.%04u", out, j);
+            runs[j] = bin_reader_open(tmp);
+            if (runs[j] == NULL || bin_reader_read(runs[j], &rec, 1) != 1) {
+                ret = 1;
+                break;
+            }
+            bin_rec_get(&heap[k].r, rec);
+            heap[k++].i = j;
+        }
+        if (!ret && n > 0) {
+            heap[k].r = a[0];
+            heap[k++].i = n_runs;
+        }
+        i = 1;
+        for (j = k >> 1; j > 0; --j)
+            bin_run_heapdown(heap, j - 1, k);
+        while (!ret && k > 0) {
+            bin_idx_writer_add(&iw, &heap->r);
+            j = heap->i;
+            if (j == n_runs) {
+                if (i < n)
+                    heap->r = a[i++];
+                else
+                    heap[0] = heap[--k];
+            } else {
+                c = bin_reader_read(runs[j], &rec, 1);
+                if (c < 0)
+                    ret = 1;
+                else if (c == 1)
+                    bin_rec_get(&heap->r, rec);
+                else
+                    heap[0] = heap[--k];
+            }
+            bin_run_heapdown(heap, 0, k);
+        }
+        for (j = 0; j < n_runs; ++j)
+            if (runs[j])
+                bin_reader_close(runs[j]);
+        free(runs);
+        free(heap);
+    }
+
+    if (bin_writer_close(iw.w)) {
+        fprintf(stderr, "[E::%s] error writing file %s\n", __func__, out);
+        ret = 1;
+    }
+    if (!ret) {
+        fp = fopen(out, "r");
+        ret = fp == NULL || bin_stamp_get(fileno(fp), &iw.idx.stamp);
+        if (fp)
+            fclose(fp);
+        sprintf(tmp, "%s.idx", out);
+        if (!ret)
+            ret = bin_idx_save(tmp, &iw.idx);
+    }
+    free(iw.idx.a);
+
+clean:
+    for (j = 0; j < n_runs; ++j) {
+        sprintf(tmp, "%s.tmp.%04u", out, j);
+        unlink(tmp);
+    }
+    free(tmp);
+    free(a);
+
+    return ret;
+}
+
+// load records of a BIN file with mapping quality no less than mq into the in-memory link store
+// the store is not loaded if it would take more than mem_limit bytes while loading, no limit if mem_limit < 0
+// return the size of the store in bytes, or -1 if not loaded
+long bin_mem_load(const char *f, uint8_t mq, long mem_limit)
+{
+    bin_reader_t *r;
+    bin_rec_t *a;
+    bin_idx_ent_t *e;
+    uint8_t *rec, *p;
+    uint64_t i, n, m, max_n;
+    uint32_t v[4];
+    long c;
+
+    bin_mem_unload();
+
+    r = bin_reader_open(f);
+    if (r == NULL)
+        return -1;
+
+    // records are sorted before the image is made, both are counted towards the limit
+    max_n = mem_limit < 0? UINT64_MAX : (uint64_t) mem_limit / (sizeof(bin_rec_t) + BIN_RECORD_SIZE);
+    a = 0;
+    n = m = 0;
+    while ((c = bin_reader_read(r, &rec, BIN_BLOCK_SIZE)) > 0) {
+        for (i = 0; i < (uint64_t) c; ++i, rec += BIN_RECORD_SIZE) {
+            if (rec[16] < mq)
+                continue;
+            if (n == max_n) {
+                c = -1;
+                break;
+            }
+            if (n == m) {
+                m = m? MIN(m << 1, max_n) : MIN(1 << 20, max_n);
+                a = (bin_rec_t *) realloc(a, m * sizeof(bin_rec_t));
+            }
+            bin_rec_get(&a[n++], rec);
+        }
+        if (c < 0)
+            break;
+    }
+    bin_reader_close(r);
+    if (c < 0) {
+        free(a);
+        return -1;
+    }
+
+    ks_introsort_bin_rec(n, a);
+
+    bin_mem = (bin_mem_t *) calloc(1, sizeof(bin_mem_t));
+    bin_mem->f = strdup(f);
+    bin_mem->size = sizeof(int64_t) + n * BIN_RECORD_SIZE;
+    bin_mem->map = (uint8_t *) malloc(bin_mem->size);
+    bin_mem->idx = (bin_idx_t *) calloc(1, sizeof(bin_idx_t));
+    bin_mem->idx->stamp.size = bin_mem->size;
+    m = 0;
+    p = bin_mem->map;
+    write_bin_header_mem(p);
+    p += sizeof(int64_t);
+    e = 0;
+    for (i = 0; i < n; ++i, p += BIN_RECORD_SIZE) {
+        v[0] = a[i].x >> 32;
+        v[1] = a[i].y >> 32;
+        v[2] = (uint32_t) a[i].x;
+        v[3] = (uint32_t) a[i].y;
+        memcpy(p, v, 16);
+        p[16] = a[i].q;
+        if (!e || e->c0 != v[0] || e->c1 != v[2]) {
+            if (bin_mem->idx->n == m) {
+                m = m? m << 1 : 1024;
+                bin_mem->idx->a = (bin_idx_ent_t *) realloc(bin_mem->idx->a, m * sizeof(bin_idx_ent_t));
+            }
+            e = &bin_mem->idx->a[bin_mem->idx->n++];
+            e->c0 = v[0];
+            e->c1 = v[2];
+            e->skip = 0;
+            e->off = p - bin_mem->map;
+            e->n = 0;
+        }
+        ++e->n;
+    }
+    free(a);
+
+    return (long) (bin_mem->size + bin_mem->idx->n * sizeof(bin_idx_ent_t));
+}
+
+void bin_mem_unload(void)
+{
+    if (!bin_mem)
+        return;
+    free(bin_mem->f);
+    free(bin_mem->map);
+    bin_idx_destroy(bin_mem->idx);
+    free(bin_mem);
+    bin_mem = 0;
+}
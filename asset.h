@@ -31,6 +31,7 @@
 #define ASSET_H_
 
 #include <stdint.h>
+#include <stdio.h>
 
 #define SWAP(T, x, y) {T tmp = x; x = y; y = tmp;}
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
@@ -39,8 +40,89 @@
 #define GAP_SZ 200
 #define BIN_H 0x5941485342494E56
 #define BIN_V 0x1
+#define BIN_H2 0x5941485342494E32 // BIN version 2
+#define BIN_RECORD_SIZE 17
+#define BIN_BLOCK_SIZE 65536 // max number of records in a BIN version 2 block
+#define BIN_IDX_H 0x5941485349445833 // BIN index file
 #define LINK_EVIDENCE "proximity_ligation"
 
+// index of a sorted BIN file
+// records of intra-contig pairs come first, then the inter-contig pairs
+// records of each contig pair are sorted by mapping quality in descending order, then by (p0, p1)
+typedef struct {
+    uint32_t c0, c1; // contig pair
+    uint32_t skip; // number of records to skip in the block (version 2)
+    uint64_t off; // file offset of the first record (version 1) or the block containing it (version 2)
+    uint64_t n; // number of records
+} bin_idx_ent_t;
+
+// fingerprint of a BIN file, an index is only used for the file it was written for
+typedef struct {
+    uint64_t size; // file size
+    uint64_t ino; // inode number
+    int64_t mtime; // modification time
+    uint32_t crc; // CRC32 of the header and the first block
+} bin_stamp_t;
+
+typedef struct {
+    bin_stamp_t stamp; // fingerprint of the indexed BIN file
+    uint64_t n; // number of contig pairs
+    bin_idx_ent_t *a; // sorted by contig pair
+} bin_idx_t;
+
+// BIN file reader
+// the file is memory mapped if possible and records are returned without copying
+// otherwise, e.g., for pipes, records are read into a buffer
+// version 2 blocks are decoded into the buffer as version 1 records
+typedef struct {
+    FILE *fp;
+    int version;
+    uint8_t *map; // mapped file, NULL if not mapped
+    size_t size, off, adv; // file size, current offset, offset released from page cache
+    uint8_t *buf; // buffer for unmapped reads or decoded records
+    size_t m; // buffer size in records
+    uint8_t *blk; // buffer for an encoded block of unmapped reads
+    int blk_h; // blk holds the header of the next block
+    uint32_t skip; // records to skip in the next block after a seek
+    size_t dec_off, dec_end; // offsets of the version 2 block decoded into buf for selected runs and of the block after it
+    uint32_t dec_n; // number of records of the decoded block, 0 if buf holds no decoded block
+    size_t buf_i, buf_n; // next and number of version 2 records decoded into buf by sequential reads
+    bin_idx_t *idx; // index of a sorted file, NULL if not available
+    bin_idx_ent_t *sel; // selected runs of records
+    uint64_t sel_n, sel_i, sel_r; // number of runs, the next run and records left in the current run
+    uint8_t sel_mq; // records of a run below this mapping quality are skipped, 0 if runs are trimmed already
+    int64_t magic_number;
+    int error;
+    int mem; // records are read from the in-memory link store
+} bin_reader_t;
+
+// BIN file writer
+// version 1: records of i0, p0, i1, p1 (uint32_t) and q (uint8_t)
+// version 2: blocks of at most BIN_BLOCK_SIZE records
+//            block header: record number and payload size (uint32_t)
+//            payload: columns of i0, p0, i1, p1 and q
+//            i0 is delta encoded, p0 is delta encoded if i0 is the same as the previous record
+//            i1 is encoded as i1 - i0, p1 as p1 - p0 if i0 == i1
+//            all integer columns are zigzag varints
+typedef struct {
+    FILE *fp;
+    int version;
+    uint32_t n; // number of records in the current block
+    uint32_t *i0, *p0, *i1, *p1;
+    uint8_t *q;
+    uint8_t *buf; // buffer for encoded blocks
+    uint64_t off; // file offset of the current block
+    long rec_c; // number of records written
+} bin_writer_t;
+
+// BIN records decoded into columns
+// only records passing the mapping quality filter are kept
+typedef struct {
+    uint32_t n, m; // number of records and capacity
+    uint32_t *c0, *p0, *c1, *p1;
+    uint8_t *q;
+} bin_cols_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -54,8 +136,29 @@ int file_copy(char *fin, char *fout);
 int8_t is_read_pair(const char *rname0, const char *rname1);
 uint32_t div_ceil(uint64_t x, uint32_t y);
 uint64_t linear_scale(uint64_t g, int *scale, uint64_t max_g);
-void write_bin_header(FILE *fo);
+double median_double(double *a, uint32_t n);
+double median_int32(int32_t *a, uint32_t n);
+void write_bin_header(FILE *fo, int version);
 int is_valid_bin_header(int64_t magic_number);
+int bin_header_version(int64_t magic_number);
+bin_writer_t *bin_writer_open(const char *f, int version);
+void bin_writer_add(bin_writer_t *w, uint32_t i0, uint32_t p0, uint32_t i1, uint32_t p1, uint8_t q);
+int bin_writer_close(bin_writer_t *w);
+void bin_writer_tell(bin_writer_t *w, uint64_t *off, uint32_t *skip);
+long bin_reader_select(bin_reader_t *r, int (*keep)(uint32_t c0, uint32_t c1, void *data), void *data, uint8_t mq);
+int bin_sort_file(const char *f, const char *out, int version, long mem_limit);
+bin_idx_t *bin_idx_load(const char *f, int fd);
+void bin_idx_remove(const char *f);
+void bin_idx_destroy(bin_idx_t *idx);
+bin_reader_t *bin_reader_open(const char *f);
+long bin_reader_read(bin_reader_t *r, uint8_t **rec, long n);
+long bin_reader_count(bin_reader_t *r);
+void bin_reader_close(bin_reader_t *r);
+void bin_cols_init(bin_cols_t *cols, uint32_t m);
+void bin_cols_destroy(bin_cols_t *cols);
+uint32_t bin_cols_decode(bin_cols_t *cols, const uint8_t *rec, uint32_t n, uint8_t mq);
+long bin_mem_load(const char *f, uint8_t mq, long mem_limit);
+void bin_mem_unload(void);
 #ifdef __cplusplus
 }
 #endif
@@ -3,7 +3,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <pthread.h>
 #include "bamlite.h"
+#include "kthread.h"
 
 #ifdef USE_MALLOC_WRAPPERS
 #  include "malloc_wrap.h"
@@ -255,3 +257,278 @@ int bamlite_gzclose(gzFile file) {
 	return ret;
 }
 #endif /* USE_VERBOSE_ZLIB_WRAPPERS */
+
+/***************************************
+ * BGZF blocks inflated on many threads *
+ ***************************************/
+
+#ifdef USE_VERBOSE_ZLIB_WRAPPERS
+#  define bam_gzopen(fn, mode)      bamlite_gzopen(fn, mode)
+#  define bam_gzread(fp, buf, size) bamlite_gzread(fp, buf, size)
+#  define bam_gzclose(fp)           bamlite_gzclose(fp)
+#else
+#  define bam_gzopen(fn, mode)      gzopen(fn, mode)
+#  define bam_gzread(fp, buf, size) gzread(fp, buf, size)
+#  define bam_gzclose(fp)           gzclose(fp)
+#endif
+
+#define BGZF_MAX_BLOCK_SIZE 0x10000
+#define BGZF_BATCH_BLOCKS 64 // blocks inflated by each thread in a batch
+#define BGZF_QUEUE_SIZE 2 // batches inflated ahead of the reader
+
+typedef struct bgzf_batch_s {
+	int n; // number of blocks
+	uint8_t *raw, *out; // compressed and inflated blocks
+	size_t *roff, *ooff; // offsets of the blocks in raw and out [n + 1]
+	int err;
+	struct bgzf_batch_s *next;
+} bgzf_batch_t;
+
+struct bam_file_s {
+	gzFile gz; // read through zlib if not NULL
+	FILE *fp;
+	int n_threads;
+	pthread_t tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cv;
+	bgzf_batch_t *head, *tail; // inflated batches in file order
+	int n_queued, done, stop, err;
+	bgzf_batch_t *cur; // batch being read
+	size_t cur_i; // read position in cur->out
+};
+
+static inline uint16_t bgzf_u16(const uint8_t *p) { return p[0] | p[1] << 8; }
+static inline uint32_t bgzf_u32(const uint8_t *p) { return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24; }
+
+// read the header of the next BGZF block into b[0..12+XLEN) and return the block size; 0 on EOF, -1 on error
+static int bgzf_read_header(FILE *fp, uint8_t *b)
+{
+	size_t n;
+	int i, xlen;
+	n = fread(b, 1, 12, fp);
+	if (n == 0) return 0;
+	if (n != 12 || b[0] != 31 || b[1] != 139 || b[2] != 8 || !(b[3] & 4)) return -1;
+	xlen = bgzf_u16(b + 10);
+	if (xlen > BGZF_MAX_BLOCK_SIZE - 20) return -1;
+	if (fread(b + 12, 1, xlen, fp) != (size_t)xlen) return -1;
+	for (i = 12; i + 4 <= 12 + xlen; i += 4 + bgzf_u16(b + i + 2))
+		if (b[i] == 'B' && b[i + 1] == 'C' && bgzf_u16(b + i + 2) == 2 && i + 6 <= 12 + xlen)
+			return bgzf_u16(b + i + 4) + 1;
+	return -1;
+}
+
+static void bgzf_batch_destroy(bgzf_batch_t *bt)
+{
+	if (bt == 0) return;
+	free(bt->raw); free(bt->out); free(bt->roff); free(bt->ooff);
+	free(bt);
+}
+
+// read up to n blocks from the file; return NULL on EOF
+static bgzf_batch_t *bgzf_batch_read(FILE *fp, int n, int *err)
+{
+	bgzf_batch_t *bt;
+	size_t l, m;
+	int bs, xlen;
+
+	bt = (bgzf_batch_t*)calloc(1, sizeof(bgzf_batch_t));
+	bt->roff = (size_t*)malloc((n + 1) * sizeof(size_t));
+	bt->ooff = (size_t*)malloc((n + 1) * sizeof(size_t));
+	m = (size_t)n * BGZF_MAX_BLOCK_SIZE;
+	bt->raw = (uint8_t*)malloc(m);
+	l = 0;
+	bt->roff[0] = bt->ooff[0] = 0;
+	while (bt->n < n) {
+		bs = bgzf_read_header(fp, bt->raw + l);
+		if (bs == 0) break;
+		xlen = bs > 0? bgzf_u16(bt->raw + l + 10) : 0;
+		if (bs < 0 || bs < 12 + xlen + 8 || fread(bt->raw + l + 12 + xlen, 1, bs - 12 - xlen, fp) != (size_t)(bs - 12 - xlen)) {
+			*err = 1;
+			break;
+		}
+		l += bs;
+		// ISIZE from the block trailer
+		if (bgzf_u32(bt->raw + l - 4) > BGZF_MAX_BLOCK_SIZE) {
+			*err = 1;
+			break;
+		}
+		bt->roff[++bt->n] = l;
+		bt->ooff[bt->n] = bt->ooff[bt->n - 1] + bgzf_u32(bt->raw + l - 4);
+	}
+	if (bt->n == 0) {
+		bgzf_batch_destroy(bt);
+		return 0;
+	}
+	bt->out = (uint8_t*)malloc(bt->ooff[bt->n] + 1);
+	return bt;
+}
+
+static void bgzf_inflate_worker(void *data, long i, int tid)
+{
+	bgzf_batch_t *bt = (bgzf_batch_t*)data;
+	uint8_t *b = bt->raw + bt->roff[i];
+	size_t bs = bt->roff[i + 1] - bt->roff[i], isize = bt->ooff[i + 1] - bt->ooff[i];
+	int xlen = bgzf_u16(b + 10), ret;
+	z_stream zs;
+
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, -15) != Z_OK) {
+		bt->err = 1;
+		return;
+	}
+	zs.next_in = b + 12 + xlen;
+	zs.avail_in = bs - 12 - xlen - 8;
+	zs.next_out = bt->out + bt->ooff[i];
+	zs.avail_out = isize;
+	ret = inflate(&zs, Z_FINISH);
+	if (ret != Z_STREAM_END || zs.total_out != isize || crc32(crc32(0L, Z_NULL, 0), bt->out + bt->ooff[i], isize) != bgzf_u32(b + bs - 8))
+		bt->err = 1;
+	inflateEnd(&zs);
+}
+
+// read and inflate batches ahead of the reader, batches are queued in file order
+static void *bgzf_reader_thread(void *data)
+{
+	bamFile fp = (bamFile)data;
+	bgzf_batch_t *bt;
+	int err = 0, done;
+
+	while (1) {
+		bt = bgzf_batch_read(fp->fp, fp->n_threads * BGZF_BATCH_BLOCKS, &err);
+		if (bt) {
+			kt_for(fp->n_threads, bgzf_inflate_worker, bt, bt->n);
+			err |= bt->err;
+		}
+		pthread_mutex_lock(&fp->lock);
+		while (fp->n_queued >= BGZF_QUEUE_SIZE && !fp->stop)
+			pthread_cond_wait(&fp->cv, &fp->lock);
+		done = fp->stop || bt == 0 || err;
+		if (bt && !bt->err && !fp->stop) { // blocks read before a truncated block are still delivered
+			if (fp->tail) fp->tail->next = bt;
+			else fp->head = bt;
+			fp->tail = bt;
+			++fp->n_queued;
+			bt = 0;
+		}
+		fp->err = err;
+		fp->done = done;
+		pthread_cond_broadcast(&fp->cv);
+		pthread_mutex_unlock(&fp->lock);
+		bgzf_batch_destroy(bt);
+		if (done) break;
+	}
+	return 0;
+}
+
+bamFile bamlite_open(const char *fn, const char *mode, int n_threads)
+{
+	bamFile fp;
+	uint8_t b[BGZF_MAX_BLOCK_SIZE];
+	int is_bgzf;
+
+	fp = (bamFile)calloc(1, sizeof(struct bam_file_s));
+	fp->n_threads = n_threads;
+	// BGZF blocks are only inflated in parallel for regular files
+	if (n_threads > 1 && strstr(mode, "r") && strcmp(fn, "-") != 0) {
+		if ((fp->fp = fopen(fn, "rb")) == 0) {
+			fprintf(stderr, "Couldn't open %s : %s\n", fn, strerror(errno));
+			free(fp);
+			return 0;
+		}
+		is_bgzf = bgzf_read_header(fp->fp, b) > 0;
+		rewind(fp->fp);
+		if (is_bgzf) {
+			pthread_mutex_init(&fp->lock, 0);
+			pthread_cond_init(&fp->cv, 0);
+			pthread_create(&fp->tid, 0, bgzf_reader_thread, fp);
+			return fp;
+		}
+		fclose(fp->fp);
+		fp->fp = 0;
+	}
+	if ((fp->gz = bam_gzopen(fn, mode)) == 0) {
+		free(fp);
+		return 0;
+	}
+	return fp;
+}
+
+// read from an opened zlib stream, which is closed with the BAM file
+bamFile bamlite_dopen(gzFile gz)
+{
+	bamFile fp;
+	fp = (bamFile)calloc(1, sizeof(struct bam_file_s));
+	fp->gz = gz;
+	fp->n_threads = 1;
+	return fp;
+}
+
+int bamlite_read(bamFile fp, void *ptr, unsigned int len)
+{
+	bgzf_batch_t *bt;
+	size_t l, n;
+
+	if (fp->gz) return bam_gzread(fp->gz, ptr, len);
+	n = 0;
+	while (n < len) {
+		if (fp->cur && fp->cur_i < fp->cur->ooff[fp->cur->n]) {
+			l = fp->cur->ooff[fp->cur->n] - fp->cur_i;
+			if (l > len - n) l = len - n;
+			memcpy((uint8_t*)ptr + n, fp->cur->out + fp->cur_i, l);
+			fp->cur_i += l;
+			n += l;
+			continue;
+		}
+		bgzf_batch_destroy(fp->cur);
+		fp->cur = 0;
+		pthread_mutex_lock(&fp->lock);
+		while (fp->head == 0 && !fp->done)
+			pthread_cond_wait(&fp->cv, &fp->lock);
+		bt = fp->head;
+		if (bt) {
+			fp->head = bt->next;
+			if (fp->head == 0) fp->tail = 0;
+			--fp->n_queued;
+			pthread_cond_broadcast(&fp->cv);
+		}
+		pthread_mutex_unlock(&fp->lock);
+		if (bt == 0) {
+			if (fp->err) {
+				fprintf(stderr, "BGZF read error: corrupted or truncated block\n");
+				return -1;
+			}
+			break;
+		}
+		fp->cur = bt;
+		fp->cur_i = 0;
+	}
+	return n;
+}
+
+int bamlite_close(bamFile fp)
+{
+	bgzf_batch_t *bt;
+	int ret;
+
+	if (fp == 0) return -1;
+	if (fp->gz) {
+		ret = bam_gzclose(fp->gz);
+		free(fp);
+		return ret;
+	}
+	pthread_mutex_lock(&fp->lock);
+	fp->stop = 1;
+	pthread_cond_broadcast(&fp->cv);
+	pthread_mutex_unlock(&fp->lock);
+	pthread_join(fp->tid, 0);
+	while ((bt = fp->head) != 0) {
+		fp->head = bt->next;
+		bgzf_batch_destroy(bt);
+	}
+	bgzf_batch_destroy(fp->cur);
+	pthread_mutex_destroy(&fp->lock);
+	pthread_cond_destroy(&fp->cv);
+	ret = fclose(fp->fp);
+	free(fp);
+	return ret;
+}
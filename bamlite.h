@@ -10,19 +10,14 @@
 
 #define USE_VERBOSE_ZLIB_WRAPPERS
 
-typedef gzFile bamFile;
-#ifdef USE_VERBOSE_ZLIB_WRAPPERS
-/* These print error messages on failure */
-#  define bam_open(fn, mode)      bamlite_gzopen(fn, mode)
-#  define bam_dopen(fd, mode)     gzdopen(fd, mode)
-#  define bam_close(fp)           bamlite_gzclose(fp)
-#  define bam_read(fp, buf, size) bamlite_gzread(fp, buf, size)
-#else
-#  define bam_open(fn, mode)      gzopen(fn, mode)
-#  define bam_dopen(fd, mode)     gzdopen(fd, mode)
-#  define bam_close(fp)           gzclose(fp)
-#  define bam_read(fp, buf, size) gzread(fp, buf, size)
-#endif /* USE_VERBOSE_ZLIB_WRAPPERS */
+/* A BAM file is read through zlib, or with BGZF blocks inflated on
+ * multiple threads in the background if opened with bam_open_mt() */
+typedef struct bam_file_s *bamFile;
+#define bam_open(fn, mode)      bamlite_open(fn, mode, 1)
+#define bam_open_mt(fn, n_threads) bamlite_open(fn, "r", n_threads)
+#define bam_dopen(gz)           bamlite_dopen(gz)
+#define bam_close(fp)           bamlite_close(fp)
+#define bam_read(fp, buf, size) bamlite_read(fp, buf, size)
 
 typedef struct {
 	int32_t n_targets;
@@ -112,6 +107,11 @@ extern "C" {
     /*! Returns the sort order from the @HD SO: field */
     enum bam_sort_order bam_hrecs_sort_order(bam_header_t *header);
 
+	bamFile bamlite_open(const char *fn, const char *mode, int n_threads);
+	bamFile bamlite_dopen(gzFile gz);
+	int bamlite_read(bamFile fp, void *ptr, unsigned int len);
+	int bamlite_close(bamFile fp);
+
 #ifdef USE_VERBOSE_ZLIB_WRAPPERS
 	gzFile bamlite_gzopen(const char *fn, const char *mode);
 	int bamlite_gzread(gzFile file, void *ptr, unsigned int len);
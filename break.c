@@ -31,12 +31,16 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "kdq.h"
+#include "ksort.h"
 
 #include "sdict.h"
+#include "link.h"
 #include "break.h"
 #include "asset.h"
+#include "kthread.h"
 
 #undef REMOVE_NOISE
 #undef DEBUG_LOCAL_BREAK
@@ -75,72 +79,68 @@ void link_mat_destroy(link_mat_t *link_mat)
     free(link_mat);
 }
 
-uint32_t estimate_dist_thres_from_file(const char *f, asm_dict_t *dict, double min_frac, uint32_t resolution, uint8_t mq)
+typedef struct {
+    uint32_t resolution;
+    uint32_t *link_c;
+    int atomic;
+    long intra_c;
+} dist_hist_acc_t;
+
+static void dist_hist_add(void *data, link_pair_t *pairs, uint32_t n, int tid)
+{
+    uint32_t i, b;
+    long intra_c;
+    dist_hist_acc_t *acc;
+
+    acc = (dist_hist_acc_t *) data;
+    intra_c = 0;
+    for (i = 0; i < n; ++i) {
+        if (pairs[i].i0 == pairs[i].i1) {
+            b = labs((long) pairs[i].p0 - pairs[i].p1) / acc->resolution;
+            if (acc->atomic)
+                __atomic_fetch_add(&acc->link_c[b], 1, __ATOMIC_RELAXED);
+            else
+                ++acc->link_c[b];
+            ++intra_c;
+        }
+    }
+    __atomic_fetch_add(&acc->intra_c, intra_c, __ATOMIC_RELAXED);
+}
+
+uint32_t estimate_dist_thres_from_file(const char *f, asm_dict_t *dict, double min_frac, uint32_t resolution, uint8_t mq, int n_threads)
 {
-    FILE *fp;
-    uint32_t i, m, i0, i1, nb, *link_c;
-    uint8_t buffer[BUFF_SIZE * 17];
-    uint64_t max_len, p0, p1;
-    int64_t magic_number;
-    long pair_c, intra_c, cum_c;
+    uint32_t i, nb;
+    uint64_t max_len;
+    long cum_c;
+    dist_hist_acc_t acc;
+    link_scan_t *scan;
 
     max_len = 0;
     for (i = 0; i < dict->n; ++i)
         if (dict->s[i].len > max_len)
             max_len = dict->s[i].len;
     nb = div_ceil(max_len, resolution);
-    link_c = (uint32_t *) calloc(nb, sizeof(uint32_t));
-
-    fp = fopen(f, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "[E::%s] cannot open file %s for reading\n", __func__, f);
-        exit(EXIT_FAILURE);
-    }
+    acc.resolution = resolution;
+    acc.link_c = (uint32_t *) calloc(nb, sizeof(uint32_t));
+    acc.atomic = n_threads > 1;
+    acc.intra_c = 0;
 
-    m = fread(&magic_number, sizeof(int64_t), 1, fp);
-    if (!m || !is_valid_bin_header(magic_number)) {
-        fprintf(stderr, "[E::%s] not a valid BIN file\n", __func__);
+    scan = link_scan_init(dict, mq, n_threads);
+    scan->intra_only = 1;
+    link_scan_add(scan, dist_hist_add, 0, &acc);
+    if (link_scan_file(scan, f))
         exit(EXIT_FAILURE);
-    }
-
-    pair_c = 0;
-    intra_c = 0;
-    while (1) {
-        m = fread(buffer, sizeof(uint8_t), BUFF_SIZE * 17, fp);
-
-        for (i = 0; i < m; i += 17) {
-            if (*(uint8_t *) (buffer + i + 16) < mq)
-                continue;
-
-            sd_coordinate_conversion(dict, *(uint32_t *) (buffer + i),     *(uint32_t *) (buffer + i + 4),  &i0, &p0, 0);
-            sd_coordinate_conversion(dict, *(uint32_t *) (buffer + i + 8), *(uint32_t *) (buffer + i + 12), &i1, &p1, 0);
-
-            if (i0 == i1) {
-                ++link_c[labs((long) p0 - p1) / resolution];
-                ++intra_c;
-            }
-            
-            ++pair_c;
-        }
-
-        if (m < BUFF_SIZE * 17) {
-            if (ferror(fp))
-                return 0;
-            break;
-        }
-    }
-    
-    fclose(fp);
+#ifdef DEBUG
+    fprintf(stderr, "[DEBUG::%s] %ld read pairs processed, intra links: %ld \n", __func__, scan->link_c, acc.intra_c);
+#endif
+    link_scan_destroy(scan);
     
     i = 0;
     cum_c = 0;
-    while (cum_c < intra_c * min_frac)
-        cum_c += link_c[i++];
-    free(link_c);
+    while (cum_c < acc.intra_c * min_frac)
+        cum_c += acc.link_c[i++];
+    free(acc.link_c);
 
-#ifdef DEBUG
-    fprintf(stderr, "[DEBUG::%s] %ld read pairs processed, intra links: %ld \n", __func__, pair_c, intra_c);
-#endif
     return i * resolution;
 }
 
@@ -184,26 +184,53 @@ static void calc_moving_average(int64_t *arr, int32_t n, int32_t a)
     free(buff);
 }
 
-link_mat_t *link_mat_from_file(const char *f, asm_dict_t *dict, uint32_t dist_thres, uint32_t resolution, double noise, uint32_t move_avg, uint8_t mq)
+typedef struct {
+    link_mat_t *link_mat;
+    uint32_t dist_thres;
+    int atomic;
+    long intra_c;
+} link_cov_acc_t;
+
+static void link_cov_add(void *data, link_pair_t *pairs, uint32_t n, int tid)
 {
-    FILE *fp;
-    uint32_t i, j, m, n, i0, i1;
+    uint32_t i, resolution, dist_thres;
     uint64_t p0, p1;
-    int64_t magic_number;
-    uint8_t buffer[BUFF_SIZE * 17];
-    long pair_c, intra_c;
+    long intra_c;
+    int64_t *l0, *l1;
+    link_cov_acc_t *acc;
+    link_mat_t *link_mat;
 
-    fp = fopen(f, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "[E::%s] cannot open file %s for reading\n", __func__, f);
-        exit(EXIT_FAILURE);
+    acc = (link_cov_acc_t *) data;
+    link_mat = acc->link_mat;
+    resolution = link_mat->b;
+    dist_thres = acc->dist_thres;
+    intra_c = 0;
+    for (i = 0; i < n; ++i) {
+        p0 = pairs[i].p0;
+        p1 = pairs[i].p1;
+        if (p0 > p1)
+            SWAP(uint64_t, p0, p1);
+        if (pairs[i].i0 == pairs[i].i1 && p1 - p0 <= dist_thres) {
+            l0 = &link_mat->link[pairs[i].i0].link[(MAX(p0, 1) - 1) / resolution];
+            l1 = &link_mat->link[pairs[i].i1].link[(MAX(p1, 1) - 1) / resolution];
+            if (acc->atomic) {
+                __atomic_fetch_add(l0, 1, __ATOMIC_RELAXED);
+                __atomic_fetch_sub(l1, 1, __ATOMIC_RELAXED);
+            } else {
+                *l0 += 1;
+                *l1 -= 1;
+            }
+            ++intra_c;
+        }
     }
+    __atomic_fetch_add(&acc->intra_c, intra_c, __ATOMIC_RELAXED);
+}
 
-    m = fread(&magic_number, sizeof(int64_t), 1, fp);
-    if (!m || !is_valid_bin_header(magic_number)) {
-        fprintf(stderr, "[E::%s] not a valid BIN file\n", __func__);
-        exit(EXIT_FAILURE);
-    }
+link_mat_t *link_mat_from_file(const char *f, asm_dict_t *dict, uint32_t dist_thres, uint32_t resolution, double noise, uint32_t move_avg, uint8_t mq, int n_threads)
+{
+    uint32_t i, j, n;
+    link_cov_acc_t acc;
+    link_scan_t *scan;
 
     link_mat_t *link_mat = (link_mat_t *) malloc(sizeof(link_mat_t));
     link_mat->b = resolution;
@@ -216,39 +243,19 @@ link_mat_t *link_mat_from_file(const char *f, asm_dict_t *dict, uint32_t dist_th
         link_mat->link[i].link = (int64_t *) calloc(n, sizeof(int64_t));
     }
 
-    pair_c = intra_c = 0;
-    while (1) {
-        m = fread(buffer, sizeof(uint8_t), BUFF_SIZE * 17, fp);
-
-        for (i = 0; i < m; i += 17) {
-            if (*(uint8_t *) (buffer + i + 16) < mq)
-                continue;
-
-            sd_coordinate_conversion(dict, *(uint32_t *) (buffer + i),     *(uint32_t *) (buffer + i + 4),  &i0, &p0, 0);
-            sd_coordinate_conversion(dict, *(uint32_t *) (buffer + i + 8), *(uint32_t *) (buffer + i + 12), &i1, &p1, 0);
-
-            if (p0 > p1)
-                SWAP(uint64_t, p0, p1);
-            if (i0 == i1 && p1 - p0 <= dist_thres) {
-                link_mat->link[i0].link[(MAX(p0, 1) - 1) / resolution] += 1;
-                link_mat->link[i1].link[(MAX(p1, 1) - 1) / resolution] -= 1;
-                ++intra_c;
-            }
-            
-            ++pair_c;
-        }
-        
-        if (m < BUFF_SIZE * 17) {
-            if (ferror(fp))
-                return 0;
-            break;
-        }
-    }
-    fclose(fp);
-
+    acc.link_mat = link_mat;
+    acc.dist_thres = dist_thres;
+    acc.atomic = n_threads > 1;
+    acc.intra_c = 0;
+    scan = link_scan_init(dict, mq, n_threads);
+    scan->intra_only = 1;
+    link_scan_add(scan, link_cov_add, 0, &acc);
+    if (link_scan_file(scan, f))
+        exit(EXIT_FAILURE);
 #ifdef DEBUG
-    fprintf(stderr, "[DEBUG::%s] %ld read pairs processed, intra links: %ld \n", __func__, pair_c, intra_c);
+    fprintf(stderr, "[DEBUG::%s] %ld read pairs processed, intra links: %ld \n", __func__, scan->link_c, acc.intra_c);
 #endif
+    link_scan_destroy(scan);
     
     int64_t *link;
     for (i = 0; i < link_mat->n; ++i) {
@@ -286,22 +293,28 @@ link_mat_t *link_mat_from_file(const char *f, asm_dict_t *dict, uint32_t dist_th
     return link_mat;
 }
 
-// sort by position = higher 32 bits
-int pos_cmp(const void *p, const void *q)
+KDQ_INIT(int64_t)
+
+// median link count of bins [s, e], link count = lower 32 bits
+// counts are copied to cnt so that bins stay in position order
+static double link_cnt_median(int64_t *link, uint32_t s, uint32_t e, int32_t *cnt)
 {
-    int64_t d = *(int64_t *) p - *(int64_t *) q;
-    return d == 0? 0 : (d > 0? 1 : -1);
+    uint32_t i;
+    for (i = s; i <= e; ++i)
+        cnt[i - s] = (int32_t) link[i];
+    return median_int32(cnt, e - s + 1);
 }
 
-// sort by link count = lower 32 bits
-int cnt_cmp(const void *p, const void *q)
+// buffer of link counts for the largest link vector
+static int32_t *link_cnt_buf(link_mat_t *link_mat)
 {
-    int32_t d = *(int32_t *) p - *(int32_t *) q;
-    return d == 0? 0 : (d > 0? 1 : -1);
+    uint32_t i, n;
+    n = 1;
+    for (i = 0; i < link_mat->n; ++i)
+        n = MAX(n, link_mat->link[i].n);
+    return (int32_t *) malloc(n * sizeof(int32_t));
 }
 
-KDQ_INIT(int64_t)
-
 static void add_break_point(bp_t *bp, uint64_t p)
 {
     if (bp->n == bp->m) {
@@ -317,7 +330,8 @@ bp_t *detect_break_points_local_joint(link_mat_t *link_mat, uint32_t bin_size, d
     uint32_t i, j, b_n, b_m;
     double mcnt;
     int64_t *link;
-    uint32_t s, e, t;
+    int32_t *cnt;
+    uint32_t s, e;
     int8_t a;
     bp_t *bp, *bp1;
     sd_seg_t *segs, seg;
@@ -328,6 +342,7 @@ bp_t *detect_break_points_local_joint(link_mat_t *link_mat, uint32_t bin_size, d
     b_m = 16;
     bp = (bp_t *) malloc(b_m * sizeof(bp_t));
     bp1 = 0;
+    cnt = link_cnt_buf(link_mat);
     for (i = 0; i < link_mat->n; ++i) {
         seq = dict->s[i];
         link = link_mat->link[i].link;
@@ -338,11 +353,8 @@ bp_t *detect_break_points_local_joint(link_mat_t *link_mat, uint32_t bin_size, d
             e = (MAX(seg.a + MIN(flank_size, seg.y), 1) - 1) / bin_size;
             // s = (MAX(seg.a - MIN(flank_size, seg.a), 1) - 1) / bin_size;
             // e = (MAX(seg.a + MIN(flank_size, seq.len - seg.a), 1) - 1) / bin_size;
-            t = e - s + 1;
-            qsort(link + s, t, sizeof(int64_t), cnt_cmp);
-            mcnt = t & 1? (int32_t) link[(e + s) / 2] : ((int32_t) link[(e + s) / 2] + (int32_t) link[(e + s) / 2 + 1]) / 2.;
+            mcnt = link_cnt_median(link, s, e, cnt);
             mcnt *= fold_thres;
-            qsort(link + s, t, sizeof(int64_t), pos_cmp);
 
             if ((int32_t) link[(MAX(seg.a, 1) - 1) / bin_size] < mcnt) {
                 if (!a) {
@@ -365,6 +377,7 @@ bp_t *detect_break_points_local_joint(link_mat_t *link_mat, uint32_t bin_size, d
             }
         }
     }
+    free(cnt);
 
     *bp_n = b_n;
 
@@ -419,6 +432,7 @@ bp_t *detect_break_points(link_mat_t *link_mat, uint32_t bin_size, uint32_t merg
     uint32_t i, j, k, n, m, d, b, b_n, b_m;
     double mcnt;
     int64_t *link;
+    int32_t *cnt;
     uint32_t s, e, t, min_c, p, bp_s, bp_e;
     kdq_t(int64_t) *q;
     bp_t *bp, *bp1;
@@ -430,30 +444,28 @@ bp_t *detect_break_points(link_mat_t *link_mat, uint32_t bin_size, uint32_t merg
     m = merge_size / bin_size;
     d = dual_break_thres / bin_size;
     q = kdq_init(int64_t);
+    cnt = link_cnt_buf(link_mat);
     for (i = 0; i < link_mat->n; ++i) {
         link = link_mat->link[i].link;
         n = link_mat->link[i].n;
-        // sort by link count
-        qsort(link, n, sizeof(int64_t), cnt_cmp);
+        if (n == 0)
+            continue;
         // find median
-        mcnt = n & 1? (int32_t) link[n / 2] : ((int32_t) link[n / 2] + (int32_t) link[n / 2 - 1]) / 2.;
+        mcnt = link_cnt_median(link, 0, n - 1, cnt);
         // find count threshold
         mcnt *= fold_thres;
-        // find positions below threshold
-        b = 0;
-        while (b < n && (int32_t) link[b] < mcnt)
-            ++b;
-        if (!b || b == n)
-            continue;
-        // sort by position for positions below threshold
-        qsort(link, b, sizeof(int64_t), pos_cmp);
-        // detect blocks for break points
+        // detect blocks for break points from positions below threshold
         kdq_clean(q);
-        s = link[0] >> 32;
-        e = s;
-        for (j = 1; j < b; ++j) {
+        b = 0;
+        s = e = 0;
+        for (j = 0; j < n; ++j) {
+            if ((int32_t) link[j] >= mcnt)
+                continue;
             t = link[j] >> 32;
-            if (e + m < t) {
+            if (b == 0) {
+                s = t;
+                e = s;
+            } else if (e + m < t) {
                 // new block
                 kdq_push(int64_t, q, (int64_t) s << 32 | e);
                 s = t;
@@ -461,11 +473,12 @@ bp_t *detect_break_points(link_mat_t *link_mat, uint32_t bin_size, uint32_t merg
             } else {
                 e = t;
             }
+            ++b;
         }
+        if (!b || b == n)
+            continue;
         // add last block
         kdq_push(int64_t, q, (int64_t) s << 32 | e);
-        // sort by position for all positions
-        qsort(link, n, sizeof(int64_t), pos_cmp);
         // detect precise break points
         if (b_n == b_m) {
             b_m <<= 1;
@@ -516,11 +529,8 @@ bp_t *detect_break_points(link_mat_t *link_mat, uint32_t bin_size, uint32_t merg
             for (k = 0; k < bp1->n; ++k) {
                 s = k > 0? bp1->p[k - 1] : 0;
                 e = k < bp1->n - 1? bp1->p[k + 1] : n - 1;
-                t = e - s + 1;
-                qsort(link + s, t, sizeof(int64_t), cnt_cmp);
-                mcnt = t & 1? (int32_t) link[(e + s) / 2] : ((int32_t) link[(e + s) / 2] + (int32_t) link[(e + s) / 2 + 1]) / 2.;
+                mcnt = link_cnt_median(link, s, e, cnt);
                 mcnt *= fold_thres;
-                qsort(link + s, t, sizeof(int64_t), pos_cmp);
                 if ((int32_t) link[bp1->p[k]] > mcnt)
                     kdq_push(int64_t, q, k);
             }
@@ -540,11 +550,368 @@ bp_t *detect_break_points(link_mat_t *link_mat, uint32_t bin_size, uint32_t merg
         }
     }
     kdq_destroy(int64_t, q);
+    free(cnt);
     *bp_n = b_n;
     
     return bp;
 }
 
+// contigs share the locks of link position arrays by contig index modulo LINK_POS_SHARDS
+#define LINK_POS_SHARDS 64
+
+typedef struct {
+    link_pos_mat_t *link_mat;
+    uint32_t dist_thres;
+    pthread_mutex_t mutex[LINK_POS_SHARDS];
+} link_pos_acc_t;
+
+static void link_pos_push(link_pos_t *link, uint64_t a)
+{
+    if (link->n == link->m) {
+        link->m = link->m? link->m << 1 : 16;
+        link->a = (uint64_t *) realloc(link->a, link->m * sizeof(uint64_t));
+    }
+    link->a[link->n++] = a;
+}
+
+// links are grouped by shard and each shard is locked once per batch
+static void link_pos_add(void *data, link_pair_t *pairs, uint32_t n, int tid)
+{
+    uint32_t i, j, k, h, resolution, dist_thres;
+    uint32_t c[LINK_POS_SHARDS + 1], *s;
+    uint64_t p0, p1, *a;
+    link_pos_acc_t *acc;
+    link_pos_mat_t *link_mat;
+
+    acc = (link_pos_acc_t *) data;
+    link_mat = acc->link_mat;
+    resolution = link_mat->b;
+    dist_thres = acc->dist_thres;
+    // links in the first half, grouped by shard in the second half
+    s = (uint32_t *) malloc(n * 2 * sizeof(uint32_t));
+    a = (uint64_t *) malloc(n * 2 * sizeof(uint64_t));
+    memset(c, 0, sizeof(c));
+    k = 0;
+    for (i = 0; i < n; ++i) {
+        p0 = pairs[i].p0;
+        p1 = pairs[i].p1;
+        if (p0 > p1)
+            SWAP(uint64_t, p0, p1);
+        if (pairs[i].i0 == pairs[i].i1 && p1 - p0 <= dist_thres) {
+            s[k] = pairs[i].i0;
+            a[k] = (MAX(p0, 1) - 1) / resolution << 32 | (MAX(p1, 1) - 1) / resolution;
+            ++c[s[k] % LINK_POS_SHARDS + 1];
+            ++k;
+        }
+    }
+    for (h = 0; h < LINK_POS_SHARDS; ++h)
+        c[h + 1] += c[h];
+    for (i = 0; i < k; ++i) {
+        j = n + c[s[i] % LINK_POS_SHARDS]++;
+        s[j] = s[i];
+        a[j] = a[i];
+    }
+
+    // c[h] is the end of shard h
+    for (h = 0, i = 0; h < LINK_POS_SHARDS; ++h) {
+        if (i == c[h])
+            continue;
+        pthread_mutex_lock(&acc->mutex[h]);
+        for (; i < c[h]; ++i)
+            link_pos_push(&link_mat->link[s[n + i]], a[n + i]);
+        pthread_mutex_unlock(&acc->mutex[h]);
+    }
+    __atomic_fetch_add(&link_mat->intra_c, k, __ATOMIC_RELAXED);
+
+    free(s);
+    free(a);
+}
+
+#define link_pos_key(a) (a)
+KRADIX_SORT_INIT(link_pos, uint64_t, link_pos_key, 8)
+
+static void link_pos_sort_worker(void *data, long i, int tid)
+{
+    link_pos_t *link = &((link_pos_mat_t *) data)->link[i];
+    radix_sort_link_pos(link->a, link->a + link->n);
+}
+
+link_pos_mat_t *link_pos_mat_from_file(const char *f, asm_dict_t *dict, uint32_t dist_thres, uint32_t resolution, uint8_t mq, int n_threads)
+{
+    uint32_t i;
+    link_pos_acc_t acc;
+    link_scan_t *scan;
+    link_pos_mat_t *link_mat;
+
+    link_mat = (link_pos_mat_t *) malloc(sizeof(link_pos_mat_t));
+    link_mat->b = resolution;
+    link_mat->n = dict->n;
+    link_mat->intra_c = 0;
+    link_mat->link = (link_pos_t *) calloc(link_mat->n, sizeof(link_pos_t));
+    for (i = 0; i < link_mat->n; ++i)
+        link_mat->link[i].nb = div_ceil(dict->s[i].len, resolution);
+
+    acc.link_mat = link_mat;
+    acc.dist_thres = dist_thres;
+    for (i = 0; i < LINK_POS_SHARDS; ++i)
+        pthread_mutex_init(&acc.mutex[i], 0);
+    scan = link_scan_init(dict, mq, n_threads);
+    scan->intra_only = 1;
+    link_scan_add(scan, link_pos_add, 0, &acc);
+    if (link_scan_file(scan, f))
+        exit(EXIT_FAILURE);
+#ifdef DEBUG
+    fprintf(stderr, "[DEBUG::%s] %ld read pairs processed, intra links: %ld \n", __func__, scan->link_c, link_mat->intra_c);
+#endif
+    link_scan_destroy(scan);
+    for (i = 0; i < LINK_POS_SHARDS; ++i)
+        pthread_mutex_destroy(&acc.mutex[i]);
+
+    // links were added in the order threads finished, sort them to make the sweep in break rounds possible
+    kt_for(n_threads, link_pos_sort_worker, link_mat, link_mat->n);
+
+    return link_mat;
+}
+
+// capacity of a link position array after n pushes
+static inline uint64_t link_pos_capacity(uint64_t n)
+{
+    uint64_t m;
+    if (n == 0)
+        return 0;
+    for (m = 16; m < n; m <<= 1) {}
+    return m;
+}
+
+// upper bound of the memory used by link_pos_mat_from_file, assuming all intra links in the file are kept
+// arrays grow by doubling so the allocated capacity is counted
+// with an index the intra links of each contig are known, otherwise all records are assumed to be intra links
+long estimate_link_pos_mat_rss(const char *f, asm_dict_t *dict)
+{
+    bin_reader_t *reader;
+    bin_idx_ent_t *e;
+    long bytes, n;
+    uint64_t i, m;
+
+    reader = bin_reader_open(f);
+    if (reader == 0)
+        return -1;
+    n = bin_reader_count(reader);
+    if (n < 0) {
+        bin_reader_close(reader);
+        return -1;
+    }
+
+    bytes = 0;
+    bytes += sizeof(link_pos_mat_t);
+    bytes += dict->n * sizeof(link_pos_t);
+    if (reader->idx) {
+        m = 0;
+        for (i = 0; i < reader->idx->n; ++i) {
+            e = &reader->idx->a[i];
+            if (e->c0 == e->c1 && e->c0 < dict->n)
+                m += link_pos_capacity(e->n);
+        }
+    } else {
+        // each array is at most twice its length, or 16 for short arrays
+        m = (uint64_t) n * 2 + (uint64_t) dict->n * 16;
+    }
+    bytes += m * sizeof(uint64_t);
+    bin_reader_close(reader);
+
+    return bytes;
+}
+
+void link_pos_mat_destroy(link_pos_mat_t *link_mat)
+{
+    uint32_t i;
+    for (i = 0; i < link_mat->n; ++i) {
+        free(link_mat->link[i].a);
+        free(link_mat->link[i].bp);
+    }
+    free(link_mat->link);
+    free(link_mat);
+}
+
+typedef struct {
+    link_pos_mat_t *link_mat;
+    uint32_t merge_size;
+    double fold_thres;
+    uint32_t dual_break_thres;
+    uint32_t move_avg;
+} link_pos_break_t;
+
+static int uint32_cmp(const void *p, const void *q)
+{
+    uint32_t a = *(uint32_t *) p, b = *(uint32_t *) q;
+    return (a > b) - (a < b);
+}
+
+static int uint64_cmp(const void *p, const void *q)
+{
+    uint64_t a = *(uint64_t *) p, b = *(uint64_t *) q;
+    return (a > b) - (a < b);
+}
+
+// break rounds of a single sequence
+// the sequence is split into pieces at break points of each round
+// each piece gets the same link coverage as a sequence in a file based round would do
+static void link_pos_break_worker(void *data, long i, int tid)
+{
+    uint32_t j, k, s, e, b, n, b_n, p_n, p_m, bp_n;
+    uint64_t *a;
+    uint32_t *ps;
+    int32_t ma_k;
+    int64_t *link_c;
+    link_pos_break_t *w;
+    link_pos_t *link;
+    link_mat_t link_mat;
+    bp_t *bp;
+
+    w = (link_pos_break_t *) data;
+    link = &w->link_mat->link[i];
+    b = w->link_mat->b;
+    ma_k = w->move_avg / b;
+
+    // start bin of each piece
+    p_n = 1;
+    p_m = 16;
+    ps = (uint32_t *) malloc(p_m * sizeof(uint32_t));
+    ps[0] = 0;
+    link_mat.b = b;
+    while (1) {
+        link_mat.n = p_n;
+        link_mat.link = (link_t *) malloc(p_n * sizeof(link_t));
+        for (j = 0; j < p_n; ++j) {
+            s = ps[j];
+            e = j + 1 < p_n? ps[j + 1] : link->nb;
+            link_mat.link[j].s = j;
+            link_mat.link[j].n = e - s;
+            link_mat.link[j].link = (int64_t *) calloc(e - s, sizeof(int64_t));
+        }
+
+        // links are sorted by the first end, the piece of which only moves forward
+        a = link->a;
+        k = 0;
+        for (j = 0; j < link->n; ++j) {
+            s = a[j] >> 32;
+            e = (uint32_t) a[j];
+            while (k + 1 < p_n && s >= ps[k + 1])
+                ++k;
+            if (k + 1 < p_n && e >= ps[k + 1])
+                continue;
+            link_mat.link[k].link[s - ps[k]] += 1;
+            link_mat.link[k].link[e - ps[k]] -= 1;
+        }
+
+        for (j = 0; j < p_n; ++j) {
+            link_c = link_mat.link[j].link;
+            n = link_mat.link[j].n;
+            for (k = 1; k < n; ++k)
+                link_c[k] += link_c[k - 1];
+            if (ma_k > 1)
+                calc_moving_average(link_c, n, ma_k);
+            for (k = 0; k < n; ++k)
+                link_c[k] |= (int64_t) k << 32;
+        }
+
+        bp_n = 0;
+        bp = detect_break_points(&link_mat, b, w->merge_size, w->fold_thres, w->dual_break_thres, &bp_n);
+
+        for (j = 0; j < p_n; ++j)
+            free(link_mat.link[j].link);
+        free(link_mat.link);
+
+        if (bp_n == 0) {
+            free(bp);
+            break;
+        }
+
+        ++link->r;
+        link->nr += bp_n;
+        b_n = p_n;
+        for (j = 0; j < bp_n; ++j) {
+            for (k = 0; k < bp[j].n; ++k) {
+                s = ps[bp[j].s] + bp[j].p[k] / b;
+                if (link->b_n == link->b_m) {
+                    link->b_m = link->b_m? link->b_m << 1 : 4;
+                    link->bp = (uint64_t *) realloc(link->bp, link->b_m * sizeof(uint64_t));
+                }
+                link->bp[link->b_n++] = (uint64_t) link->r << 32 | s;
+                if (p_n == p_m) {
+                    p_m <<= 1;
+                    ps = (uint32_t *) realloc(ps, p_m * sizeof(uint32_t));
+                }
+                ps[p_n++] = s;
+            }
+            free(bp[j].p);
+        }
+        free(bp);
+        if (p_n > b_n)
+            qsort(ps, p_n, sizeof(uint32_t), uint32_cmp);
+    }
+    free(ps);
+}
+
+// run contig error break rounds with links in memory
+// sequences are independent of each other so that the rounds of each sequence run in parallel
+// return the number of rounds a file based process would take, i.e., including the last round without breaks
+uint32_t link_pos_mat_break(link_pos_mat_t *link_mat, uint32_t merge_size, double fold_thres, uint32_t dual_break_thres, uint32_t move_avg, int n_threads, uint32_t *err_no)
+{
+    uint32_t i, r;
+    link_pos_break_t w;
+
+    w.link_mat = link_mat;
+    w.merge_size = merge_size;
+    w.fold_thres = fold_thres;
+    w.dual_break_thres = dual_break_thres;
+    w.move_avg = move_avg;
+    kt_for(n_threads, link_pos_break_worker, &w, link_mat->n);
+
+    r = 0;
+    *err_no = 0;
+    for (i = 0; i < link_mat->n; ++i) {
+        r = MAX(r, link_mat->link[i].r);
+        *err_no += link_mat->link[i].nr;
+    }
+
+    return r + 1;
+}
+
+// all break points made in rounds no later than round
+// break points are positions on the sequences used to build the link matrix
+bp_t *link_pos_mat_break_points(link_pos_mat_t *link_mat, uint32_t round, uint32_t *bp_n)
+{
+    uint32_t i, j, b_n;
+    link_pos_t *link;
+    bp_t *bp, *bp1;
+
+    b_n = 0;
+    bp = (bp_t *) malloc(MAX(link_mat->n, 1) * sizeof(bp_t));
+    for (i = 0; i < link_mat->n; ++i) {
+        link = &link_mat->link[i];
+        bp1 = 0;
+        for (j = 0; j < link->b_n; ++j) {
+            if (link->bp[j] >> 32 > round)
+                continue;
+            if (bp1 == 0) {
+                bp1 = bp + b_n;
+                bp1->s = i;
+                bp1->n = 0;
+                bp1->m = 4;
+                bp1->p = (uint64_t *) malloc(bp1->m * sizeof(uint64_t));
+                ++b_n;
+            }
+            add_break_point(bp1, (uint64_t) (uint32_t) link->bp[j] * link_mat->b);
+        }
+        if (bp1)
+            qsort(bp1->p, bp1->n, sizeof(uint64_t), uint64_cmp);
+    }
+    *bp_n = b_n;
+
+    return bp;
+}
+
 void print_link_mat(link_mat_t *link_mat, asm_dict_t *dict, FILE *fp)
 {
     int i, j, n;
@@ -568,7 +935,22 @@ void print_break_point(bp_t *bp, asm_dict_t *dict, FILE *fp)
     fprintf(fp, "\n");
 }
 
-void write_break_agp(asm_dict_t *d, bp_t *breaks, uint32_t b_n, FILE *fp)
+// write a scaffold to the AGP file and add it to the assembly dictionary of the file
+static void write_break_scaf(sd_seg_t *segs, uint32_t n, uint32_t s, FILE *fp, asm_dict_t *d1)
+{
+    uint32_t i;
+    char name[32];
+
+    write_segs_to_agp(segs, n, d1->sdict, s, fp);
+    for (i = 0; i < n; ++i)
+        asm_put_seg(d1, segs[i].c, segs[i].x, segs[i].y);
+    sprintf(name, "scaffold_%u", s);
+    asm_put_scaf(d1, name);
+}
+
+// write the AGP file of the assembly broken at the break points
+// return the assembly dictionary of the AGP file lifted from d
+asm_dict_t *write_break_agp(asm_dict_t *d, bp_t *breaks, uint32_t b_n, FILE *fp)
 {
     uint32_t i, j, s, ns, ms;
     int64_t L, l;
@@ -577,16 +959,18 @@ void write_break_agp(asm_dict_t *d, bp_t *breaks, uint32_t b_n, FILE *fp)
     sdict_t *sd;
     uint64_t *p;
     uint32_t p_n;
+    asm_dict_t *d1;
 
     ns = 0;
     ms = 4096;
     segs = (sd_seg_t *) malloc(ms * sizeof(sd_seg_t));
     sd = d->sdict;
+    d1 = asm_init(sd);
     s = 0;
     for (i = 0; i < d->n; ++i) {
         if (b_n == 0 || i < breaks->s) {
             // no breaks
-            write_segs_to_agp(d->seg + d->s[i].s, d->s[i].n, sd, ++s, fp);
+            write_break_scaf(d->seg + d->s[i].s, d->s[i].n, ++s, fp, d1);
         } else {
             // contain break points
             p = breaks->p;
@@ -614,7 +998,7 @@ void write_break_agp(asm_dict_t *d, bp_t *breaks, uint32_t b_n, FILE *fp)
                         ++ns;
                     }
 
-                    write_segs_to_agp(segs, ns, sd, ++s, fp);
+                    write_break_scaf(segs, ns, ++s, fp, d1);
                     ns = 0;
                     len = 0;
                     if (--p_n)
@@ -625,7 +1009,7 @@ void write_break_agp(asm_dict_t *d, bp_t *breaks, uint32_t b_n, FILE *fp)
                         l = (int64_t) (p[0] - p[-1]);
                         assert(l < UINT32_MAX);
                         sd_seg_t seg1 = {seg.s, ns, 0, seg.c, seg.c & 1? (uint32_t) (-L - l + seg.x + seg.y) : (uint32_t) (L + seg.x), (uint32_t) l};
-                        write_segs_to_agp(&seg1, 1, sd, ++s, fp);
+                        write_break_scaf(&seg1, 1, ++s, fp, d1);
                         L += l;
                         if (--p_n) 
                             ++p;
@@ -641,7 +1025,7 @@ void write_break_agp(asm_dict_t *d, bp_t *breaks, uint32_t b_n, FILE *fp)
                 }
             }
             if (ns > 0) {
-                write_segs_to_agp(segs, ns, sd, ++s, fp);
+                write_break_scaf(segs, ns, ++s, fp, d1);
                 ns = 0;
             }
             if(--b_n) 
@@ -650,5 +1034,8 @@ void write_break_agp(asm_dict_t *d, bp_t *breaks, uint32_t b_n, FILE *fp)
     }
 
     free(segs);
+    asm_index_lift(d1, d);
+
+    return d1;
 }
 
@@ -54,19 +54,40 @@ typedef struct {
     uint64_t *p;
 } bp_t;
 
+typedef struct {
+    uint32_t n, m; // link number
+    uint64_t *a; // bin0 << 32 | bin1 of intra links within dist threshold, sorted
+    uint32_t nb; // bin number
+    uint32_t r, nr; // number of rounds with breaks, number of pieces broken in all rounds
+    uint32_t b_n, b_m; // break number
+    uint64_t *bp; // round << 32 | break bin
+} link_pos_t;
+
+typedef struct {
+    uint32_t b; // bin size
+    uint32_t n; // number seqs
+    long intra_c;
+    link_pos_t *link;
+} link_pos_mat_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 link_mat_t *link_mat_init(asm_dict_t *dict, uint32_t b);
-link_mat_t *link_mat_from_file(const char *f, asm_dict_t *dict, uint32_t dist_thres, uint32_t resolution, double noise, uint32_t move_avg, uint8_t mq);
-uint32_t estimate_dist_thres_from_file(const char *f, asm_dict_t *dict, double min_frac, uint32_t resolution, uint8_t mq);
+link_mat_t *link_mat_from_file(const char *f, asm_dict_t *dict, uint32_t dist_thres, uint32_t resolution, double noise, uint32_t move_avg, uint8_t mq, int n_threads);
+uint32_t estimate_dist_thres_from_file(const char *f, asm_dict_t *dict, double min_frac, uint32_t resolution, uint8_t mq, int n_threads);
 void link_mat_destroy(link_mat_t *link_mat);
 void print_link_mat(link_mat_t *link_mat, asm_dict_t *dict, FILE *fp);
 bp_t *detect_break_points(link_mat_t *link_mat, uint32_t bin_size, uint32_t merge_size, double fold_thres, uint32_t dual_break_thres, uint32_t *bp_n);
 void print_break_point(bp_t *bp, asm_dict_t *dict, FILE *fp);
 bp_t *detect_break_points_local_joint(link_mat_t *link_mat, uint32_t bin_size, double fold_thres, uint32_t flank_size, asm_dict_t *dict, uint32_t *bp_n);
-void write_break_agp(asm_dict_t *d, bp_t *breaks, uint32_t b_n, FILE *fp);
+asm_dict_t *write_break_agp(asm_dict_t *d, bp_t *breaks, uint32_t b_n, FILE *fp);
+link_pos_mat_t *link_pos_mat_from_file(const char *f, asm_dict_t *dict, uint32_t dist_thres, uint32_t resolution, uint8_t mq, int n_threads);
+uint32_t link_pos_mat_break(link_pos_mat_t *link_mat, uint32_t merge_size, double fold_thres, uint32_t dual_break_thres, uint32_t move_avg, int n_threads, uint32_t *err_no);
+bp_t *link_pos_mat_break_points(link_pos_mat_t *link_mat, uint32_t round, uint32_t *bp_n);
+long estimate_link_pos_mat_rss(const char *f, asm_dict_t *dict);
+void link_pos_mat_destroy(link_pos_mat_t *link_mat);
 
 #ifdef __cplusplus
 }
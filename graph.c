@@ -737,21 +737,26 @@ int search_graph_path(graph_t *g, asm_dict_t *dict, char *out)
     int pst, step, k, t;
     uint32_t ori;
     FILE *agp_out;
+    char *agp_out_name, name[32];
+    asm_dict_t *dict1;
 
     if (out) {
-        char *agp_out_name = (char *) malloc(strlen(out) + 5);
+        agp_out_name = (char *) malloc(strlen(out) + 5);
         sprintf(agp_out_name, "%s.agp", out);
-        agp_out = fopen(agp_out_name, "w");
-        free(agp_out_name);
     } else {
-        agp_out = fopen("scaffolds_FINAL.agp", "w");
+        agp_out_name = strdup("scaffolds_FINAL.agp");
     }
+    agp_out = fopen(agp_out_name, "w");
 
     if (agp_out == NULL) {
         fprintf(stderr, "[E::%s] fail to open file to write\n", __func__);
+        free(agp_out_name);
         return 0;
     }
 
+    // the assembly dictionary of the AGP file is built along with it
+    dict1 = asm_init(sd);
+
 
     s = 0;
     for (r = 0; r < 2; ++r) {
@@ -797,6 +802,7 @@ int search_graph_path(graph_t *g, asm_dict_t *dict, char *out)
                         for (k = 0; k < nseg; ++k) {
                             cseg = dict->seg[pst + step * k];
                             fprintf(agp_out, "scaffold_%u\t%lu\t%lu\t%u\tW\t%s\t%u\t%u\t%c\n", s, len + 1, len + cseg.y, ++t, sd->s[cseg.c >> 1].name, cseg.x + 1, cseg.x + cseg.y, "+-"[(cseg.c & 1) ^ ori]);
+                            asm_put_seg(dict1, cseg.c ^ ori, cseg.x, cseg.y);
                             len += cseg.y;
                             if (k != nseg - 1 || j != qs - 1) {
                                 fprintf(agp_out, "scaffold_%u\t%lu\t%lu\t%u\tN\t%d\tscaffold\tyes\t%s\n", s, len + 1, len + GAP_SZ, ++t, GAP_SZ, LINK_EVIDENCE);
@@ -804,6 +810,8 @@ int search_graph_path(graph_t *g, asm_dict_t *dict, char *out)
                             }
                         }
                     }
+                    sprintf(name, "scaffold_%u", s);
+                    asm_put_scaf(dict1, name);
                 }
             }
         }
@@ -811,6 +819,9 @@ int search_graph_path(graph_t *g, asm_dict_t *dict, char *out)
     kdq_destroy(uint32_t, q);
     
     fclose(agp_out);
+    asm_index_lift(dict1, dict);
+    asm_agp_put(agp_out_name, dict1);
+    free(agp_out_name);
 
     return 0;
 }
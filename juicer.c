@@ -44,38 +44,33 @@ KHASH_SET_INIT_STR(str)
 
 static int make_juicer_pre_file_from_bin(char *f, char *agp, char *fai, uint8_t mq, int scale, int count_gap, FILE *fo)
 {
-    FILE *fp;
-    uint32_t i, i0, i1, m;
-    uint64_t p0, p1;
-    int64_t magic_number;
-    uint8_t buffer[BUFF_SIZE * 17];
-    long pair_c;
+    bin_reader_t *reader;
+    bin_cols_t cols;
+    uint32_t i, n, i0, i1, *si;
+    uint64_t p0, p1, *sp;
+    uint8_t *buffer;
+    long m, pair_c;
 
     sdict_t *sdict = make_sdict_from_index(fai, 0);
     asm_dict_t *dict = agp? make_asm_dict_from_agp(sdict, agp) : make_asm_dict_from_sdict(sdict);
 
-    fp = fopen(f, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "[E::%s] cannot open file %s for reading\n", __func__, f);
+    reader = bin_reader_open(f);
+    if (reader == NULL)
         exit(EXIT_FAILURE);
-    }
-    
-    m = fread(&magic_number, sizeof(int64_t), 1, fp);
-    if (!m || !is_valid_bin_header(magic_number)) {
-        fprintf(stderr, "[E::%s] not a valid BIN file\n", __func__);
-        exit(EXIT_FAILURE);
-    }
 
     pair_c = 0;
-    while (1) {
-        m = fread(buffer, sizeof(uint8_t), BUFF_SIZE * 17, fp);
-
-        for (i = 0; i < m; i += 17) {
-            if (*(uint8_t *) (buffer + i + 16) < mq)
-                continue;
-
-            sd_coordinate_conversion(dict, *(uint32_t *) (buffer + i),     *(uint32_t *) (buffer + i + 4),  &i0, &p0, count_gap);
-            sd_coordinate_conversion(dict, *(uint32_t *) (buffer + i + 8), *(uint32_t *) (buffer + i + 12), &i1, &p1, count_gap);
+    bin_cols_init(&cols, BUFF_SIZE);
+    si = (uint32_t *) malloc(BUFF_SIZE * 2 * sizeof(uint32_t));
+    sp = (uint64_t *) malloc(BUFF_SIZE * 2 * sizeof(uint64_t));
+    while ((m = bin_reader_read(reader, &buffer, BUFF_SIZE)) > 0) {
+        n = bin_cols_decode(&cols, buffer, m, mq);
+        sd_coordinate_conversion_batch(dict, n, cols.c0, cols.p0, si, sp, count_gap);
+        sd_coordinate_conversion_batch(dict, n, cols.c1, cols.p1, si + BUFF_SIZE, sp + BUFF_SIZE, count_gap);
+        for (i = 0; i < n; ++i) {
+            i0 = si[i];
+            p0 = sp[i];
+            i1 = si[BUFF_SIZE + i];
+            p1 = sp[BUFF_SIZE + i];
             
             if (i0 == UINT32_MAX || i1 == UINT32_MAX) {
                 fprintf(stderr, "[W::%s] sequence not found \n", __func__);
@@ -88,16 +83,15 @@ static int make_juicer_pre_file_from_bin(char *f, char *agp, char *fai, uint8_t
             
             ++pair_c;
         }
-
-        if (m < BUFF_SIZE * 17) {
-            if (ferror(fp))
-                return 1;
-            break;
-        }
     }
+    bin_cols_destroy(&cols);
+    free(si);
+    free(sp);
+    bin_reader_close(reader);
+    if (m < 0)
+        return 1;
 
     fprintf(stderr, "[I::%s] %ld read pairs processed\n", __func__, pair_c);
-    fclose(fp);
     asm_destroy(dict);
     sd_destroy(sdict);
 
@@ -245,7 +239,7 @@ static char *parse_bam_rec1(bam1_t *b, bam_header_t *h, char **cname0, int32_t *
     return bam1_qname(b);
 }
 
-static int make_juicer_pre_file_from_bam(char *f, char *agp, char *fai, uint8_t mq, int scale, int count_gap, FILE *fo)
+static int make_juicer_pre_file_from_bam(char *f, char *agp, char *fai, uint8_t mq, int scale, int count_gap, FILE *fo, int n_threads)
 {
     bamFile fp;
     bam_header_t *h;
@@ -266,7 +260,7 @@ static int make_juicer_pre_file_from_bam(char *f, char *agp, char *fai, uint8_t
     sdict_t *sdict = make_sdict_from_index(fai, 0);
     asm_dict_t *dict = agp? make_asm_dict_from_agp(sdict, agp) : make_asm_dict_from_sdict(sdict);
 
-    fp = bam_open(f, "r");
+    fp = bam_open_mt(f, n_threads);
     if (fp == NULL) {
         fprintf(stderr, "[E::%s] cannot open file %s for reading\n", __func__, f);
         exit(EXIT_FAILURE);
@@ -520,6 +514,7 @@ static void print_help_pre(FILE *fp_help)
     fprintf(fp_help, "    -a                preprocess for assembly mode\n");
     fprintf(fp_help, "    -q INT            minimum mapping quality [10]\n");
     fprintf(fp_help, "    -o STR            output file prefix (required for '-a' mode) [stdout]\n");
+    fprintf(fp_help, "    -t INT            number of threads for BAM decompression [1]\n");
     fprintf(fp_help, "    --version         show version number\n");
 }
 
@@ -533,18 +528,19 @@ static int main_pre(int argc, char *argv[])
 {
     FILE *fo;
     char *fai, *agp, *agp1, *link_file, *out, *out1, *annot, *lift, *ext;
-    int mq, asm_mode;;
+    int mq, asm_mode, n_threads;
     
     liftrlimit();
     jc_realtime0 = realtime();
 
-    const char *opt_str = "q:ao:Vh";
+    const char *opt_str = "q:ao:t:Vh";
     ketopt_t opt = KETOPT_INIT;
     int c, ret;
     FILE *fp_help = stderr;
     fai = agp = agp1 = link_file = out = out1 = annot = lift = 0;
     mq = 10;
     asm_mode = 0;
+    n_threads = 1;
 
     while ((c = ketopt(&opt, argc, argv, 1, opt_str, long_options)) >= 0) {
         if (c == 'o') {
@@ -553,6 +549,8 @@ static int main_pre(int argc, char *argv[])
             mq = atoi(opt.arg);
         } else if (c == 'a') {
             asm_mode = 1;
+        } else if (c == 't') {
+            n_threads = atoi(opt.arg);
         } else if (c == 'h') {
             fp_help = stdout;   
         } else if (c == 'V') {
@@ -588,6 +586,11 @@ static int main_pre(int argc, char *argv[])
         return 1;
     }
 
+    if (n_threads < 1) {
+        fprintf(stderr, "[E::%s] invalid number of threads: %d\n", __func__, n_threads);
+        return 1;
+    }
+
     uint8_t mq8;
     mq8 = (uint8_t) mq;
 
@@ -633,7 +636,7 @@ static int main_pre(int argc, char *argv[])
     ext = link_file + strlen(link_file) - 4;
     if (strcmp(ext, ".bam") == 0) {
         fprintf(stderr, "[I::%s] make juicer pre input from BAM file %s\n", __func__, link_file);
-        ret = make_juicer_pre_file_from_bam(link_file, agp1, fai, mq8, scale, !asm_mode, fo);
+        ret = make_juicer_pre_file_from_bam(link_file, agp1, fai, mq8, scale, !asm_mode, fo, n_threads);
     } else if (strcmp(ext, ".bed") == 0) {
         fprintf(stderr, "[I::%s] make juicer pre input from BED file %s\n", __func__, link_file);
         ret = make_juicer_pre_file_from_bed(link_file, agp1, fai, mq8, scale, !asm_mode, fo);
@@ -33,13 +33,22 @@
 #include <math.h>
 #include <assert.h>
 #include <float.h>
+#include <pthread.h>
 
 #include "khash.h"
+#include "ksort.h"
+#include "kvec.h"
 #include "bamlite.h"
 #include "sdict.h"
 #include "enzyme.h"
 #include "link.h"
 #include "asset.h"
+#include "kthread.h"
+#include "kseq.h"
+KSTREAM_INIT(gzFile, gzread, gzseek, 0x10000)
+
+void *kopen(const char *fn, int *_fd);
+int kclose(void *a);
 
 #undef DEBUG_NOISE
 #undef DEBUG_ORIEN
@@ -48,6 +57,19 @@
 #define USE_MEDIAN_NORM
 #define MIN_RE_DENS .1
 static uint32_t MAX_RADIUS = 100;
+// number of intra link bands stored
+// norms are used up to MAX_RADIUS and the radius is cut at a run of 10 zero norms
+#define INTRA_MAX_BAND (MAX_RADIUS + 10)
+// fraction bits of the fixed point sum of links in bands not stored
+#define INTRA_FAR_SHIFT 24
+
+// normalised link count of a cell with link count c and relative area a
+// no normalisation for small cells to avoid extreme cases
+#define link_norm(c, a) ((a) > FLT_EPSILON? (double) (c) / (a) : -DBL_MAX)
+// normalised link count of cell l of the intra link between bins (j, k), j <= k
+#define intra_link_cell(e, l, j, k) link_norm((e)->link[l], intra_link_cell_area(e, j, k))
+// normalised link count of cell l of link type t of the inter link
+#define inter_link_cell(m, e, t, l) link_norm((e)->link[t][l], inter_link_cell_area(m, (e)->c0, (e)->c1, l))
 
 KHASH_SET_INIT_STR(str)
 
@@ -55,26 +77,33 @@ void intra_link_mat_destroy(intra_link_mat_t *link_mat)
 {
     uint32_t i;
     for (i = 0; i < link_mat->n; ++i)
-        if (link_mat->links[i].n)
-            free(link_mat->links[i].link);
+        free(link_mat->links[i].re);
     if (link_mat->links)
         free(link_mat->links);
+    free(link_mat->cells);
+    free(link_mat->band_c);
+    free(link_mat->band_x);
     free(link_mat);
 }
 
 void inter_link_mat_destroy(inter_link_mat_t *link_mat)
 {
-    uint32_t i, j;
+    uint32_t i;
     for (i = 0; i < link_mat->n; ++i) {
-        if (link_mat->links[i].n) {
-            for (j = 0; j < 4; ++j) {
-                free(link_mat->links[i].link[j]);
-                free(link_mat->links[i].linkb[j]);
-            }
-        }
+        // cells of all link types are allocated in one block
+        free(link_mat->links[i].link[0]);
+        free(link_mat->links[i].linkb[0]);
     }
     if (link_mat->links)
         free(link_mat->links);
+    if (link_mat->re_dens) {
+        for (i = 0; i < link_mat->s; ++i)
+            free(link_mat->re_dens[i]);
+        free(link_mat->re_dens);
+    }
+    kh_destroy(inter_link, link_mat->h);
+    free(link_mat->b);
+    free(link_mat->a);
     free(link_mat);
 }
 
@@ -158,127 +187,598 @@ void inter_link_mat_destroy(inter_link_mat_t *link_mat)
 inter_link_mat_t *inter_link_mat_init(asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, uint32_t radius)
 {
     inter_link_mat_t *link_mat;
-    inter_link_t *link;
-    uint32_t i, j, k, l, b0, b1, n, m, p, r2;
-    double a0, a1, a;
-    double **re_dens, re;
+    uint32_t i, n, r2;
 
     n = dict->n;
-    m = (long) n * (n - 1) / 2;
     r2 = resolution * 2;
-    link_mat = (inter_link_mat_t *) malloc(sizeof(inter_link_mat_t));
-    link_mat->n = m;
+    link_mat = (inter_link_mat_t *) calloc(1, sizeof(inter_link_mat_t));
     link_mat->r = radius;
-    link_mat->links = (inter_link_t *) malloc(m * sizeof(inter_link_t));
-    
-    re_dens = calc_re_cuts_density2(re_cuts, resolution, dict);
-    
+    link_mat->h = kh_init(inter_link);
+    link_mat->s = n;
+    link_mat->b = (uint32_t *) calloc(n, sizeof(uint32_t));
+    link_mat->a = (double *) calloc(n, sizeof(double));
     for (i = 0; i < n; ++i) {
-        if (dict->s[i].len < r2) {
-            for (j = i + 1; j < n; ++j)
-                link_mat->links[(long) (n * 2 - i - 3) * i / 2 + j - 1].n = 0;
+        if (dict->s[i].len < r2)
             continue;
-        }
-        
-        b0 = MIN(radius, div_ceil(dict->s[i].len, r2));
+        link_mat->b[i] = MIN(radius, div_ceil(dict->s[i].len, r2));
         // relative size of the last cell
-        a0 = MIN(1., (dict->s[i].len / 2. - (double) (b0 - 1) * resolution) / resolution);
-        for (j = i + 1; j < n; ++j) {
-            link = &link_mat->links[(long) (n * 2 - i - 3) * i / 2 + j - 1];
-            if (dict->s[j].len < r2) {
-                link->n = 0;
-                continue;
-            }
-            
-            b1 = MIN(radius, div_ceil(dict->s[j].len, r2));
-            // relative size of the last cell
-            a1 = MIN(1., (dict->s[j].len / 2. - (double) (b1 - 1) * resolution) / resolution);
-            p = b0 * b1; 
-            link->c0 = i;
-            link->c1 = j;
-            link->b0 = b0;
-            link->b1 = b1;
-            link->r = MIN(radius, (uint32_t) (b0 + b1 - 1));
-            link->n = p;
-            link->n0 = 0;
-            link->linkt = 0;
-            assert(p == (long) b0 * b1);
-            for (k = 0; k < 4; ++k) {
-                link->link[k] = (double *) calloc(p, sizeof(double));
-                link->linkb[k] = (double *) calloc(link->r, sizeof(double));
-                if (!link->link[k] || !link->linkb[k]) {
-                    fprintf(stderr, "[E::%s] memory allocation failure\n", __func__);
-                    exit(EXIT_FAILURE);
-                }
-            }
+        link_mat->a[i] = MIN(1., (dict->s[i].len / 2. - (double) (link_mat->b[i] - 1) * resolution) / resolution);
+    }
+    link_mat->re_dens = calc_re_cuts_density2(re_cuts, resolution, dict);
+
+    return link_mat;
+}
+
+// relative area of cell (x, y) of the sequence pair (i, j) adjusted by restriction site density
+static inline double inter_link_cell_area_xy(inter_link_mat_t *link_mat, uint32_t i, uint32_t j, uint32_t x, uint32_t y)
+{
+    double a, re;
+
+    a = 1.;
+    if (x == link_mat->b[i] - 1)
+        a *= link_mat->a[i];
+    if (y == link_mat->b[j] - 1)
+        a *= link_mat->a[j];
+    if (a < .5)
+        a = .0;
+    re = link_mat->re_dens? link_mat->re_dens[i][x] * link_mat->re_dens[j][y] : 1.;
+    a *= re < MIN_RE_DENS? .0 : re;
+    return a;
+}
+
+// relative area of cell l of the sequence pair (i, j) adjusted by restriction site density
+static inline double inter_link_cell_area(inter_link_mat_t *link_mat, uint32_t i, uint32_t j, uint32_t l)
+{
+    return inter_link_cell_area_xy(link_mat, i, j, l / link_mat->b[j], l % link_mat->b[j]);
+}
+
+// get the index of the sequence pair (i, j), i < j, in link_mat->links
+// cells are allocated if the pair is not stored yet
+static uint32_t inter_link_put(inter_link_mat_t *link_mat, uint32_t i, uint32_t j)
+{
+    uint32_t k, p, b0, b1;
+    int absent;
+    khint_t x;
+    inter_link_t *link;
+
+    x = kh_put(inter_link, link_mat->h, (uint64_t) i << 32 | j, &absent);
+    if (!absent)
+        return kh_val(link_mat->h, x);
+
+    if (link_mat->n == link_mat->m) {
+        link_mat->m = link_mat->m? link_mat->m << 1 : 16;
+        link_mat->links = (inter_link_t *) realloc(link_mat->links, link_mat->m * sizeof(inter_link_t));
+    }
+    kh_val(link_mat->h, x) = link_mat->n;
+    link = &link_mat->links[link_mat->n++];
+
+    b0 = link_mat->b[i];
+    b1 = link_mat->b[j];
+    p = b0 * b1;
+    link->c0 = i;
+    link->c1 = j;
+    link->b0 = b0;
+    link->b1 = b1;
+    link->r = MIN(link_mat->r, (uint32_t) (b0 + b1 - 1));
+    link->n = p;
+    link->n0 = 0;
+    link->linkt = 0;
+    assert(p == (long) b0 * b1);
+    link->link[0] = (uint32_t *) calloc((long) p * 4, sizeof(uint32_t));
+    link->linkb[0] = (double *) calloc(link->r * 4, sizeof(double));
+    if (!link->link[0] || !link->linkb[0]) {
+        fprintf(stderr, "[E::%s] memory allocation failure\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+    for (k = 1; k < 4; ++k) {
+        link->link[k] = link->link[k - 1] + p;
+        link->linkb[k] = link->linkb[k - 1] + link->r;
+    }
+    memset(link->norms, 0, sizeof(link->norms));
+
+    return kh_val(link_mat->h, x);
+}
+
+inter_link_t *get_inter_link(inter_link_mat_t *link_mat, uint32_t i, uint32_t j)
+{
+    khint_t x;
+    if (i > j)
+        SWAP(uint32_t, i, j);
+    x = kh_get(inter_link, link_mat->h, (uint64_t) i << 32 | j);
+    return x == kh_end(link_mat->h)? 0 : &link_mat->links[kh_val(link_mat->h, x)];
+}
+
+#define inter_link_lt(a, b) ((a).c0 < (b).c0 || ((a).c0 == (b).c0 && (a).c1 < (b).c1))
+KSORT_INIT(inter_link, inter_link_t, inter_link_lt)
+
+// sort stored pairs by (c0, c1) so that results do not depend on the order links were collected
+static void inter_link_mat_sort(inter_link_mat_t *link_mat)
+{
+    uint32_t i;
+    khint_t x;
+
+    ks_introsort_inter_link(link_mat->n, link_mat->links);
+    for (i = 0; i < link_mat->n; ++i) {
+        x = kh_get(inter_link, link_mat->h, (uint64_t) link_mat->links[i].c0 << 32 | link_mat->links[i].c1);
+        kh_val(link_mat->h, x) = i;
+    }
+}
+
+// scaffolds containing each contig
+typedef struct {
+    uint32_t *s; // offsets of contigs in a
+    uint32_t *a; // sorted scaffold ids
+} contig_scaf_t;
+
+#define u64_key(a) (a)
+KRADIX_SORT_INIT(u64, uint64_t, u64_key, 8)
+KSORT_INIT_GENERIC(double)
+KSORT_INIT_GENERIC(uint64_t)
+
+static void contig_scaf_init(contig_scaf_t *cs, asm_dict_t *dict)
+{
+    uint32_t i, n;
+    uint64_t *a;
+
+    n = dict->sdict->n;
+    a = (uint64_t *) malloc(MAX(1, dict->u) * sizeof(uint64_t));
+    for (i = 0; i < dict->u; ++i)
+        a[i] = (uint64_t) (dict->seg[i].c >> 1) << 32 | dict->seg[i].s;
+    radix_sort_u64(a, a + dict->u);
+    cs->s = (uint32_t *) calloc(n + 1, sizeof(uint32_t));
+    cs->a = (uint32_t *) malloc(MAX(1, dict->u) * sizeof(uint32_t));
+    for (i = 0; i < dict->u; ++i) {
+        cs->a[i] = (uint32_t) a[i];
+        ++cs->s[(a[i] >> 32) + 1];
+    }
+    for (i = 0; i < n; ++i)
+        cs->s[i + 1] += cs->s[i];
+    free(a);
+}
+
+static void contig_scaf_destroy(contig_scaf_t *cs)
+{
+    free(cs->s);
+    free(cs->a);
+}
+
+// scaffold pairs with links in an indexed BIN file
+// return NULL if the file is not indexed
+static khash_t(inter_link) *bin_idx_scaf_pairs(const char *f, asm_dict_t *dict)
+{
+    uint64_t i;
+    uint32_t j, k, s0, s1;
+    int absent;
+    bin_reader_t *reader;
+    bin_idx_ent_t *e;
+    contig_scaf_t cs;
+    khash_t(inter_link) *h;
+
+    reader = f? bin_reader_open(f) : 0;
+    if (reader == NULL || reader->idx == NULL) {
+        if (reader)
+            bin_reader_close(reader);
+        return 0;
+    }
 
-            // calculate relative areas for each cell 
-            for (l = 0; l < p; ++l) {
-                a = 1.;
-                if (l / b1 == b0 - 1)
-                    a *= a0;
-                if (l % b1 == b1 - 1)
-                    a *= a1;
-                if (a < .5)
-                    a = .0;
-                re = re_dens? re_dens[i][l / b1] * re_dens[j][l % b1] : 1.;
-                a *= re < MIN_RE_DENS? .0 : re;
-                if (a < FLT_EPSILON)
-                    a = FLT_EPSILON;
-                else if (a > 1.)
-                    a = -1. / a;
-                for (k = 0; k < 4; ++k)
-                    link->link[k][l] = a;
+    contig_scaf_init(&cs, dict);
+    h = kh_init(inter_link);
+    for (i = 0; i < reader->idx->n; ++i) {
+        e = &reader->idx->a[i];
+        if (e->c0 >= dict->sdict->n || e->c1 >= dict->sdict->n)
+            continue;
+        for (j = cs.s[e->c0]; j < cs.s[e->c0 + 1]; ++j) {
+            for (k = cs.s[e->c1]; k < cs.s[e->c1 + 1]; ++k) {
+                s0 = MIN(cs.a[j], cs.a[k]);
+                s1 = MAX(cs.a[j], cs.a[k]);
+                if (s0 != s1)
+                    kh_put(inter_link, h, (uint64_t) s0 << 32 | s1, &absent);
             }
-            memset(link->norms, 0, sizeof(link->norms));
         }
     }
+    contig_scaf_destroy(&cs);
+    bin_reader_close(reader);
 
-    if (re_dens) {
-        for (i = 0; i < n; ++i)
-            free(re_dens[i]);
-        free(re_dens);
-    }
+    return h;
+}
 
-    return link_mat;
+// number of bins MIN(radius, div_ceil(len, 2 * resolution)) of sequence i, 0 for short sequences
+static inline uint32_t inter_link_seq_bins(asm_dict_t *dict, uint32_t i, uint32_t resolution, uint32_t radius)
+{
+    uint32_t r2 = resolution * 2;
+    return dict->s[i].len < r2? 0 : MIN(radius, div_ceil(dict->s[i].len, r2));
 }
 
-long estimate_inter_link_mat_init_rss(asm_dict_t *dict, uint32_t resolution, uint32_t radius)
+// number of sequences with each bin number [0 ... radius]
+// all sequence pairs are summarised by bin number pairs without enumerating them
+static uint64_t *inter_link_bin_hist(asm_dict_t *dict, uint32_t resolution, uint32_t radius)
 {
-    long bytes, p, m;
-    uint32_t i, j, b0, b1, n, r, r2;
+    uint32_t i;
+    uint64_t *hist;
 
-    n = dict->n;
-    m = (long) n * (n - 1) / 2;
-    if (m > UINT32_MAX)
+    hist = (uint64_t *) calloc(radius + 1, sizeof(uint64_t));
+    for (i = 0; i < dict->n; ++i)
+        ++hist[inter_link_seq_bins(dict, i, resolution, radius)];
+    return hist;
+}
+
+// number of sequence pairs with bin numbers (b0, b1), b0 <= b1
+static inline long inter_link_bin_pairs(uint64_t *hist, uint32_t b0, uint32_t b1)
+{
+    return b0 == b1? (long) hist[b0] * (hist[b0] - 1) / 2 : (long) hist[b0] * hist[b1];
+}
+
+// records between different contigs and records within each contig of a BIN file
+// counted when the file is dumped, or else in the first scan reading all records of the file,
+// and kept for the scaffolding rounds
+static char *rec_c_f;
+static uint8_t rec_c_mq;
+static long rec_c_inter;
+static uint32_t rec_c_n;
+static long *rec_c_intra;
+
+void bin_file_rec_clear(void)
+{
+    free(rec_c_f);
+    free(rec_c_intra);
+    rec_c_f = 0;
+    rec_c_intra = 0;
+    rec_c_inter = 0;
+    rec_c_n = 0;
+}
+
+// start counting the records of a BIN file with n sequences
+static void bin_file_rec_init(uint32_t n)
+{
+    bin_file_rec_clear();
+    rec_c_n = n;
+    rec_c_intra = (long *) calloc(n, sizeof(long));
+}
+
+static inline void bin_file_rec_add(uint32_t i0, uint32_t i1)
+{
+    if (i0 != i1 || i0 >= rec_c_n)
+        ++rec_c_inter;
+    else
+        ++rec_c_intra[i0];
+}
+
+// the records of file f passing the mapping quality filter mq are counted
+static void bin_file_rec_done(const char *f, uint8_t mq)
+{
+    rec_c_f = strdup(f);
+    rec_c_mq = mq;
+}
+
+// upper bound of the number of scaffold pairs with links
+// a scaffold pair needs a record between different contigs, or within a contig placed in more than one scaffold
+// all records are counted if the file has not been scanned yet
+// return -1 if unknown
+static long bin_file_scaf_pairs_max(const char *f, asm_dict_t *dict, uint8_t mq)
+{
+    uint32_t i;
+    long n;
+    contig_scaf_t cs;
+    bin_reader_t *reader;
+
+    if (f == 0)
         return -1;
+    if (rec_c_f == 0 || strcmp(rec_c_f, f) || rec_c_mq > mq) {
+        reader = bin_reader_open(f);
+        if (reader == NULL)
+            return -1;
+        n = bin_reader_count(reader);
+        bin_reader_close(reader);
+        return n;
+    }
+    n = rec_c_inter;
+    contig_scaf_init(&cs, dict);
+    for (i = 0; i < dict->sdict->n && i < rec_c_n; ++i)
+        if (cs.s[i + 1] > cs.s[i] && cs.a[cs.s[i]] != cs.a[cs.s[i + 1] - 1])
+            n += rec_c_intra[i];
+    contig_scaf_destroy(&cs);
 
-    r2 = resolution * 2;
+    return n;
+}
+
+typedef struct {
+    long rss; // memory of a sequence pair
+    long n; // number of sequence pairs
+    uint32_t b0, b1; // bin numbers of the sequences
+} pair_grp_t;
+
+#define pair_grp_lt(a, b) ((a).rss > (b).rss)
+KSORT_INIT(pair_grp, pair_grp_t, pair_grp_lt)
+
+// memory of at most max_n sequence pairs of the groups, taking the pairs with most memory first
+static long pair_grp_max_rss(pair_grp_t *g, uint32_t n, long max_n)
+{
+    uint32_t i;
+    long bytes, m;
 
+    ks_introsort_pair_grp(n, g);
     bytes = 0;
-    bytes += sizeof(inter_link_mat_t);
-    bytes += m * sizeof(inter_link_t);
+    for (i = 0; i < n && max_n != 0; ++i) {
+        m = max_n < 0? g[i].n : MIN(g[i].n, max_n);
+        bytes += m * g[i].rss;
+        if (max_n >= 0)
+            max_n -= m;
+    }
+    return bytes;
+}
 
-    for (i = 0; i < n; ++i) {
-        if (dict->s[i].len < r2)
-            continue;
+// sequence pairs that can have inter links grouped by bin numbers (b0, b1), 0 < b0 <= b1 <= radius
+// only sequence pairs with links in the BIN file are counted if it is indexed and *max_n is set to -1
+// otherwise all sequence pairs are counted and *max_n is set to the number of scaffold pairs that can have links
+static pair_grp_t *inter_link_pair_grps(const char *f, asm_dict_t *dict, uint32_t resolution, uint32_t radius, uint8_t mq,
+        uint32_t *m, long *max_n)
+{
+    uint32_t i, j, b0, b1;
+    uint64_t *hist;
+    khint_t x;
+    khash_t(inter_link) *h;
+    pair_grp_t *g;
+
+    g = (pair_grp_t *) malloc(MAX(1, (uint64_t) radius * (radius + 1) / 2) * sizeof(pair_grp_t));
+    *m = 0;
+    for (i = 1; i <= radius; ++i) {
+        for (j = i; j <= radius; ++j) {
+            g[*m].rss = 0;
+            g[*m].n = 0;
+            g[*m].b0 = i;
+            g[*m].b1 = j;
+            ++*m;
+        }
+    }
 
-        b0 = MIN(radius, div_ceil(dict->s[i].len, r2));
-        for (j = i + 1; j < n; ++j) {
-            if (dict->s[j].len < r2)
+    h = bin_idx_scaf_pairs(f, dict);
+    if (h) {
+        for (x = 0; x < kh_end(h); ++x) {
+            if (!kh_exist(h, x))
                 continue;
+            b0 = inter_link_seq_bins(dict, kh_key(h, x) >> 32, resolution, radius);
+            b1 = inter_link_seq_bins(dict, (uint32_t) kh_key(h, x), resolution, radius);
+            if (b0 == 0 || b1 == 0)
+                continue;
+            if (b0 > b1)
+                SWAP(uint32_t, b0, b1);
+            // groups of b0 start after those of smaller bin numbers
+            ++g[(uint64_t) (b0 - 1) * (radius * 2 - b0 + 2) / 2 + b1 - b0].n;
+        }
+        kh_destroy(inter_link, h);
+        *max_n = -1;
+        return g;
+    }
+
+    hist = inter_link_bin_hist(dict, resolution, radius);
+    for (i = 0; i < *m; ++i)
+        g[i].n = inter_link_bin_pairs(hist, g[i].b0, g[i].b1);
+    free(hist);
+    *max_n = bin_file_scaf_pairs_max(f, dict, mq);
+
+    return g;
+}
+
+// memory of a sparse inter link store for a sequence pair of bin numbers (b0, b1)
+static long inter_link_pair_rss(uint32_t b0, uint32_t b1, uint32_t radius)
+{
+    long p;
+    uint32_t r;
+
+    if (b0 == 0 || b1 == 0)
+        return 0;
+    p = (long) b0 * b1;
+    r = MIN(radius, (uint32_t) (b0 + b1 - 1));
+
+    // cells, bands, pair record and hash entry
+    return p * 4 * sizeof(uint32_t) + r * 4 * sizeof(double) + sizeof(inter_link_t) + 16;
+}
+
+// memory of the inter link matrix
+// only sequence pairs with links in the BIN file are counted if it is indexed
+// otherwise pairs with most memory are counted, at most as many as the scaffold pairs that can have links
+long estimate_inter_link_mat_init_rss(const char *f, asm_dict_t *dict, uint32_t resolution, uint32_t radius, uint8_t mq)
+{
+    long bytes, max_n;
+    uint32_t i, m;
+    pair_grp_t *g;
+
+    bytes = 0;
+    bytes += sizeof(inter_link_mat_t);
+    bytes += dict->n * (sizeof(uint32_t) + sizeof(double));
+    g = inter_link_pair_grps(f, dict, resolution, radius, mq, &m, &max_n);
+    for (i = 0; i < m; ++i)
+        g[i].rss = inter_link_pair_rss(g[i].b0, g[i].b1, radius);
+    bytes += pair_grp_max_rss(g, m, max_n);
+    free(g);
+
+    return bytes;
+}
+
+// relative area of the intra link cell between bins (j, k), j <= k, adjusted by restriction site density
+static inline double intra_link_cell_area(intra_link_t *link, uint32_t j, uint32_t k)
+{
+    double a, re;
+
+    if (link->re) {
+        re = link->re[j] * link->re[k];
+        a = re < MIN_RE_DENS? .0 : re;
+    } else {
+        a = 1.;
+    }
+    if (k == link->n - 1) {
+        a *= link->a < .5? .0 : link->a;
+        // the last cell in the diagonal
+        if (j == k)
+            a *= link->a < SQRT2_2? .0 : link->a;
+    }
+    return a;
+}
+
+// number of cells in the first r bands of an intra link with n bins, i.e., the start of band r
+static inline long intra_link_cells(uint32_t n, uint32_t r)
+{
+    return (long) (n * 2 - r + 1) * r / 2;
+}
 
-            b1 = MIN(radius, div_ceil(dict->s[j].len, r2));
-            p = b0 * b1;
-            if (p > UINT32_MAX)
-                return -1;
-            r = MIN(radius, (uint32_t) (b0 + b1 - 1));
+// number of cells in the bands not stored [r, n - 1) too small to normalise
+// the last cell of each band is not used for norms and not counted
+static uint64_t intra_link_far_small(intra_link_t *link, uint32_t r)
+{
+    uint32_t i, j, d, m;
+    uint64_t c;
+    double *v;
 
-            bytes += (p + r) * 4 * sizeof(double);
+    if (!link->re || link->n <= r + 1)
+        return 0;
+    m = link->n - 1;
+    // all cells (j, k), j < k < m, by sorted densities
+    v = (double *) malloc(m * sizeof(double));
+    memcpy(v, link->re, m * sizeof(double));
+    ks_introsort_double(m, v);
+    c = 0;
+    i = 0;
+    j = m - 1;
+    while (i < j) {
+        if (v[i] * v[j] < MIN_RE_DENS) {
+            c += j - i;
+            ++i;
+        } else {
+            --j;
         }
     }
+    free(v);
+    // cells in the bands stored
+    for (d = 1; d < r; ++d)
+        for (i = 0; i + d < m; ++i)
+            if (link->re[i] * link->re[i + d] < MIN_RE_DENS)
+                --c;
+    return c;
+}
 
-    return bytes;
+// number of cells in the bands [0, r) too small to normalise of an intra link not stored
+// the last cell of each band is not used for norms and not counted
+static void intra_link_band_small(intra_link_t *link, uint32_t r, uint64_t *band_x)
+{
+    uint32_t i, d, m;
+
+    if (!link->re || link->n <= 1)
+        return;
+    m = link->n - 1;
+    for (d = 0; d < MIN(r, m); ++d)
+        for (i = 0; i + d < m; ++i)
+            if (link->re[i] * link->re[i + d] < MIN_RE_DENS)
+                ++band_x[d];
+}
+
+// keep the bands of the intra links of a sample of sequences within max_cells cells
+// sequences are taken in order of size keeping the cells stored close to the fraction allowed
+// so that all sizes are represented
+// return the number of cells stored
+static uint64_t intra_link_mat_sample(intra_link_mat_t *link_mat, uint64_t p, uint64_t max_cells)
+{
+    uint32_t i, s;
+    uint64_t c, q, a, *order;
+    double f;
+    intra_link_t *link;
+
+    order = (uint64_t *) malloc(MAX(1, link_mat->n) * sizeof(uint64_t));
+    for (i = 0; i < link_mat->n; ++i)
+        order[i] = (uint64_t) link_mat->links[i].n << 32 | i;
+    ks_introsort_uint64_t(link_mat->n, order);
+
+    f = (double) max_cells / p;
+    a = q = 0;
+    s = 0;
+    for (i = 0; i < link_mat->n; ++i) {
+        link = &link_mat->links[(uint32_t) order[i]];
+        c = intra_link_cells(link->n, link->r);
+        a += c;
+        if (c == 0)
+            continue;
+        if (q + c <= max_cells && q + c * .5 <= f * a) {
+            q += c;
+            ++s;
+        } else {
+            link->r = 0;
+        }
+    }
+    // with a few large sequences, store the largest one fitting
+    for (i = link_mat->n; s == 0 && i > 0; --i) {
+        link = &link_mat->links[(uint32_t) order[i - 1]];
+        c = intra_link_cells(link->n, MIN(link->n, link_mat->r));
+        if (c > 0 && c <= max_cells) {
+            link->r = MIN(link->n, link_mat->r);
+            q += c;
+            ++s;
+        }
+    }
+    free(order);
+
+    link_mat->band_c = (uint64_t *) calloc(link_mat->r, sizeof(uint64_t));
+    link_mat->band_x = (uint64_t *) calloc(link_mat->r, sizeof(uint64_t));
+
+    fprintf(stderr, "[I::%s] %.2f%% of intra link cells stored within the RAM limit, norms estimated from %u sequences\n", __func__, 100. * q / p, s);
+
+    return q;
+}
+
+// allocate the cells of the bands stored for all intra links in one block
+// if the cells do not fit in rss_limit (>= 0), only a sample of intra links is stored
+static void intra_link_mat_alloc(intra_link_mat_t *link_mat, long rss_limit)
+{
+    uint32_t i;
+    uint64_t p;
+    long max_cells;
+    intra_link_t *link;
+
+    p = 0;
+    for (i = 0; i < link_mat->n; ++i) {
+        link = &link_mat->links[i];
+        link->r = MIN(link->n, link_mat->r);
+        p += intra_link_cells(link->n, link->r);
+    }
+    link_mat->band_c = link_mat->band_x = 0;
+    if (rss_limit >= 0) {
+        max_cells = (rss_limit - (long) sizeof(intra_link_mat_t) - (long) link_mat->n * sizeof(intra_link_t)
+                - (long) link_mat->r * sizeof(uint64_t) * 2) / (long) sizeof(uint32_t);
+        if (p > MAX(max_cells, 0))
+            p = intra_link_mat_sample(link_mat, p, MAX(max_cells, 0));
+    }
+    link_mat->cells = (uint32_t *) calloc(MAX(1, p), sizeof(uint32_t));
+    if (!link_mat->cells) {
+        fprintf(stderr, "[E::%s] memory allocation failure\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+    link_mat->far_c = link_mat->far_x = 0;
+    p = 0;
+    for (i = 0; i < link_mat->n; ++i) {
+        link = &link_mat->links[i];
+        link->link = link_mat->cells + p;
+        p += intra_link_cells(link->n, link->r);
+        link_mat->far_x += intra_link_far_small(link, MIN(link->n, link_mat->r));
+        if (link->r == 0 && link_mat->band_x)
+            intra_link_band_small(link, link_mat->r, link_mat->band_x);
+    }
+}
+
+// fixed point weight of a link in cell l beyond the bands stored
+// the cell index of a link in band *d may fall into a lower band (see intra_link_add)
+// *d is set to the band of the cell
+static inline uint64_t intra_link_far_weight(intra_link_t *link, long l, uint32_t *d)
+{
+    uint32_t k;
+    double a;
+
+    while (l < intra_link_cells(link->n, *d))
+        --*d;
+    k = l - intra_link_cells(link->n, *d) + *d;
+    // the last cell of each band is not used for norms
+    if (k == link->n - 1)
+        return 0;
+    a = intra_link_cell_area(link, k - *d, k);
+    // cells too small to normalise are counted by intra_link_far_small
+    return a > FLT_EPSILON? (uint64_t) (ldexp(1. / a, INTRA_FAR_SHIFT) + .5) : 0;
 }
 
 // index mapping (i, j) -> ([n - (j - i)] + [n - 1]) / 2 * (j - i) + j -> (n * 2 - j + i - 1) * (j - i) / 2 + j
@@ -290,75 +790,62 @@ long estimate_inter_link_mat_init_rss(asm_dict_t *dict, uint32_t resolution, uin
 // 22 (0,4) 19 (1,4) 15 (2,4) 10 (3,4) 4  (4,4)
 // 25 (0,5) 23 (1,5) 20 (2,5) 16 (3,5) 11 (4,5) 5  (5,5)
 // 27 (0,6) 26 (1,6) 24 (2,6) 21 (3,6) 17 (4,6) 12 (5,6) 6  (6,6)
-intra_link_mat_t *intra_link_mat_init(asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution)
+// intra links of n sequences of lengths len with restriction site densities re_dens
+// the densities are kept by each intra link, the sequence names are only used for debugging
+static intra_link_mat_t *intra_link_mat_init_len(uint32_t n, uint64_t *len, char **name, double **re_dens, uint32_t resolution, long rss_limit)
 {
     intra_link_mat_t *link_mat;
     intra_link_t *link;
-    uint32_t i, j, k, n, b, p;
-    double a;
-    double **re_dens, *dens, re;
+    uint32_t i, b;
 
-    n = dict->n;
     link_mat = (intra_link_mat_t *) malloc(sizeof(intra_link_mat_t));
     link_mat->n = n;
+    link_mat->r = INTRA_MAX_BAND;
     link_mat->links = (intra_link_t *) calloc(n, sizeof(intra_link_t));
 
-    re_dens = calc_re_cuts_density1(re_cuts, resolution, dict);
-    
     for (i = 0; i < n; ++i) {
         link = &link_mat->links[i];
         link->c = i;
-        if (dict->s[i].len < resolution) {
+        link->re = re_dens? re_dens[i] : 0;
+        if (len[i] < resolution) {
             link->n = 0;
             continue;
         }
-        b = div_ceil(dict->s[i].len, resolution);
+        b = div_ceil(len[i], resolution);
         link->n = b;
         // relative size of the last cell
-        a = ((double) dict->s[i].len - (double) (b - 1) * resolution) / resolution;
-        p = (long) b * (b + 1) / 2;
-        link->link = (double *) calloc(p, sizeof(double));
-        if (!link->link) {
-            fprintf(stderr, "[E::%s] memory allocation failure\n", __func__);
-            exit(EXIT_FAILURE);
-        }
-        if (re_dens) {
-            dens = re_dens[i];
-            for (j = 0; j < b; ++j) {
-                for (k = j; k < b; ++k) {
-                    re = dens[j] * dens[k];
-                    link->link[(long) (b * 2 - k + j - 1) * (k - j) / 2 + k] = re < MIN_RE_DENS? .0 : re;
-                }
-            }
-        } else {
-            for (j = 0; j < p; ++j)
-                link->link[j] = 1.;
-        }
-        // calculate relative area for each cell
-        for (j = 0; j < b; ++j)
-            link->link[(long) (b + j) * (b - j - 1) / 2 + b - 1] *= (a < .5? .0 : a);
-        // the last cell in the diagonal
-        link->link[b - 1] *= (a < SQRT2_2? .0 : a);
-        for (j = 0; j < p; ++j) {
-            if (link->link[j] < FLT_EPSILON)
-                link->link[j] = FLT_EPSILON;
-            else if (link->link[j] > 1.)
-                link->link[j] = -1. / link->link[j];
-        }
-        // need a least half size to count
-        //for (j = 0; j < p; ++j)
-        //    if (link->link[j] < .5)
-        //        link->link[j] = -FLT_MAX;
+        link->a = ((double) len[i] - (double) (b - 1) * resolution) / resolution;
 #ifdef DEBUG_INTRA
-        fprintf(stderr, "[DEBUG_INTRA::%s] %s bins: %d\n", __func__, dict->s[i].name, link->n);
+        fprintf(stderr, "[DEBUG_INTRA::%s] %s bins: %d\n", __func__, name[i], link->n);
+#else
+        (void) name;
 #endif
     }
+    intra_link_mat_alloc(link_mat, rss_limit);
 
-    if (re_dens) {
-        for (i = 0; i < n; ++i)
-            free(re_dens[i]);
-        free(re_dens);
+    return link_mat;
+}
+
+intra_link_mat_t *intra_link_mat_init(asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, long rss_limit)
+{
+    intra_link_mat_t *link_mat;
+    uint32_t i;
+    uint64_t *len;
+    char **name;
+    double **re_dens;
+
+    len = (uint64_t *) malloc(MAX(1, dict->n) * sizeof(uint64_t));
+    name = (char **) malloc(MAX(1, dict->n) * sizeof(char *));
+    for (i = 0; i < dict->n; ++i) {
+        len[i] = dict->s[i].len;
+        name[i] = dict->s[i].name;
     }
+    re_dens = calc_re_cuts_density1(re_cuts, resolution, dict);
+    link_mat = intra_link_mat_init_len(dict->n, len, name, re_dens, resolution, rss_limit);
+    free(re_dens);
+    free(len);
+    free(name);
+
     return link_mat;
 }
 
@@ -377,78 +864,34 @@ long estimate_intra_link_mat_init_rss(asm_dict_t *dict, uint32_t resolution)
         if (dict->s[i].len < resolution)
             continue;
         b = div_ceil(dict->s[i].len, resolution);
-        p = (long) b * (b + 1) / 2;
+        p = intra_link_cells(b, MIN(b, INTRA_MAX_BAND));
         if (p > UINT32_MAX)
             return -1;
 
-        bytes += p * sizeof(double);
+        bytes += p * sizeof(uint32_t);
     }
     return bytes;
 }
 
-intra_link_mat_t *intra_link_mat_init_sdict(sdict_t *dict, re_cuts_t *re_cuts, uint32_t resolution)
+intra_link_mat_t *intra_link_mat_init_sdict(sdict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, long rss_limit)
 {
     intra_link_mat_t *link_mat;
-    intra_link_t *link;
-    uint32_t i, j, k, n, b, p;
-    double a;
-    double **re_dens, *dens, re;
-    
-    n = dict->n;
-    link_mat = (intra_link_mat_t *) malloc(sizeof(intra_link_mat_t));
-    link_mat->n = n;
-    link_mat->links = (intra_link_t *) malloc(n * sizeof(intra_link_t));
-
-    re_dens = calc_re_cuts_density(re_cuts, resolution);
-
-    for (i = 0; i < n; ++i) {
-        link = &link_mat->links[i];
-        link->c = i;
-        if (dict->s[i].len < resolution) {
-            link->n = 0;
-            continue;
-        }
-        b = div_ceil(dict->s[i].len, resolution);
-        link->n = b;
-        // relative size of the last cell
-        a = ((double) dict->s[i].len - (double) (b - 1) * resolution) / resolution;
-        p = (long) b * (b + 1) / 2;
-        link->link = (double *) calloc(p, sizeof(double));
-        if (!link->link) {
-            fprintf(stderr, "[E::%s] memory allocation failure\n", __func__);
-            exit(EXIT_FAILURE);
-        }
-        if (re_dens) {
-            dens = re_dens[i];
-            for (j = 0; j < b; ++j) {
-                for (k = j; k < b; ++k) {
-                    re = dens[j] * dens[k];
-                    link->link[(long) (b * 2 - k + j - 1) * (k - j) / 2 + k] = re < MIN_RE_DENS? .0 : re;
-                }
-            }
-        } else {
-            for (j = 0; j < p; ++j)
-                link->link[j] = 1.;
-        }
-        // calculate relative area for each cell
-        for (j = 0; j < b; ++j)
-            link->link[(long) (b + j) * (b - j - 1) / 2 + b - 1] *= (a < .5? .0 : a);
-        // the last cell in the diagonal
-        link->link[b - 1] *= (a < SQRT2_2? .0 : a);
-        for (j = 0; j < p; ++j) {
-            if (link->link[j] < FLT_EPSILON)
-                link->link[j] = FLT_EPSILON;
-            else if (link->link[j] > 1.)
-                link->link[j] = -1. / link->link[j];
-        }
-        // need a least half size to count
-        //for (j = 0; j < p; ++j)
-        //    if (link->link[j] < .5)
-        //        link->link[j] = -FLT_MAX;
-#ifdef DEBUG_INTRA
-        fprintf(stderr, "[DEBUG_INTRA::%s] %s bins: %d\n", __func__, dict->s[i].name, link->n);
-#endif
+    uint32_t i;
+    uint64_t *len;
+    char **name;
+    double **re_dens;
+
+    len = (uint64_t *) malloc(MAX(1, dict->n) * sizeof(uint64_t));
+    name = (char **) malloc(MAX(1, dict->n) * sizeof(char *));
+    for (i = 0; i < dict->n; ++i) {
+        len[i] = dict->s[i].len;
+        name[i] = dict->s[i].name;
     }
+    re_dens = calc_re_cuts_density(re_cuts, resolution);
+    link_mat = intra_link_mat_init_len(dict->n, len, name, re_dens, resolution, rss_limit);
+    free(re_dens);
+    free(len);
+    free(name);
 
     return link_mat;
 }
@@ -468,245 +911,1355 @@ long estimate_intra_link_mat_init_sdict_rss(sdict_t *dict, uint32_t resolution)
         if (dict->s[i].len < resolution)
             continue;
         b = div_ceil(dict->s[i].len, resolution);
-        p = (long) b * (b + 1) / 2;
+        p = intra_link_cells(b, MIN(b, INTRA_MAX_BAND));
         if (p > UINT32_MAX)
             return -1;
 
-        bytes += p * sizeof(double);
+        bytes += p * sizeof(uint32_t);
     }
     return bytes;
 }
 
-static inline int signf(double l) {
-    return (l > 0) - (l < 0);
+link_scan_t *link_scan_init(asm_dict_t *dict, uint8_t mq, int n_threads)
+{
+    link_scan_t *scan;
+    scan = (link_scan_t *) calloc(1, sizeof(link_scan_t));
+    scan->dict = dict;
+    scan->mq = mq;
+    scan->n_threads = MAX(1, n_threads);
+    return scan;
 }
 
-static inline void normalise_by_size(double *l)
+void link_scan_add(link_scan_t *scan, link_acc_f add, void (*free)(void *), void *data)
 {
-    int s;
-    s = signf(*l);
-    *l *= s;
-    double f, i;
-    // f is the decimal part, i.e., area * re
-    // i is the integer part, i.e., links
-    f = modf(*l, &i);
-    if (f < FLT_EPSILON) {
-        f = 1.;
-        i -= 1.;
-    }
-    assert(i >= 0 && f > 0);
-    // no normalisation for small cells to avoid extreme cases
-    if (fabs(f - FLT_EPSILON) < DBL_EPSILON) {
-        *l = -DBL_MAX;
-        return;
+    if (scan->n == scan->m) {
+        scan->m = scan->m? scan->m << 1 : 4;
+        scan->acc = (link_acc_t *) realloc(scan->acc, scan->m * sizeof(link_acc_t));
     }
-    if (s > 0)
-        i /= f;
-    else
-        i *= f;
-    *l = i;
+    scan->acc[scan->n].add = add;
+    scan->acc[scan->n].free = free;
+    scan->acc[scan->n].data = data;
+    ++scan->n;
 }
 
-intra_link_mat_t *intra_link_mat_from_file(const char *f, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, int use_gap_seq, uint8_t mq)
+void link_scan_destroy(link_scan_t *scan)
 {
-    uint32_t i, j, k, m, n, i0, i1, b0, b1;
-    uint64_t p0, p1;
-    int64_t magic_number;
-    uint8_t buffer[BUFF_SIZE * 17];
-    long pair_c, intra_c;
-    intra_link_mat_t *link_mat;
-    intra_link_t *link;
-    FILE *fp;
+    uint32_t i;
+    for (i = 0; i < scan->n; ++i)
+        if (scan->acc[i].free)
+            scan->acc[i].free(scan->acc[i].data);
+    free(scan->acc);
+    free(scan);
+}
 
-    fp = fopen(f, "r");
-    if (fp == NULL)
-        return 0;
+typedef struct {
+    link_scan_t *scan;
+    uint8_t *buffer;
+    uint32_t n; // number of records in buffer
+    link_pair_t **pairs; // pair buffer of each thread
+    bin_cols_t *cols; // decoded records of each thread
+    uint32_t **si; // converted sequence ids of both ends of each thread [2 x BUFF_SIZE]
+    uint64_t **sp; // converted positions of both ends of each thread [2 x BUFF_SIZE]
+    int rec_c; // count records within and between contigs
+} link_scan_step_t;
+
+// count the records within each contig and between contigs
+static void link_scan_rec_count(bin_cols_t *cols, uint32_t n)
+{
+    uint32_t j, c, m;
+    long k;
+
+    k = 0;
+    for (j = 0; j < n; ) {
+        c = cols->c0[j];
+        if (cols->c1[j] != c || c >= rec_c_n) {
+            ++k;
+            ++j;
+            continue;
+        }
+        // runs of records within the same contig
+        for (m = 0; j < n && cols->c0[j] == c && cols->c1[j] == c; ++j)
+            ++m;
+        __atomic_fetch_add(&rec_c_intra[c], m, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&rec_c_inter, k, __ATOMIC_RELAXED);
+}
 
-    m = fread(&magic_number, sizeof(int64_t), 1, fp);
-    if (!m || !is_valid_bin_header(magic_number)) {
-        fprintf(stderr, "[E::%s] not a valid BIN file\n", __func__);
-        return 0;
+// convert one block of BUFF_SIZE records and dispatch it to accumulators
+static void link_scan_worker(void *data, long i, int tid)
+{
+    uint32_t j, k, n, *si;
+    uint64_t *sp;
+    uint8_t *buffer;
+    link_scan_step_t *step;
+    link_scan_t *scan;
+    link_pair_t *pairs, *pair;
+    bin_cols_t *cols;
+
+    step = (link_scan_step_t *) data;
+    scan = step->scan;
+    pairs = step->pairs[tid];
+    cols = &step->cols[tid];
+    si = step->si[tid];
+    sp = step->sp[tid];
+    buffer = step->buffer + i * BUFF_SIZE * BIN_RECORD_SIZE;
+    n = MIN(step->n - i * BUFF_SIZE, BUFF_SIZE);
+
+    k = bin_cols_decode(cols, buffer, n, scan->mq);
+    sd_coordinate_conversion_batch(scan->dict, k, cols->c0, cols->p0, si, sp, 0);
+    sd_coordinate_conversion_batch(scan->dict, k, cols->c1, cols->p1, si + BUFF_SIZE, sp + BUFF_SIZE, 0);
+    for (j = 0; j < k; ++j) {
+        pair = &pairs[j];
+        pair->c0 = cols->c0[j];
+        pair->x0 = cols->p0[j];
+        pair->c1 = cols->c1[j];
+        pair->x1 = cols->p1[j];
+        pair->i0 = si[j];
+        pair->p0 = sp[j];
+        pair->i1 = si[BUFF_SIZE + j];
+        pair->p1 = sp[BUFF_SIZE + j];
     }
+    __atomic_fetch_add(&scan->link_c, k, __ATOMIC_RELAXED);
+    if (step->rec_c)
+        link_scan_rec_count(cols, k);
+
+    for (j = 0; j < scan->n; ++j)
+        scan->acc[j].add(scan->acc[j].data, pairs, k, tid);
+}
 
-    link_mat = use_gap_seq? intra_link_mat_init(dict, re_cuts, resolution) : intra_link_mat_init_sdict(dict->sdict, re_cuts, resolution);
+// keep a contig pair if both contigs are placed in the same scaffold
+static int link_scan_keep_intra(uint32_t c0, uint32_t c1, void *data)
+{
+    uint32_t i, j;
+    contig_scaf_t *cs;
+
+    if (c0 == c1)
+        return 1;
+    cs = (contig_scaf_t *) data;
+    i = cs->s[c0];
+    j = cs->s[c1];
+    while (i < cs->s[c0 + 1] && j < cs->s[c1 + 1]) {
+        if (cs->a[i] == cs->a[j])
+            return 1;
+        if (cs->a[i] < cs->a[j])
+            ++i;
+        else
+            ++j;
+    }
+    return 0;
+}
 
-    pair_c = 0;
+// keep a contig pair unless both contigs are placed only in the same scaffold
+static int link_scan_keep_inter(uint32_t c0, uint32_t c1, void *data)
+{
+    contig_scaf_t *cs;
+
+    cs = (contig_scaf_t *) data;
+    if (cs->s[c0] == cs->s[c0 + 1] || cs->s[c1] == cs->s[c1 + 1])
+        return 1;
+    return cs->a[cs->s[c0]] != cs->a[cs->s[c0 + 1] - 1] ||
+        cs->a[cs->s[c1]] != cs->a[cs->s[c1 + 1] - 1] ||
+        cs->a[cs->s[c0]] != cs->a[cs->s[c1]];
+}
+
+// select the records of contig pairs within scaffolds from an indexed BIN file
+static void link_scan_select_intra(link_scan_t *scan, bin_reader_t *reader)
+{
+    contig_scaf_t cs;
+    long m;
+
+    contig_scaf_init(&cs, scan->dict);
+    m = bin_reader_select(reader, link_scan_keep_intra, &cs, scan->mq);
+#ifdef DEBUG
+    fprintf(stderr, "[DEBUG::%s] %ld records selected from BIN index\n", __func__, m);
+#else
+    (void) m;
+#endif
+
+    contig_scaf_destroy(&cs);
+}
+
+int link_scan_file(link_scan_t *scan, const char *f)
+{
+    uint32_t i, b;
+    long m;
+    link_scan_step_t step;
+    bin_reader_t *reader;
+    int ret;
+
+    reader = bin_reader_open(f);
+    if (reader == NULL)
+        return 1;
+    if (scan->intra_only && reader->idx)
+        link_scan_select_intra(scan, reader);
+    else if (scan->keep && reader->idx)
+        bin_reader_select(reader, scan->keep, scan->keep_data, scan->mq);
+    else if (scan->mq > 0 && reader->idx)
+        bin_reader_select(reader, 0, 0, scan->mq);
+
+    // all records are read without an index and counted for the memory estimates if not counted before
+    step.rec_c = !reader->idx && (rec_c_f == 0 || strcmp(rec_c_f, f) || rec_c_mq > scan->mq);
+    if (step.rec_c)
+        bin_file_rec_init(scan->dict->sdict->n);
+
+    // each thread works on blocks of BUFF_SIZE records
+    b = scan->n_threads > 1? scan->n_threads * 16 : 1;
+    step.scan = scan;
+    step.pairs = (link_pair_t **) malloc(scan->n_threads * sizeof(link_pair_t *));
+    step.cols = (bin_cols_t *) malloc(scan->n_threads * sizeof(bin_cols_t));
+    step.si = (uint32_t **) malloc(scan->n_threads * sizeof(uint32_t *));
+    step.sp = (uint64_t **) malloc(scan->n_threads * sizeof(uint64_t *));
+    for (i = 0; i < scan->n_threads; ++i) {
+        step.pairs[i] = (link_pair_t *) malloc(BUFF_SIZE * sizeof(link_pair_t));
+        bin_cols_init(&step.cols[i], BUFF_SIZE);
+        step.si[i] = (uint32_t *) malloc(BUFF_SIZE * 2 * sizeof(uint32_t));
+        step.sp[i] = (uint64_t *) malloc(BUFF_SIZE * 2 * sizeof(uint64_t));
+    }
+    ret = 0;
+    while ((m = bin_reader_read(reader, &step.buffer, (long) b * BUFF_SIZE)) > 0) {
+        step.n = m;
+        scan->pair_c += m;
+        kt_for(scan->n_threads, link_scan_worker, &step, div_ceil(m, BUFF_SIZE));
+    }
+    if (m < 0)
+        ret = 1;
+    if (step.rec_c) {
+        if (ret)
+            bin_file_rec_clear();
+        else
+            bin_file_rec_done(f, scan->mq);
+    }
+    for (i = 0; i < scan->n_threads; ++i) {
+        free(step.pairs[i]);
+        bin_cols_destroy(&step.cols[i]);
+        free(step.si[i]);
+        free(step.sp[i]);
+    }
+    free(step.pairs);
+    free(step.cols);
+    free(step.si);
+    free(step.sp);
+    bin_reader_close(reader);
+
+    return ret;
+}
+
+// add one link to a cell
+static inline void link_add1(uint32_t *l, int atomic)
+{
+    if (atomic)
+        __atomic_fetch_add(l, 1, __ATOMIC_RELAXED);
+    else
+        ++*l;
+}
+
+typedef struct {
+    intra_link_mat_t *link_mat;
+    uint32_t resolution;
+    int use_gap_seq;
+    int atomic;
+    long intra_c;
+} intra_link_acc_t;
+
+static void intra_link_add(void *data, link_pair_t *pairs, uint32_t n, int tid)
+{
+    uint32_t i, i0, i1, b0, b1, d, resolution;
+    long k, intra_c;
+    uint64_t far_c, w;
+    intra_link_acc_t *acc;
+    intra_link_t *link;
+    link_pair_t *pair;
+
+    acc = (intra_link_acc_t *) data;
+    resolution = acc->resolution;
     intra_c = 0;
+    far_c = 0;
+    for (i = 0; i < n; ++i) {
+        pair = &pairs[i];
+        if (acc->use_gap_seq) {
+            i0 = pair->i0;
+            i1 = pair->i1;
+            b0 = (MAX(pair->p0, 1) - 1) / resolution;
+            b1 = (MAX(pair->p1, 1) - 1) / resolution;
+        } else {
+            i0 = pair->c0;
+            i1 = pair->c1;
+            b0 = (MAX(pair->x0, 1) - 1) / resolution;
+            b1 = (MAX(pair->x1, 1) - 1) / resolution;
+        }
+
+        if (i0 == i1) {
+            link = &acc->link_mat->links[i0];
+            if (link->n) {
+                if (b0 > b1)
+                    SWAP(uint32_t, b0, b1);
+                k = (long) (link->n * 2 - b1 + b0 - 3) * (b1 - b0) / 2 + b1;
+                if (k < intra_link_cells(link->n, link->r))
+                    link_add1(&link->link[k], acc->atomic);
+                else {
+                    d = b1 - b0;
+                    w = intra_link_far_weight(link, k, &d);
+                    // only links of sequences not sampled fall into the first r bands
+                    if (d < acc->link_mat->r)
+                        __atomic_fetch_add(&acc->link_mat->band_c[d], w, __ATOMIC_RELAXED);
+                    else
+                        far_c += w;
+                }
+            }
+
+            ++intra_c;
+        }
+    }
+    __atomic_fetch_add(&acc->intra_c, intra_c, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&acc->link_mat->far_c, far_c, __ATOMIC_RELAXED);
+}
+
+void link_scan_add_intra_link_mat(link_scan_t *scan, intra_link_mat_t *link_mat, uint32_t resolution, int use_gap_seq)
+{
+    intra_link_acc_t *acc;
+    acc = (intra_link_acc_t *) calloc(1, sizeof(intra_link_acc_t));
+    acc->link_mat = link_mat;
+    acc->resolution = resolution;
+    acc->use_gap_seq = use_gap_seq;
+    acc->atomic = scan->n_threads > 1;
+    link_scan_add(scan, intra_link_add, free, acc);
+}
 
-    while (1) {
-        m = fread(buffer, sizeof(uint8_t), BUFF_SIZE * 17, fp);
+// find the end bins of an inter link
+// return the link type (0...3) or -1 if out of radius
+static inline int inter_link_bins(asm_dict_t *dict, uint32_t i0, uint64_t p0, uint32_t i1, uint64_t p1, uint32_t resolution, uint32_t *b0, uint32_t *b1)
+{
+    double l0, l1;
+
+    l0 = dict->s[i0].len / 2.;
+    l1 = dict->s[i1].len / 2.;
+
+    if (p0 >= l0 && p1 < l1) {
+        // i0(-) -> i1(+)
+        *b0 = (uint32_t) ((2 * l0 - p0) / resolution);
+        *b1 = (uint32_t) ((double) p1 / resolution);
+        return 0;
+    } else if(p0 >= l0 && p1 >= l1) {
+        // i0(-) -> i1(-)
+        *b0 = (uint32_t) ((2 * l0 - p0) / resolution);
+        *b1 = (uint32_t) ((2 * l1 - p1) / resolution);
+        return 1;
+    } else if(p0 < l0 && p1 < l1) {
+        // i0(+) -> i1(+)
+        *b0 = (uint32_t) ((double) p0 / resolution);
+        *b1 = (uint32_t) ((double) p1 / resolution);
+        return 2;
+    } else if(p0 < l0 && p1 >= l1) {
+        // i0(+) -> i1(-)
+        *b0 = (uint32_t) ((double) p0 / resolution);
+        *b1 = (uint32_t) ((2 * l1 - p1) / resolution);
+        return 3;
+    }
+    return -1;
+}
 
-        for (i = 0; i < m; i += 17) {
-            if (*(uint8_t *) (buffer + i + 16) < mq)
+typedef struct {
+    inter_link_mat_t *link_mat;
+    asm_dict_t *dict;
+    uint32_t resolution;
+    int atomic;
+    pthread_mutex_t mutex;
+    long inter_c, radius_c;
+    int n_threads;
+    // scratch space of each thread [BUFF_SIZE]
+    uint64_t **key;
+    uint32_t **k;
+    int8_t **t;
+    uint32_t ***l;
+} inter_link_acc_t;
+
+static void inter_link_add(void *data, link_pair_t *pairs, uint32_t n, int tid)
+{
+    uint32_t i, j, m, i0, i1, b0, b1, radius, resolution, *b, *k;
+    uint64_t p0, p1, *key;
+    long inter_c, radius_c;
+    int t;
+    int8_t *tt;
+    uint32_t **l;
+    inter_link_acc_t *acc;
+    inter_link_mat_t *link_mat;
+    
+    acc = (inter_link_acc_t *) data;
+    link_mat = acc->link_mat;
+    inter_c = radius_c = 0;
+    radius = link_mat->r;
+    resolution = acc->resolution;
+    b = link_mat->b;
+    key = acc->key[tid];
+    k = acc->k[tid];
+    tt = acc->t[tid];
+    l = acc->l[tid];
+    m = 0;
+    for (i = 0; i < n; ++i) {
+        i0 = pairs[i].i0;
+        i1 = pairs[i].i1;
+        p0 = pairs[i].p0;
+        p1 = pairs[i].p1;
+
+        if (i0 != i1) {
+            if (i0 > i1) {
+                SWAP(uint32_t, i0, i1);
+                SWAP(uint64_t, p0, p1);
+            }
+
+            if (b[i0] == 0 || b[i1] == 0)
                 continue;
 
-            if (use_gap_seq) {
-                sd_coordinate_conversion(dict, *(uint32_t *) (buffer + i),     *(uint32_t *) (buffer + i + 4),  &i0, &p0, 0);
-                sd_coordinate_conversion(dict, *(uint32_t *) (buffer + i + 8), *(uint32_t *) (buffer + i + 12), &i1, &p1, 0);
-                b0 = (MAX(p0, 1) - 1) / resolution;
-                b1 = (MAX(p1, 1) - 1) / resolution;
-            } else {
-                i0 = *(uint32_t *) (buffer + i);
-                i1 = *(uint32_t *) (buffer + i + 8);
-                b0 = (MAX(*(uint32_t *) (buffer + i + 4),  1) - 1) / resolution;
-                b1 = (MAX(*(uint32_t *) (buffer + i + 12), 1) - 1) / resolution;
+            t = inter_link_bins(acc->dict, i0, p0, i1, p1, resolution, &b0, &b1);
+            if (t >= 0 && b0 < b[i0] && b1 < b[i1] && b0 + b1 < radius) {
+                key[m] = (uint64_t) i0 << 32 | i1;
+                k[m] = (long) (MAX(1, b0) - 1) * b[i1] + b1;
+                tt[m] = t;
+                ++m;
+                ++radius_c;
             }
 
-            if (i0 == i1) {
-                link = &link_mat->links[i0];
-                if (link->n) {
-                    if (b0 > b1)
-                        SWAP(uint32_t, b0, b1);
-                    k = (long) (link->n * 2 - b1 + b0 - 3) * (b1 - b0) / 2 + b1;
-                    link->link[k] += signf(link->link[k]);
-                }
+            ++inter_c;
+        }
+    }
+
+    // cells of a pair are allocated at its first link
+    if (acc->atomic)
+        pthread_mutex_lock(&acc->mutex);
+    for (i = 0; i < m; ++i) {
+        // links may be reallocated by inter_link_put
+        j = inter_link_put(link_mat, key[i] >> 32, (uint32_t) key[i]);
+        l[i] = link_mat->links[j].link[tt[i]] + k[i];
+    }
+    if (acc->atomic)
+        pthread_mutex_unlock(&acc->mutex);
+
+    for (i = 0; i < m; ++i)
+        link_add1(l[i], acc->atomic);
+
+    __atomic_fetch_add(&acc->inter_c, inter_c, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&acc->radius_c, radius_c, __ATOMIC_RELAXED);
+}
 
-                ++intra_c;
+static void inter_link_acc_free(void *data)
+{
+    int i;
+    inter_link_acc_t *acc = (inter_link_acc_t *) data;
+    for (i = 0; i < acc->n_threads; ++i) {
+        free(acc->key[i]);
+        free(acc->k[i]);
+        free(acc->t[i]);
+        free(acc->l[i]);
+    }
+    free(acc->key);
+    free(acc->k);
+    free(acc->t);
+    free(acc->l);
+    pthread_mutex_destroy(&acc->mutex);
+    free(acc);
+}
+
+void link_scan_add_inter_link_mat(link_scan_t *scan, inter_link_mat_t *link_mat, uint32_t resolution)
+{
+    int i;
+    inter_link_acc_t *acc;
+    acc = (inter_link_acc_t *) calloc(1, sizeof(inter_link_acc_t));
+    acc->link_mat = link_mat;
+    acc->dict = scan->dict;
+    acc->resolution = resolution;
+    acc->atomic = scan->n_threads > 1;
+    pthread_mutex_init(&acc->mutex, 0);
+    acc->n_threads = scan->n_threads;
+    acc->key = (uint64_t **) malloc(acc->n_threads * sizeof(uint64_t *));
+    acc->k = (uint32_t **) malloc(acc->n_threads * sizeof(uint32_t *));
+    acc->t = (int8_t **) malloc(acc->n_threads * sizeof(int8_t *));
+    acc->l = (uint32_t ***) malloc(acc->n_threads * sizeof(uint32_t **));
+    for (i = 0; i < acc->n_threads; ++i) {
+        acc->key[i] = (uint64_t *) malloc(BUFF_SIZE * sizeof(uint64_t));
+        acc->k[i] = (uint32_t *) malloc(BUFF_SIZE * sizeof(uint32_t));
+        acc->t[i] = (int8_t *) malloc(BUFF_SIZE * sizeof(int8_t));
+        acc->l[i] = (uint32_t **) malloc(BUFF_SIZE * sizeof(uint32_t *));
+    }
+    link_scan_add(scan, inter_link_add, inter_link_acc_free, acc);
+}
+
+typedef struct {
+    inter_link_raw_t *raw;
+    asm_dict_t *dict;
+    int atomic;
+    pthread_mutex_t mutex;
+    int n_threads;
+    // scratch space of each thread [BUFF_SIZE]
+    uint64_t **key;
+    uint64_t **k;
+    uint32_t ***cnt;
+} inter_link_raw_acc_t;
+
+// if the counts of the sequence pair (i, j) are lifted from the earlier round
+// all cells (b0, b1) at this resolution need the cells (f0, f1) of the earlier round with f0 < f[i], f1 < f[j]
+// and f0 + f1 <= MIN(f[i] + f[j] - 2, k * (r + 1) - 2), which are kept if f0 + f1 < r0
+static inline int inter_link_raw_lifted(inter_link_raw_t *raw, uint32_t i, uint32_t j)
+{
+    if (raw->b[i] == 0 || raw->b[j] == 0)
+        return 1;
+    if (raw->f[i] == 0 || raw->f[j] == 0)
+        return 0;
+    return MIN(raw->f[i] + raw->f[j] - 2, raw->k * (raw->r + 1) - 2) < raw->r0;
+}
+
+// get the counts of the sequence pair (i, j), i < j, allocated at its first link
+static uint32_t *inter_link_raw_put(inter_link_raw_t *raw, uint32_t i, uint32_t j)
+{
+    int absent;
+    khint_t x;
+
+    x = kh_put(inter_link, raw->h, (uint64_t) i << 32 | j, &absent);
+    if (!absent)
+        return raw->cnt[kh_val(raw->h, x)];
+
+    if (raw->np == raw->mp) {
+        raw->mp = raw->mp? raw->mp << 1 : 16;
+        raw->pair = (uint64_t *) realloc(raw->pair, raw->mp * sizeof(uint64_t));
+        raw->cnt = (uint32_t **) realloc(raw->cnt, raw->mp * sizeof(uint32_t *));
+    }
+    kh_val(raw->h, x) = raw->np;
+    raw->pair[raw->np] = (uint64_t) i << 32 | j;
+    raw->cnt[raw->np] = (uint32_t *) calloc((long) raw->b[i] * raw->b[j] * 4, sizeof(uint32_t));
+    if (!raw->cnt[raw->np]) {
+        fprintf(stderr, "[E::%s] memory allocation failure\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+
+    return raw->cnt[raw->np++];
+}
+
+static void inter_link_raw_add(void *data, link_pair_t *pairs, uint32_t n, int tid)
+{
+    uint32_t i, m, i0, i1, b0, b1, c0, c1, radius, resolution;
+    uint64_t p0, p1, *key, *k;
+    long inter_c, radius_c;
+    int t;
+    inter_link_raw_acc_t *acc;
+    inter_link_raw_t *raw;
+    uint32_t **cnt;
+
+    acc = (inter_link_raw_acc_t *) data;
+    inter_c = radius_c = 0;
+    raw = acc->raw;
+    radius = raw->r;
+    resolution = raw->resolution;
+    key = acc->key[tid];
+    k = acc->k[tid];
+    cnt = acc->cnt[tid];
+    m = 0;
+    for (i = 0; i < n; ++i) {
+        i0 = pairs[i].i0;
+        i1 = pairs[i].i1;
+        p0 = pairs[i].p0;
+        p1 = pairs[i].p1;
+
+        if (i0 != i1) {
+            if (i0 > i1) {
+                SWAP(uint32_t, i0, i1);
+                SWAP(uint64_t, p0, p1);
             }
 
-            ++pair_c;
+            c0 = raw->b[i0];
+            c1 = raw->b[i1];
+            if (c0 == 0 || c1 == 0)
+                continue;
+            // counts lifted from an earlier round
+            if (raw->k && inter_link_raw_lifted(raw, i0, i1))
+                continue;
+
+            t = inter_link_bins(acc->dict, i0, p0, i1, p1, resolution, &b0, &b1);
+            if (t >= 0 && b0 < c0 && b1 < c1 && b0 + b1 < radius) {
+                key[m] = (uint64_t) i0 << 32 | i1;
+                k[m] = ((uint64_t) t * c0 + b0) * c1 + b1;
+                ++m;
+                ++radius_c;
+            }
+
+            ++inter_c;
         }
+    }
 
-        if (m < BUFF_SIZE * 17) {
-            if (ferror(fp))
-                return 0;
-            break;
+    if (acc->atomic)
+        pthread_mutex_lock(&acc->mutex);
+    for (i = 0; i < m; ++i)
+        cnt[i] = inter_link_raw_put(raw, key[i] >> 32, (uint32_t) key[i]);
+    if (acc->atomic)
+        pthread_mutex_unlock(&acc->mutex);
+
+    for (i = 0; i < m; ++i) {
+        if (acc->atomic)
+            __atomic_fetch_add(&cnt[i][k[i]], 1, __ATOMIC_RELAXED);
+        else
+            ++cnt[i][k[i]];
+    }
+
+    __atomic_fetch_add(&raw->inter_c, inter_c, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&raw->radius_c, radius_c, __ATOMIC_RELAXED);
+}
+
+static void inter_link_raw_acc_free(void *data)
+{
+    int i;
+    inter_link_raw_acc_t *acc = (inter_link_raw_acc_t *) data;
+    for (i = 0; i < acc->n_threads; ++i) {
+        free(acc->key[i]);
+        free(acc->k[i]);
+        free(acc->cnt[i]);
+    }
+    free(acc->key);
+    free(acc->k);
+    free(acc->cnt);
+    pthread_mutex_destroy(&acc->mutex);
+    free(acc);
+}
+
+void link_scan_add_inter_link_raw(link_scan_t *scan, inter_link_raw_t *raw)
+{
+    int i;
+    inter_link_raw_acc_t *acc;
+    acc = (inter_link_raw_acc_t *) calloc(1, sizeof(inter_link_raw_acc_t));
+    acc->raw = raw;
+    acc->dict = scan->dict;
+    acc->atomic = scan->n_threads > 1;
+    pthread_mutex_init(&acc->mutex, 0);
+    acc->n_threads = scan->n_threads;
+    acc->key = (uint64_t **) malloc(acc->n_threads * sizeof(uint64_t *));
+    acc->k = (uint64_t **) malloc(acc->n_threads * sizeof(uint64_t *));
+    acc->cnt = (uint32_t ***) malloc(acc->n_threads * sizeof(uint32_t **));
+    for (i = 0; i < acc->n_threads; ++i) {
+        acc->key[i] = (uint64_t *) malloc(BUFF_SIZE * sizeof(uint64_t));
+        acc->k[i] = (uint64_t *) malloc(BUFF_SIZE * sizeof(uint64_t));
+        acc->cnt[i] = (uint32_t **) malloc(BUFF_SIZE * sizeof(uint32_t *));
+    }
+    link_scan_add(scan, inter_link_raw_add, inter_link_raw_acc_free, acc);
+}
+
+inter_link_raw_t *inter_link_raw_init(asm_dict_t *dict, uint32_t resolution, uint32_t radius)
+{
+    inter_link_raw_t *raw;
+    uint32_t i, n, r2;
+
+    n = dict->n;
+    r2 = resolution * 2;
+    raw = (inter_link_raw_t *) calloc(1, sizeof(inter_link_raw_t));
+    raw->n = n;
+    raw->r = radius;
+    raw->resolution = resolution;
+    raw->b = (uint32_t *) calloc(n, sizeof(uint32_t));
+    raw->h = kh_init(inter_link);
+    for (i = 0; i < n; ++i)
+        raw->b[i] = dict->s[i].len < r2? 0 : MIN(radius, div_ceil(dict->s[i].len, r2));
+
+    return raw;
+}
+
+void inter_link_raw_destroy(inter_link_raw_t *raw)
+{
+    uint32_t i;
+    for (i = 0; i < raw->np; ++i)
+        free(raw->cnt[i]);
+    free(raw->cnt);
+    free(raw->pair);
+    kh_destroy(inter_link, raw->h);
+    free(raw->b);
+    free(raw->f);
+    free(raw);
+}
+
+// memory of raw inter link counts of a sequence pair of bin numbers (b0, b1)
+static long inter_link_raw_pair_rss(uint32_t b0, uint32_t b1)
+{
+    if (b0 == 0 || b1 == 0)
+        return 0;
+    // counts, pair record and hash entry
+    return (long) b0 * b1 * 4 * sizeof(uint32_t) + sizeof(uint32_t *) + sizeof(uint64_t) + 16;
+}
+
+// raw inter links of the last two scaffolding rounds and the assemblies they were collected on
+// scaffolds not changed in a round may be written in the reverse orientation and match those two rounds before
+#define INTER_LINK_RAW_KEPT 2
+static inter_link_raw_t *raw_kept[INTER_LINK_RAW_KEPT];
+static asm_dict_t *raw_kept_dict[INTER_LINK_RAW_KEPT];
+
+static void inter_link_raw_drop(int i)
+{
+    if (raw_kept[i])
+        inter_link_raw_destroy(raw_kept[i]);
+    if (raw_kept_dict[i])
+        asm_destroy(raw_kept_dict[i]);
+    raw_kept[i] = 0;
+    raw_kept_dict[i] = 0;
+}
+
+void inter_link_raw_clear(void)
+{
+    int i;
+    for (i = 0; i < INTER_LINK_RAW_KEPT; ++i)
+        inter_link_raw_drop(i);
+}
+
+// keep the raw inter links of a scaffolding round for the next rounds
+// the ownership of raw and dict is taken
+void inter_link_raw_keep(inter_link_raw_t *raw, asm_dict_t *dict)
+{
+    inter_link_raw_drop(INTER_LINK_RAW_KEPT - 1);
+    memmove(raw_kept + 1, raw_kept, (INTER_LINK_RAW_KEPT - 1) * sizeof(inter_link_raw_t *));
+    memmove(raw_kept_dict + 1, raw_kept_dict, (INTER_LINK_RAW_KEPT - 1) * sizeof(asm_dict_t *));
+    // the sequence dictionary may be freed by its owner
+    dict->sdict = 0;
+    raw_kept[0] = raw;
+    raw_kept_dict[0] = dict;
+}
+
+long inter_link_raw_kept_rss(void)
+{
+    int i;
+    uint32_t j;
+    long bytes;
+    inter_link_raw_t *raw;
+
+    bytes = 0;
+    for (i = 0; i < INTER_LINK_RAW_KEPT; ++i) {
+        raw = raw_kept[i];
+        if (!raw)
+            continue;
+        bytes += sizeof(inter_link_raw_t) + raw->n * sizeof(uint32_t);
+        for (j = 0; j < raw->np; ++j)
+            bytes += inter_link_raw_pair_rss(raw->b[raw->pair[j] >> 32], raw->b[(uint32_t) raw->pair[j]]);
+    }
+    return bytes;
+}
+
+// sequences of dict not changed since the assembly d0, UINT32_MAX for the changed ones
+static uint32_t *asm_seq_map(asm_dict_t *dict, asm_dict_t *d0)
+{
+    uint32_t i, j, *map;
+    int absent;
+    khint_t x;
+    khash_t(inter_link) *h;
+    sd_aseq_t *s, *s0;
+    sd_seg_t *g, *g0;
+
+    // sequences of d0 by the first segment
+    h = kh_init(inter_link);
+    for (i = 0; i < d0->n; ++i) {
+        g0 = &d0->seg[d0->s[i].s];
+        x = kh_put(inter_link, h, (uint64_t) g0->c << 32 | g0->x, &absent);
+        kh_val(h, x) = i;
+    }
+
+    map = (uint32_t *) malloc(MAX(1, dict->n) * sizeof(uint32_t));
+    for (i = 0; i < dict->n; ++i) {
+        map[i] = UINT32_MAX;
+        s = &dict->s[i];
+        g = &dict->seg[s->s];
+        x = kh_get(inter_link, h, (uint64_t) g->c << 32 | g->x);
+        if (x == kh_end(h))
+            continue;
+        s0 = &d0->s[kh_val(h, x)];
+        if (s->len != s0->len || s->n != s0->n)
+            continue;
+        g0 = &d0->seg[s0->s];
+        for (j = 0; j < s->n; ++j)
+            if (g[j].c != g0[j].c || g[j].x != g0[j].x || g[j].y != g0[j].y || g[j].a != g0[j].a)
+                break;
+        if (j == s->n)
+            map[i] = kh_val(h, x);
+    }
+    kh_destroy(inter_link, h);
+
+    return map;
+}
+
+// number of bins of raw0 needed for each sequence of raw if its counts can be lifted from raw0, 0 otherwise
+// return the number of sequences that can be lifted
+static uint32_t inter_link_raw_lift_bins(inter_link_raw_t *raw, asm_dict_t *dict, inter_link_raw_t *raw0, uint32_t *map, uint32_t *f)
+{
+    uint32_t i, k, b, n;
+
+    k = raw->resolution / raw0->resolution;
+    n = 0;
+    for (i = 0; i < raw->n; ++i) {
+        f[i] = 0;
+        if (map[i] == UINT32_MAX || raw->b[i] == 0)
+            continue;
+        // no links beyond the middle of the sequence
+        b = MIN(k * raw->b[i], dict->s[i].len / (raw0->resolution * 2) + 1);
+        if (b <= raw0->b[map[i]]) {
+            f[i] = b;
+            ++n;
         }
     }
-#ifdef DEBUG
-    fprintf(stderr, "[DEBUG::%s] %ld read pairs processed, %ld intra links \n", __func__, pair_c, intra_c);
-#endif
-    fclose(fp);
+    return n;
+}
 
-    // normalise links by cell size
-    for (i = 0; i < link_mat->n; ++i) {
-        link = &link_mat->links[i];
-        n = link->n;
-        if (n == 0)
+// sum the raw counts of sequence pairs not changed since one of the last two rounds into raw
+// only if the resolution is an integer multiple of that round, where each bin is the union of bins of that round
+// the raw inter links of the older round are released
+void inter_link_raw_lift(inter_link_raw_t *raw, asm_dict_t *dict)
+{
+    // link type with the sequence pair swapped
+    static const uint32_t swap_t[4] = {3, 1, 2, 0};
+    uint32_t i, j, k, t, t1, f0, f1, e0, e1, b0, b1, c0, c1, i0, i1, m, m0;
+    uint32_t *map, *map0, *rmap, *f, *f1s, *cnt, *cnt1;
+    uint64_t n;
+    int l, l0;
+    inter_link_raw_t *raw0;
+
+    // the round with most sequences to lift
+    map0 = f = 0;
+    m0 = 0;
+    l0 = -1;
+    f1s = (uint32_t *) malloc(MAX(1, raw->n) * sizeof(uint32_t));
+    for (l = 0; l < INTER_LINK_RAW_KEPT; ++l) {
+        raw0 = raw_kept[l];
+        if (!raw0 || raw->resolution % raw0->resolution)
             continue;
-        n = (long) n * (n + 1) / 2;
-        for (j = 0; j < n; ++j)
-            normalise_by_size(&link->link[j]);
+        map = asm_seq_map(dict, raw_kept_dict[l]);
+        m = inter_link_raw_lift_bins(raw, dict, raw0, map, f1s);
+        if (m > m0) {
+            SWAP(uint32_t *, f, f1s);
+            if (!f1s)
+                f1s = (uint32_t *) malloc(MAX(1, raw->n) * sizeof(uint32_t));
+            free(map0);
+            map0 = map;
+            m0 = m;
+            l0 = l;
+        } else {
+            free(map);
+        }
+    }
+    free(f1s);
+    if (l0 < 0) {
+        inter_link_raw_drop(INTER_LINK_RAW_KEPT - 1);
+        return;
     }
 
-    return link_mat;
+    raw0 = raw_kept[l0];
+    map = map0;
+    k = raw->resolution / raw0->resolution;
+    raw->k = k;
+    raw->r0 = raw0->r;
+    raw->f = f;
+    rmap = (uint32_t *) malloc(MAX(1, raw0->n) * sizeof(uint32_t));
+    for (i = 0; i < raw0->n; ++i)
+        rmap[i] = UINT32_MAX;
+    for (i = 0; i < raw->n; ++i)
+        if (map[i] != UINT32_MAX)
+            rmap[map[i]] = i;
+
+    n = 0;
+    for (i = 0; i < raw0->np; ++i) {
+        i0 = rmap[raw0->pair[i] >> 32];
+        i1 = rmap[(uint32_t) raw0->pair[i]];
+        if (i0 == UINT32_MAX || i1 == UINT32_MAX || raw->b[i0] == 0 || raw->b[i1] == 0 || !inter_link_raw_lifted(raw, i0, i1))
+            continue;
+        c0 = raw0->b[raw0->pair[i] >> 32];
+        c1 = raw0->b[(uint32_t) raw0->pair[i]];
+        b0 = raw->b[MIN(i0, i1)];
+        b1 = raw->b[MAX(i0, i1)];
+        cnt = raw0->cnt[i];
+        cnt1 = 0;
+        for (t = 0; t < 4; ++t) {
+            for (f0 = 0; f0 < c0; ++f0) {
+                for (f1 = 0; f1 < c1 && f0 + f1 < raw0->r; ++f1) {
+                    j = cnt[((long) t * c0 + f0) * c1 + f1];
+                    if (j == 0)
+                        continue;
+                    if (i0 < i1) {
+                        t1 = t;
+                        e0 = f0 / k;
+                        e1 = f1 / k;
+                    } else {
+                        t1 = swap_t[t];
+                        e0 = f1 / k;
+                        e1 = f0 / k;
+                    }
+                    if (e0 >= b0 || e1 >= b1 || e0 + e1 >= raw->r)
+                        continue;
+                    if (cnt1 == 0)
+                        cnt1 = inter_link_raw_put(raw, MIN(i0, i1), MAX(i0, i1));
+                    cnt1[((long) t1 * b0 + e0) * b1 + e1] += j;
+                }
+            }
+        }
+        if (cnt1)
+            ++n;
+    }
+    free(map);
+    free(rmap);
+    inter_link_raw_drop(INTER_LINK_RAW_KEPT - 1);
+#ifdef DEBUG
+    fprintf(stderr, "[DEBUG::%s] %u sequences and %lu sequence pairs lifted from resolution %u\n", __func__, m0, n, raw0->resolution);
+#else
+    (void) n;
+#endif
 }
 
-inter_link_mat_t *inter_link_mat_from_file(const char *f, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, uint32_t radius, uint8_t mq)
+// memory of raw inter link counts
+// only sequence pairs with links in the BIN file are counted if it is indexed
+// otherwise pairs with most memory are counted, at most as many as the scaffold pairs that can have links
+long estimate_inter_link_raw_rss(const char *f, asm_dict_t *dict, uint32_t resolution, uint32_t radius, uint8_t mq)
 {
-    uint32_t i, j, k, m, n, i0, i1, b0, b1;
-    uint64_t p0, p1;
-    int64_t magic_number;
-    uint8_t buffer[BUFF_SIZE * 17];
-    double l0, l1, a, na[4], nc[4];
-    long pair_c, inter_c, radius_c, noise_c;
-    inter_link_mat_t *link_mat;
-    inter_link_t *link;
-    FILE *fp;
+    long bytes, max_n;
+    uint32_t i, m;
+    pair_grp_t *g;
 
-    fp = fopen(f, "r");
-    if (fp == NULL)
+    bytes = 0;
+    bytes += sizeof(inter_link_raw_t);
+    bytes += dict->n * sizeof(uint32_t);
+    g = inter_link_pair_grps(f, dict, resolution, radius, mq, &m, &max_n);
+    for (i = 0; i < m; ++i)
+        g[i].rss = inter_link_raw_pair_rss(g[i].b0, g[i].b1);
+    bytes += pair_grp_max_rss(g, m, max_n);
+    free(g);
+
+    return bytes;
+}
+
+// upper bound of the radius returned by calc_norms
+// it only depends on the number of cells in each band, i.e., sequence lengths and resolution
+uint32_t estimate_max_radius(asm_dict_t *dict, uint32_t resolution)
+{
+    uint32_t i, j, n, b, r0;
+    uint32_t *bs;
+
+    n = 0;
+    for (i = 0; i < dict->n; ++i)
+        if (dict->s[i].len >= resolution)
+            n = MAX(div_ceil(dict->s[i].len, resolution), n);
+    if (n <= 1)
         return 0;
+    n -= 1;
+    bs = (uint32_t *) calloc(n, sizeof(uint32_t));
+    for (i = 0; i < dict->n; ++i) {
+        if (dict->s[i].len >= resolution) {
+            b = div_ceil(dict->s[i].len, resolution) - 1;
+            for (j = 0; j < b; ++j)
+                bs[j] += b - j;
+        }
+    }
+
+    r0 = 0;
+    while (r0 < n && bs[r0] >= 30)
+        ++r0;
+    free(bs);
+
+    return MIN(r0, MAX_RADIUS);
+}
+
+typedef struct {
+    contig_scaf_t cs;
+    inter_link_raw_t *raw;
+} raw_keep_t;
 
-    m = fread(&magic_number, sizeof(int64_t), 1, fp);
-    if (!m || !is_valid_bin_header(magic_number)) {
-        fprintf(stderr, "[E::%s] not a valid BIN file\n", __func__);
+// keep a contig pair if the contigs are placed in the same scaffold or in a scaffold pair not lifted from an earlier round
+static int link_scan_keep_unlifted(uint32_t c0, uint32_t c1, void *data)
+{
+    uint32_t i, j, s0, s1;
+    raw_keep_t *keep;
+    contig_scaf_t *cs;
+
+    keep = (raw_keep_t *) data;
+    cs = &keep->cs;
+    if (cs->s[c0] == cs->s[c0 + 1] || cs->s[c1] == cs->s[c1 + 1])
+        return 1;
+    for (i = cs->s[c0]; i < cs->s[c0 + 1]; ++i) {
+        for (j = cs->s[c1]; j < cs->s[c1 + 1]; ++j) {
+            s0 = MIN(cs->a[i], cs->a[j]);
+            s1 = MAX(cs->a[i], cs->a[j]);
+            if (s0 == s1 || !inter_link_raw_lifted(keep->raw, s0, s1))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+// intra links, and raw inter links into inter_raw if given, collected in the same pass over the BIN file
+// if the cells of intra links do not fit in rss_limit (>= 0), only a sample of intra links is stored
+intra_link_mat_t *intra_link_mat_from_file_raw(const char *f, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, int use_gap_seq, uint8_t mq, inter_link_raw_t *inter_raw, long rss_limit, int n_threads)
+{
+    intra_link_mat_t *link_mat;
+    link_scan_t *scan;
+    raw_keep_t keep;
+    int ret;
+
+    link_mat = use_gap_seq? intra_link_mat_init(dict, re_cuts, resolution, rss_limit) : intra_link_mat_init_sdict(dict->sdict, re_cuts, resolution, rss_limit);
+
+    scan = link_scan_init(dict, mq, n_threads);
+    link_scan_add_intra_link_mat(scan, link_mat, resolution, use_gap_seq);
+    if (inter_raw)
+        link_scan_add_inter_link_raw(scan, inter_raw);
+    else
+        scan->intra_only = 1;
+    // records of the scaffold pairs lifted from an earlier round are not needed
+    if (inter_raw && inter_raw->k) {
+        contig_scaf_init(&keep.cs, dict);
+        keep.raw = inter_raw;
+        scan->keep = link_scan_keep_unlifted;
+        scan->keep_data = &keep;
+    }
+
+    ret = link_scan_file(scan, f);
+    if (scan->keep)
+        contig_scaf_destroy(&keep.cs);
+    if (ret) {
+        link_scan_destroy(scan);
+        intra_link_mat_destroy(link_mat);
         return 0;
     }
+#ifdef DEBUG
+    fprintf(stderr, "[DEBUG::%s] %ld read pairs processed, %ld intra links \n", __func__, scan->link_c, ((intra_link_acc_t *) scan->acc[0].data)->intra_c);
+    if (inter_raw)
+        fprintf(stderr, "[DEBUG::%s] %ld inter links, within radius %d: %ld\n", __func__, inter_raw->inter_c, inter_raw->r, inter_raw->radius_c);
+#endif
+    link_scan_destroy(scan);
 
-    n = dict->n;
-    link_mat = inter_link_mat_init(dict, re_cuts, resolution, radius);
-    pair_c = inter_c = radius_c = 0;
+    return link_mat;
+}
 
-    while (1) {
-        m = fread(buffer, sizeof(uint8_t), BUFF_SIZE * 17, fp);
+intra_link_mat_t *intra_link_mat_from_file(const char *f, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, int use_gap_seq, uint8_t mq)
+{
+    return intra_link_mat_from_file_raw(f, dict, re_cuts, resolution, use_gap_seq, mq, 0, -1, 1);
+}
 
-        for (i = 0; i < m; i += 17) {
-            ++pair_c;
+// count cells of the sequence pair (i, j) without links that are valid after normalisation by size
+// with norms, only cells in bands b < r with norms[b + 1] > 0 are counted and *n0 is set to the count of band 0
+static uint32_t inter_link_empty_cells(inter_link_mat_t *link_mat, uint32_t i, uint32_t j, double *norms, uint32_t *n0)
+{
+    uint32_t l, p, b1, r, c;
+    uint32_t b = 0;
+    double a;
 
-            if (*(uint8_t *) (buffer + i + 16) < mq)
+    b1 = link_mat->b[j];
+    p = link_mat->b[i] * b1;
+    r = MIN(link_mat->r, link_mat->b[i] + b1 - 1);
+    c = 0;
+    if (n0)
+        *n0 = 0;
+    for (l = 0; l < p; ++l) {
+        if (norms) {
+            b = l / b1 + l % b1;
+            if (b >= r || norms[b + 1] <= 0)
                 continue;
-            
-            sd_coordinate_conversion(dict, *(uint32_t *) (buffer + i),     *(uint32_t *) (buffer + i + 4),  &i0, &p0, 0);
-            sd_coordinate_conversion(dict, *(uint32_t *) (buffer + i + 8), *(uint32_t *) (buffer + i + 12), &i1, &p1, 0);
+        }
+        a = inter_link_cell_area(link_mat, i, j, l);
+        if (link_norm(0, a) < .0)
+            continue;
+        ++c;
+        if (norms && n0 && b == 0)
+            ++*n0;
+    }
 
-            if (i0 != i1) {
-                if (i0 > i1) {
-                    SWAP(uint32_t, i0, i1);
-                    SWAP(uint64_t, p0, p1);
-                }
+    return c;
+}
 
-                link = &link_mat->links[(long) (n * 2 - i0 - 3) * i0 / 2 + i1 - 1];
+// a bin of a sequence in counting valid cells of all sequence pairs with restriction site densities
+// a cell of bins (x, y) is valid if the products of v[0], v[1] and v[2] of x and y reach the thresholds
+// r[] are the ranks of a point among all points, or the lowest ranks of points a query is paired with
+typedef struct {
+    double v[3]; // relative size of the cell if the last bin or 1, density of bin 0 or 1, density of the bin
+    uint32_t r[3];
+    uint32_t q; // query or point
+} area_pt_t;
+
+// points before queries of the same rank
+#define area_pt_lt(a, b) ((a).r[0] > (b).r[0] || ((a).r[0] == (b).r[0] && (a).q < (b).q))
+KSORT_INIT(area_pt, area_pt_t, area_pt_lt)
+
+// pairs of points in the first half and queries in the second half of a[l, h) with all ranks reached
+// a[l, h) is sorted by r[1] in descending order on return
+static uint64_t area_pt_pairs(area_pt_t *a, area_pt_t *t, uint32_t l, uint32_t h, uint32_t *fw, uint32_t n)
+{
+    uint32_t i, j, k, m, x;
+    uint64_t c;
 
-                if (link->n == 0)
-                    continue;
+    if (h - l < 2)
+        return 0;
+    m = l + (h - l) / 2;
+    c = area_pt_pairs(a, t, l, m, fw, n) + area_pt_pairs(a, t, m, h, fw, n);
+
+    // points are added to a Fenwick tree of r[2] in the order of r[1]
+    i = l;
+    k = 0;
+    for (j = m; j < h; ++j) {
+        if (!a[j].q)
+            continue;
+        for (; i < m && a[i].r[1] >= a[j].r[1]; ++i) {
+            if (a[i].q)
+                continue;
+            ++k;
+            for (x = a[i].r[2] + 1; x <= n; x += x & -x)
+                ++fw[x];
+        }
+        c += k;
+        for (x = a[j].r[2]; x > 0; x -= x & -x)
+            c -= fw[x];
+    }
+    for (j = l; j < i; ++j)
+        if (!a[j].q)
+            for (x = a[j].r[2] + 1; x <= n; x += x & -x)
+                --fw[x];
 
-                l0 = dict->s[i0].len / 2.;
-                l1 = dict->s[i1].len / 2.;
-                
-                if (p0 >= l0 && p1 < l1) {
-                    // i0(-) -> i1(+)
-                    b0 = (uint32_t) ((2 * l0 - p0) / resolution);
-                    b1 = (uint32_t) ((double) p1 / resolution);
-                    if (b0 < link->b0 && b1 < link->b1 && b0 + b1 < radius) {
-                        k = (long) (MAX(1, b0) - 1) * link->b1 + b1;
-                        link->link[0][k] += signf(link->link[0][k]);
-                        ++radius_c;
-                    }
-                } else if(p0 >= l0 && p1 >= l1) {
-                    // i0(-) -> i1(-)
-                    b0 = (uint32_t) ((2 * l0 - p0) / resolution);
-                    b1 = (uint32_t) ((2 * l1 - p1) / resolution);
-                    if (b0 < link->b0 && b1 < link->b1 && b0 + b1 < radius) {
-                        k = (long) (MAX(1, b0) - 1) * link->b1 + b1;
-                        link->link[1][k] += signf(link->link[1][k]);
-                        ++radius_c;
-                    }
-                } else if(p0 < l0 && p1 < l1) {
-                    // i0(+) -> i1(+)
-                    b0 = (uint32_t) ((double) p0 / resolution);
-                    b1 = (uint32_t) ((double) p1 / resolution);
-                    if (b0 < link->b0 && b1 < link->b1 && b0 + b1 < radius) {
-                        k = (long) (MAX(1, b0) - 1) * link->b1 + b1;
-                        link->link[2][k] += signf(link->link[2][k]);
-                        ++radius_c;
-                    }
-                } else if(p0 < l0 && p1 >= l1) {
-                    // i0(+) -> i1(-)
-                    b0 = (uint32_t) ((double) p0 / resolution);
-                    b1 = (uint32_t) ((2 * l1 - p1) / resolution);
-                    if (b0 < link->b0 && b1 < link->b1 && b0 + b1 < radius) {
-                        k = (long) (MAX(1, b0) - 1) * link->b1 + b1;
-                        link->link[3][k] += signf(link->link[3][k]);
-                        ++radius_c;
-                    }
-                }
+    // merge by r[1]
+    for (i = l, j = m, k = l; i < m || j < h; )
+        t[k++] = j == h || (i < m && a[i].r[1] >= a[j].r[1])? a[i++] : a[j++];
+    memcpy(a + l, t + l, (h - l) * sizeof(area_pt_t));
 
-                ++inter_c;
+    return c;
+}
+
+// number of pairs of a query and a point of a[0, n) with products of v[k] not below th[k] for all k
+// products are monotonic in each value, so the points paired with a query have ranks not below those of the query
+static uint64_t area_pt_count(area_pt_t *a, uint32_t n, const double *th)
+{
+    uint32_t i, k, m, lo, hi, mid;
+    uint32_t *fw;
+    uint64_t c;
+    double **v;
+    area_pt_t *t;
+
+    v = (double **) malloc(3 * sizeof(double *));
+    for (k = 0; k < 3; ++k) {
+        v[k] = (double *) malloc(MAX(1, n) * sizeof(double));
+        for (i = m = 0; i < n; ++i)
+            if (!a[i].q)
+                v[k][m++] = a[i].v[k];
+        ks_introsort_double(m, v[k]);
+        for (i = 0; i < n; ++i) {
+            // the first rank of a point value, or of the values paired with a query value
+            for (lo = 0, hi = m; lo < hi; ) {
+                mid = lo + (hi - lo) / 2;
+                if (a[i].q? a[i].v[k] * v[k][mid] < th[k] : v[k][mid] < a[i].v[k])
+                    lo = mid + 1;
+                else
+                    hi = mid;
             }
+            a[i].r[k] = lo;
         }
+    }
+    ks_introsort_area_pt(n, a);
 
-        if (m < BUFF_SIZE * 17) {
-            if (ferror(fp))
-                return 0;
-            break;
+    t = (area_pt_t *) malloc(MAX(1, n) * sizeof(area_pt_t));
+    fw = (uint32_t *) calloc(m + 1, sizeof(uint32_t));
+    c = area_pt_pairs(a, t, 0, n, fw, m);
+
+    for (k = 0; k < 3; ++k)
+        free(v[k]);
+    free(v);
+    free(t);
+    free(fw);
+
+    return c;
+}
+
+static inline void area_pt_set(area_pt_t *p, inter_link_mat_t *link_mat, uint32_t i, uint32_t x, int norms, uint32_t q)
+{
+    p->v[0] = x == link_mat->b[i] - 1? link_mat->a[i] : 1.;
+    p->v[1] = norms? link_mat->re_dens[i][0] : 1.;
+    p->v[2] = link_mat->re_dens[i][x];
+    p->q = q;
+}
+
+// total valid cells of all sequence pairs with restriction site densities
+// a cell is valid if the product of the relative sizes is at least .5 and the product of the densities
+// at least MIN_RE_DENS, and with norms, if the cell in band 0 is valid and the band has a norm.
+// Cells are counted between all bins as pairs of queries and points, a bin of a sequence
+// being both a query and a point, by ranks in O(n log^2(n)); the pairs within sequences are enumerated
+// and subtracted. Without norms, all bins are counted at once, with norms, points by bin.
+static uint64_t inter_link_area_re(inter_link_mat_t *link_mat, double *norms)
+{
+    uint32_t i, x, y, n, r;
+    uint64_t c, c1, m;
+    double th[3];
+    area_pt_t *a, p, q;
+
+    th[0] = .5;
+    th[1] = th[2] = MIN_RE_DENS;
+    r = link_mat->r;
+    if (r == 0 || (norms && norms[1] <= 0))
+        return 0;
+
+    m = 0;
+    for (i = 0; i < link_mat->s; ++i)
+        m += link_mat->b[i];
+    a = (area_pt_t *) malloc(MAX(1, m * 2) * sizeof(area_pt_t));
+    c = 0;
+    for (y = 0; y < (norms? r : 1); ++y) {
+        // points of bin y, or of all bins
+        n = 0;
+        for (i = 0; i < link_mat->s; ++i) {
+            for (x = norms? y : 0; x < link_mat->b[i]; ++x) {
+                area_pt_set(&a[n++], link_mat, i, x, norms != 0, 0);
+                if (norms)
+                    break;
+            }
+        }
+        // queries of bins in bands with norms
+        for (i = 0; i < link_mat->s; ++i)
+            for (x = 0; x < link_mat->b[i]; ++x)
+                if (!norms || (x + y < r && norms[x + y + 1] > 0))
+                    area_pt_set(&a[n++], link_mat, i, x, norms != 0, 1);
+        c += area_pt_count(a, n, th);
+    }
+    free(a);
+
+    // pairs within sequences
+    c1 = 0;
+    for (i = 0; i < link_mat->s; ++i) {
+        for (x = 0; x < link_mat->b[i]; ++x) {
+            area_pt_set(&q, link_mat, i, x, norms != 0, 1);
+            for (y = 0; y < link_mat->b[i]; ++y) {
+                if (norms && (x + y >= r || norms[x + y + 1] <= 0))
+                    continue;
+                area_pt_set(&p, link_mat, i, y, norms != 0, 0);
+                if (q.v[0] * p.v[0] >= th[0] && q.v[1] * p.v[1] >= th[1] && q.v[2] * p.v[2] >= th[2])
+                    ++c1;
+            }
         }
     }
 
-#ifdef DEBUG
-    fprintf(stderr, "[DEBUG::%s] %ld read pairs processed, %ld inter links \n", __func__, pair_c, inter_c);
-    fprintf(stderr, "[DEBUG::%s] within radius %d: %ld\n", __func__, radius, radius_c);
-#endif
-    fclose(fp);
+    // each pair of sequences is counted twice
+    return (c - c1) / 2;
+}
 
-    // normalise links by cell size
-    for (i = 0; i < link_mat->n; ++i) {
-        link = &link_mat->links[i];
-        for (j = 0; j < link->n; ++j)
-            for (k = 0; k < 4; ++k)
-                normalise_by_size(&link->link[k][j]);
+// total valid cells of all sequence pairs without restriction site densities
+// a cell of the sequence pair (i, j) with b0 x b1 bins is valid if it is an inner cell, or in the last
+// row with a[i] >= .5, or in the last column with a[j] >= .5, or the corner cell with a[i] * a[j] >= .5.
+// Sequences are grouped by bin number so that the cells of all pairs are counted in O(r^2) groups.
+static uint64_t inter_link_area(inter_link_mat_t *link_mat, double *norms)
+{
+    uint32_t i, k, r, b0, b1;
+    uint64_t *g, *h, *w, *W, *WW, I, Rw, Cw, Kw, N, Nx, Ny, Nxy, Nz, a, a1;
+    double *v, *v0, *v1;
+
+    r = link_mat->r;
+    if (r == 0)
+        return 0;
+
+    // group sequences by bin number, relative sizes of the last bin are sorted in each group
+    g = (uint64_t *) calloc(r + 2, sizeof(uint64_t));
+    h = (uint64_t *) calloc(r + 1, sizeof(uint64_t));
+    for (i = 0; i < link_mat->s; ++i) {
+        if (link_mat->b[i] == 0)
+            continue;
+        ++g[link_mat->b[i] + 1];
+        if (link_mat->a[i] >= .5)
+            ++h[link_mat->b[i]];
+    }
+    for (k = 1; k <= r + 1; ++k)
+        g[k] += g[k - 1];
+    // g[b] is the start of group b, g[b + 1] is the end of group b after filling
+    v = (double *) malloc(MAX(1, g[r + 1]) * sizeof(double));
+    for (i = 0; i < link_mat->s; ++i)
+        if (link_mat->b[i] > 0)
+            v[g[link_mat->b[i]]++] = link_mat->a[i];
+    for (k = r + 1; k > 0; --k)
+        g[k] = g[k - 1];
+    g[0] = 0;
+    for (k = 1; k <= r; ++k)
+        ks_introsort_double(g[k + 1] - g[k], v + g[k]);
+
+    // w[b] is one if cells in band b are counted, W and WW are prefix sums of w and W
+    w = (uint64_t *) calloc(r * 2, sizeof(uint64_t));
+    W = (uint64_t *) calloc(r * 2 + 1, sizeof(uint64_t));
+    WW = (uint64_t *) calloc(r * 2 + 2, sizeof(uint64_t));
+    for (k = 0; k < r * 2; ++k)
+        w[k] = norms? k < r && norms[k + 1] > 0 : 1;
+    for (k = 0; k < r * 2; ++k)
+        W[k + 1] = W[k] + w[k];
+    for (k = 0; k <= r * 2; ++k)
+        WW[k + 1] = WW[k] + W[k];
+
+    a = 0;
+    for (b0 = 1; b0 <= r; ++b0) {
+        if (g[b0 + 1] == g[b0])
+            continue;
+        for (b1 = b0; b1 <= r; ++b1) {
+            if (g[b1 + 1] == g[b1])
+                continue;
+            // inner cells, last row, last column and the corner cell
+            I = WW[b0 + b1 - 2] - WW[b1 - 1] - WW[b0 - 1];
+            Rw = W[b0 + b1 - 2] - W[b0 - 1];
+            Cw = W[b0 + b1 - 2] - W[b1 - 1];
+            Kw = w[b0 + b1 - 2];
+            // number of pairs with a[i] * a[j] >= .5
+            v0 = v + g[b0];
+            v1 = v + g[b1];
+            Nz = 0;
+            k = g[b1 + 1] - g[b1];
+            for (i = 0; i < g[b0 + 1] - g[b0]; ++i) {
+                while (k > 0 && v0[i] * v1[k - 1] >= .5)
+                    --k;
+                Nz += g[b1 + 1] - g[b1] - k;
+            }
+            if (b0 == b1) {
+                N = (g[b0 + 1] - g[b0]) * (g[b0 + 1] - g[b0] - 1) / 2;
+                for (i = 0; i < g[b0 + 1] - g[b0]; ++i)
+                    if (v0[i] * v0[i] >= .5)
+                        --Nz;
+                Nz /= 2;
+                // last row and column have the same cells
+                a1 = N * I + h[b0] * (g[b0 + 1] - g[b0] - 1) * Rw + Nz * Kw;
+                if (norms && b0 == 1)
+                    a1 = Nz;
+            } else {
+                N = (g[b0 + 1] - g[b0]) * (g[b1 + 1] - g[b1]);
+                Nx = h[b0] * (g[b1 + 1] - g[b1]);
+                Ny = (g[b0 + 1] - g[b0]) * h[b1];
+                Nxy = h[b0] * h[b1];
+                // with norms, the cell in band 0 is in the last row if b0 == 1
+                if (norms && b0 == 1)
+                    a1 = Nx * I + Nx * Rw + Nxy * Cw + Nz * Kw;
+                else
+                    a1 = N * I + Nx * Rw + Ny * Cw + Nz * Kw;
+            }
+            a += norms? a1 * w[0] : a1;
+        }
+    }
+
+    free(g);
+    free(h);
+    free(v);
+    free(w);
+    free(W);
+    free(WW);
+
+    return a;
+}
+
+// total valid cells of sequence pairs without links
+// with norms, pairs without valid cells in band 0 are not counted as in inter_link_norms
+// the cells of all pairs are counted, and the cells of stored pairs are then subtracted
+static double inter_link_empty_area(inter_link_mat_t *link_mat, double *norms)
+{
+    uint32_t k, c, n0;
+    uint64_t a;
+
+    a = link_mat->re_dens? inter_link_area_re(link_mat, norms) : inter_link_area(link_mat, norms);
+    // pairs with links are not counted
+    for (k = 0; k < link_mat->n; ++k) {
+        c = inter_link_empty_cells(link_mat, link_mat->links[k].c0, link_mat->links[k].c1, norms, &n0);
+        if (!norms || n0 > 0)
+            a -= c;
     }
 
+    return (double) a;
+}
+
+// links are normalised by cell size when they are read
+static void inter_link_mat_noise(inter_link_mat_t *link_mat)
+{
+    uint32_t i, j, k;
+    double a, l, na[4], nc[4];
+    long noise_c;
+    inter_link_t *link;
+
     // calculate noise level
     noise_c = a = 0;
     for (i = 0; i < link_mat->n; ++i) {
@@ -715,8 +2268,9 @@ inter_link_mat_t *inter_link_mat_from_file(const char *f, asm_dict_t *dict, re_c
         link = &link_mat->links[i];
         for (j = 0; j < link->n; ++j) {
             for (k = 0; k < 4; ++k) {
-                if (link->link[k][j] >= 0) {
-                    nc[k] += link->link[k][j];
+                l = inter_link_cell(link_mat, link, k, j);
+                if (l >= 0) {
+                    nc[k] += l;
                     na[k] += 1.;
                 }
             }
@@ -729,10 +2283,79 @@ inter_link_mat_t *inter_link_mat_from_file(const char *f, asm_dict_t *dict, re_c
         noise_c += nc[j];
         a += na[j];
     }
+    // all cells of pairs without links are noise cells
+    a += inter_link_empty_area(link_mat, 0);
     link_mat->noise = a > 0? noise_c / a : 0;
 #ifdef DEBUG_NOISE
     fprintf(stderr, "[DEBUG_NOISE::%s] noise links: %ld; area: %.12f; noise estimation: %.12f\n", __func__, noise_c, a, link_mat->noise);
 #endif
+}
+
+inter_link_mat_t *inter_link_mat_from_file(const char *f, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, uint32_t radius, uint8_t mq, int n_threads)
+{
+    inter_link_mat_t *link_mat;
+    link_scan_t *scan;
+
+    link_mat = inter_link_mat_init(dict, re_cuts, resolution, radius);
+
+    scan = link_scan_init(dict, mq, n_threads);
+    link_scan_add_inter_link_mat(scan, link_mat, resolution);
+
+    if (link_scan_file(scan, f)) {
+        link_scan_destroy(scan);
+        inter_link_mat_destroy(link_mat);
+        return 0;
+    }
+#ifdef DEBUG
+    fprintf(stderr, "[DEBUG::%s] %ld read pairs processed, %ld inter links \n", __func__, scan->pair_c, ((inter_link_acc_t *) scan->acc[0].data)->inter_c);
+    fprintf(stderr, "[DEBUG::%s] within radius %d: %ld\n", __func__, radius, ((inter_link_acc_t *) scan->acc[0].data)->radius_c);
+#endif
+    link_scan_destroy(scan);
+
+    inter_link_mat_sort(link_mat);
+    inter_link_mat_noise(link_mat);
+
+    return link_mat;
+}
+
+// rebin raw link counts to a radius no larger than the one used for collection
+inter_link_mat_t *inter_link_mat_from_raw(inter_link_raw_t *raw, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t radius)
+{
+    uint32_t i, k, t, b0, b1, c0, c1, c, i0, i1;
+    uint32_t *cnt;
+    inter_link_mat_t *link_mat;
+    inter_link_t *link;
+
+    assert(radius <= raw->r);
+    link_mat = inter_link_mat_init(dict, re_cuts, raw->resolution, radius);
+
+    for (i = 0; i < raw->np; ++i) {
+        i0 = raw->pair[i] >> 32;
+        i1 = (uint32_t) raw->pair[i];
+        cnt = raw->cnt[i];
+        c0 = raw->b[i0];
+        c1 = raw->b[i1];
+        link = 0;
+        for (t = 0; t < 4; ++t) {
+            for (b0 = 0; b0 < MIN(c0, link_mat->b[i0]); ++b0) {
+                for (b1 = 0; b1 < MIN(c1, link_mat->b[i1]) && b0 + b1 < radius; ++b1) {
+                    c = cnt[((long) t * c0 + b0) * c1 + b1];
+                    if (c == 0)
+                        continue;
+                    if (link == 0) {
+                        // links may be reallocated by inter_link_put
+                        k = inter_link_put(link_mat, i0, i1);
+                        link = &link_mat->links[k];
+                    }
+                    k = (long) (MAX(1, b0) - 1) * link->b1 + b1;
+                    link->link[t][k] += c;
+                }
+            }
+        }
+    }
+
+    inter_link_mat_sort(link_mat);
+    inter_link_mat_noise(link_mat);
 
     return link_mat;
 }
@@ -749,15 +2372,11 @@ void norm_destroy(norm_t *norm)
     free(norm);
 }
 
-int dcmp (const void *a, const void *b) {
-    double cmp = *(double *) a - *(double *) b;
-    return cmp > 0? 1 : ( cmp < 0? -1 : 0);
-}
-
 norm_t *calc_norms(intra_link_mat_t *link_mat)
 {
-    uint32_t i, j, n, b, r, r0, t;
+    uint32_t i, j, k, n, m, b, r, r0, t;
     uint32_t *bs;
+    long l;
     double intra_c, tmp_c;
     double *norms, *link, *linkc;
     norm_t *norm;
@@ -782,7 +2401,7 @@ norm_t *calc_norms(intra_link_mat_t *link_mat)
     }
 
     r0 = 0;
-    while (bs[r0] >= 30) 
+    while (r0 < n && bs[r0] >= 30)
         ++r0;
     if (r0 < 10) {
         fprintf(stderr, "[E::%s] no enough bands (%d) for norm calculation, try a higher resolution\n", __func__, r0);
@@ -792,29 +2411,40 @@ norm_t *calc_norms(intra_link_mat_t *link_mat)
 
     // caluclate links in each band and radius
     // calculate norms - using median or mean?
-    norms = (double *) malloc(n * sizeof(double));
-    linkc = (double *) malloc(n * sizeof(double));
+    // only the bands stored are used
+    // with a sample of intra links stored, medians are taken from the sample
+    // and links of the sequences not sampled are added to the link count of each band
+    m = MIN(n, link_mat->r);
+    norms = (double *) malloc(m * sizeof(double));
+    linkc = (double *) malloc(m * sizeof(double));
     intra_c = .0;
-    for (i = 0; i < n; ++i) {
+    for (i = 0; i < m; ++i) {
         link = (double *) malloc(bs[i] * sizeof(double));
         t = 0;
         for (j = 0; j < link_mat->n; ++j) {
             b = link_mat->links[j].n;
-            if (b > i + 1) {
-                memcpy(link + t, link_mat->links[j].link + (long) (b * 2 - i - 1) * i / 2 + i, (b - 1 - i) * sizeof(double));
-                t += b - 1 - i;
+            if (b > i + 1 && link_mat->links[j].r) {
+                l = (long) (b * 2 - i - 1) * i / 2;
+                for (k = i; k < b - 1; ++k)
+                    link[t++] = intra_link_cell(&link_mat->links[j], l + k, k - i, k);
             }
         }
 
         tmp_c = .0;
-        for (j = 0; j < bs[i]; ++j)
+        for (j = 0; j < t; ++j)
             tmp_c += link[j];
+        if (link_mat->band_c)
+            tmp_c += ldexp((double) link_mat->band_c[i], -INTRA_FAR_SHIFT) - DBL_MAX * link_mat->band_x[i];
         linkc[i] = tmp_c;
         intra_c += tmp_c;
         
 #ifdef USE_MEDIAN_NORM
-        qsort(link, bs[i], sizeof(double), dcmp);
-        norms[i] = bs[i] & 1? link[bs[i] / 2] : (link[bs[i] / 2] + link[bs[i] / 2 - 1]) / 2;
+        if (t > 0) {
+            norms[i] = median_double(link, t);
+        } else {
+            // no cells sampled in the band
+            norms[i] = MAX(linkc[i], 1.) / bs[i];
+        }
 #else
         norms[i] = MAX(linkc[i], 1.) / bs[i];
 #endif
@@ -822,15 +2452,19 @@ norm_t *calc_norms(intra_link_mat_t *link_mat)
         free(link);
     }
 
+    // links in the bands not stored
+    // cells too small to normalise count -DBL_MAX as in the bands stored
+    intra_c += ldexp((double) link_mat->far_c, -INTRA_FAR_SHIFT) - DBL_MAX * link_mat->far_x;
     intra_c -= linkc[0];
     tmp_c = .0;
-    for (r = 1; r < n; ++r) {
+    for (r = 1; r < m; ++r) {
         tmp_c += linkc[r];
         if (tmp_c / intra_c >= .99)
             break;
     }
     
-    r = MIN(MIN(r, r0), MAX_RADIUS);
+    // r reaches m if the links never add up to 99%
+    r = MIN(MIN(MIN(r, r0), m - 1), MAX_RADIUS);
 
 #ifdef USE_MEDIAN_NORM
     // adjust radius by norms
@@ -838,7 +2472,7 @@ norm_t *calc_norms(intra_link_mat_t *link_mat)
     // find the first position with 10 consective zeros
     int zeros = 0;
     int p = -1;
-    for (i = 0; i < n; ++i) {
+    for (i = 0; i < m; ++i) {
         if (norms[i] < 1) {
             ++zeros;
             if (zeros >= 10) {
@@ -858,7 +2492,7 @@ norm_t *calc_norms(intra_link_mat_t *link_mat)
 #endif
 
     norm = (norm_t *) malloc(sizeof(norm_t));
-    norm->n = n;
+    norm->n = m;
     norm->r = r;
     norm->bs = bs;
     //norm->link = link;
@@ -968,7 +2602,7 @@ int estimate_noise(inter_link_mat_t *link_mat)
         n = inter_link->n;
         for (j = 0; j < n; ++j) {
             for (k = 0; k < 4; ++k) {
-                l = inter_link->link[k][j];
+                l = inter_link_cell(link_mat, inter_link, k, j);
                 if (l < .0) 
                     continue;
                 ++hist[MIN(bin - 1, (int) l)];
@@ -1004,14 +2638,85 @@ int estimate_noise(inter_link_mat_t *link_mat)
     return n;
 }
 
-void inter_link_norms(inter_link_mat_t *link_mat, norm_t *norm, int use_estimated_noise, double *la)
+typedef struct {
+    inter_link_mat_t *link_mat;
+    double *norms, noise;
+    double **fr; // per thread band sums of normalised link counts [4 x r]
+    uint32_t **fn; // per thread band cell counts [r]
+    double *t; // maximum norm of each sequence pair, -1 if not counted
+} inter_link_norms_step_t;
+
+static void inter_link_norms_worker(void *data, long i, int tid)
 {
-    uint32_t i, j, k, b, b1, r, n, n0;
-    uint32_t *fn;
+    inter_link_norms_step_t *step = (inter_link_norms_step_t *) data;
+    inter_link_mat_t *link_mat = step->link_mat;
+    inter_link_t *inter_link = &link_mat->links[i];
+    double *norms = step->norms, noise = step->noise;
+    double *fr, a, l, t;
+    uint32_t *fn, j, k, b, x, y, b0, b1, r, n0;
     int8_t bl;
-    double l, *norms, *fr, noise;
-    double c, c0, t;
-    inter_link_t *inter_link;
+
+    step->t[i] = -1.;
+    if (inter_link->n == 0)
+        return;
+    r = inter_link->r;
+    b0 = inter_link->b0;
+    b1 = inter_link->b1;
+    fr = step->fr[tid];
+    fn = step->fn[tid];
+    memset(fr, 0, 4 * r * sizeof(double));
+    memset(fn, 0, r * sizeof(uint32_t));
+
+    // cells row by row, j = x * b1 + y is in band x + y
+    for (x = 0, j = 0; x < b0 && x < r; ++x, j += b1) {
+        for (y = 0; y < b1 && (b = x + y) < r; ++y) {
+            if (norms[b + 1] > 0) {
+                a = inter_link_cell_area_xy(link_mat, inter_link->c0, inter_link->c1, x, y);
+                bl = 0;
+                for (k = 0; k < 4; ++k) {
+                    l = link_norm(inter_link->link[k][j + y], a);
+                    if(l < .0)
+                        break;
+                    l = MAX(.0, l - noise);
+                    fr[k * r + b] += MIN(1., l / norms[b + 1]);
+                    bl = 1;
+                }
+                if (bl)
+                    ++fn[b];
+            }
+        }
+    }
+    if (fn[0] == 0)
+        return;
+
+    // cumsum
+    for (k = 0; k < 4; ++k)
+        inter_link->norms[k] = fr[k * r];
+    for (b = 1; b < r; ++b) {
+        for (k = 0; k < 4; ++k) {
+            inter_link->norms[k] += fr[k * r + b] * fr[k * r + b - 1] / fn[b - 1];
+            fr[k * r + b] += fr[k * r + b - 1];
+        }
+        fn[b] += fn[b - 1];
+    }
+
+    n0 = fn[r - 1];
+    t = 0;
+    for (k = 0; k < 4; ++k) {
+        if (inter_link->norms[k] > t)
+            t = inter_link->norms[k];
+        inter_link->norms[k] /= n0;
+    }
+    inter_link->n0 = n0;
+    step->t[i] = t;
+}
+
+void inter_link_norms(inter_link_mat_t *link_mat, norm_t *norm, int use_estimated_noise, double *la, int n_threads)
+{
+    uint32_t i, r;
+    double *norms, noise;
+    double c, c0;
+    inter_link_norms_step_t step;
 
     noise = .0;
     if (use_estimated_noise) {
@@ -1042,7 +2747,7 @@ void inter_link_norms(inter_link_mat_t *link_mat, norm_t *norm, int use_estimate
                 if (norms[b + 1] > 0) {
                     bl = 0;
                     for (k = 0; k < 4; ++k) {
-                        l = inter_link->link[k][j];
+                        l = inter_link_cell(link_mat, inter_link, k, j);
                         if (l < .0)
                             break;
                         if (l >= norms[b + 1] + noise) {
@@ -1063,106 +2768,87 @@ void inter_link_norms(inter_link_mat_t *link_mat, norm_t *norm, int use_estimate
     }
     **/
     
+    step.link_mat = link_mat;
+    step.norms = norms;
+    step.noise = noise;
+    step.fr = (double **) malloc(n_threads * sizeof(double *));
+    step.fn = (uint32_t **) malloc(n_threads * sizeof(uint32_t *));
+    for (i = 0; i < (uint32_t) n_threads; ++i) {
+        step.fr[i] = (double *) malloc(MAX(1, 4 * r) * sizeof(double));
+        step.fn[i] = (uint32_t *) malloc(MAX(1, r) * sizeof(uint32_t));
+    }
+    step.t = (double *) malloc(MAX(1, link_mat->n) * sizeof(double));
+    kt_for(n_threads, inter_link_norms_worker, &step, link_mat->n);
+
+    // summed in the order of sequence pairs for a result independent of threads
     c = c0 = 0;
     for (i = 0; i < link_mat->n; ++i) {
-        inter_link = &link_mat->links[i];
-        n = inter_link->n;
-        if (n == 0)
+        if (step.t[i] < .0)
             continue;
-        r = inter_link->r;
-        b1 = inter_link->b1;
-
-        fr = (double *) calloc(4 * r, sizeof(double));
-        fn = (uint32_t *) calloc(r, sizeof(uint32_t));
-
-        for (j = 0; j < n; ++j) {
-            b = j / b1 + j % b1;
-            if (b < r) {
-                if (norms[b + 1] > 0) {
-                    bl = 0;
-                    for (k = 0; k < 4; ++k) {
-                        l = inter_link->link[k][j];
-                        if(l < .0)
-                            break;
-                        l = MAX(.0, l - noise);
-                        fr[k * r + b] += MIN(1., l / norms[b + 1]);
-                        bl = 1;
-                    }
-                    if (bl)
-                        ++fn[b];
-                }
-            }
-        }
-        if (fn[0] == 0)
-            goto loop_i_end;
-
-        // cumsum
-        for (k = 0; k < 4; ++k)
-            inter_link->norms[k] = fr[k * r];
-        for (b = 1; b < r; ++b) {
-            for (k = 0; k < 4; ++k) {
-                inter_link->norms[k] += fr[k * r + b] * fr[k * r + b - 1] / fn[b - 1];
-                fr[k * r + b] += fr[k * r + b - 1];
-            }
-            fn[b] += fn[b - 1];
-        }
-
-        n0 = fn[r - 1];
-        t = 0;
-        for (k = 0; k < 4; ++k) {
-            if (inter_link->norms[k] > t)
-                t = inter_link->norms[k];
-            inter_link->norms[k] /= n0;
-        }
-        inter_link->n0 = n0;
-        c += n0;
-        c0 += t;
-loop_i_end:
-        free(fr);
-        free(fn);
+        c += link_mat->links[i].n0;
+        c0 += step.t[i];
     }
+    // pairs without links add to the number of cells only
+    c += inter_link_empty_area(link_mat, norms);
     
     *la = c0 / c;
     fprintf(stderr, "[I::%s] average link count: %.3f %.3f %.3f\n", __func__, c0, c, *la);
     
+    for (i = 0; i < (uint32_t) n_threads; ++i) {
+        free(step.fr[i]);
+        free(step.fn[i]);
+    }
+    free(step.fr);
+    free(step.fn);
+    free(step.t);
     free(norms);
 }
 
-int8_t *calc_link_directs_from_file(const char *f, asm_dict_t *dict, uint8_t mq)
+link_directs_t *calc_link_directs_from_file(const char *f, asm_dict_t *dict, uint8_t mq)
 {
-    uint32_t i, j, k, m, n, na, i0, i1, b0, b1, b, ma, sma, n_ma;
-    uint64_t p0, p1;
-    int64_t magic_number;
-    uint8_t buffer[BUFF_SIZE * 17];
-    uint32_t *link, l;
-    int8_t *directs;
+    uint32_t i, j, k, n, i0, i1, b0, b1, b, ma, sma, n_ma, *si;
+    uint64_t p0, p1, *sp;
+    long m;
+    int absent;
+    khint_t x;
+    uint8_t *buffer;
+    uint32_t l;
+    link_directs_t *directs;
     long pair_c, inter_c;
-    FILE *fp;
-
-    fp = fopen(f, "r");
-    if (fp == NULL)
-        return 0;
-    
-    m = fread(&magic_number, sizeof(int64_t), 1, fp);
-    if (!m || !is_valid_bin_header(magic_number)) {
-        fprintf(stderr, "[E::%s] not a valid BIN file\n", __func__);
+    bin_reader_t *reader;
+    khash_t(inter_link) *h;
+    kvec_t(uint32_t) link; // link counts of each pair [n x 4]
+    kvec_t(uint64_t) pair;
+    contig_scaf_t cs;
+    bin_cols_t cols;
+
+    reader = bin_reader_open(f);
+    if (reader == NULL)
         return 0;
+    // links within a scaffold are not counted
+    if (reader->idx) {
+        contig_scaf_init(&cs, dict);
+        bin_reader_select(reader, link_scan_keep_inter, &cs, mq);
+        contig_scaf_destroy(&cs);
     }
 
-    n = dict->n;
-    na = (long) n * (n - 1) / 2;
-    link = (uint32_t *) calloc(na << 2, sizeof(uint32_t));
+    h = kh_init(inter_link);
+    kv_init(link);
+    kv_init(pair);
     pair_c = inter_c = 0;
 
-    while (1) {
-        m = fread(buffer, sizeof(uint8_t), BUFF_SIZE * 17, fp);
-        
-        for (i = 0; i < m; i += 17) {
-            if (*(uint8_t *) (buffer + i + 16) < mq)
-                continue;
-
-            sd_coordinate_conversion(dict, *(uint32_t *) (buffer + i),     *(uint32_t *) (buffer + i + 4),  &i0, &p0, 0);
-            sd_coordinate_conversion(dict, *(uint32_t *) (buffer + i + 8), *(uint32_t *) (buffer + i + 12), &i1, &p1, 0);
+    bin_cols_init(&cols, BUFF_SIZE);
+    si = (uint32_t *) malloc(BUFF_SIZE * 2 * sizeof(uint32_t));
+    sp = (uint64_t *) malloc(BUFF_SIZE * 2 * sizeof(uint64_t));
+    while ((m = bin_reader_read(reader, &buffer, BUFF_SIZE)) > 0) {
+        n = bin_cols_decode(&cols, buffer, m, mq);
+        sd_coordinate_conversion_batch(dict, n, cols.c0, cols.p0, si, sp, 0);
+        sd_coordinate_conversion_batch(dict, n, cols.c1, cols.p1, si + BUFF_SIZE, sp + BUFF_SIZE, 0);
+        for (i = 0; i < n; ++i) {
+            i0 = si[i];
+            p0 = sp[i];
+            i1 = si[BUFF_SIZE + i];
+            p1 = sp[BUFF_SIZE + i];
 
             if (i0 != i1) {
                 if (i0 > i1) {
@@ -1172,30 +2858,47 @@ int8_t *calc_link_directs_from_file(const char *f, asm_dict_t *dict, uint8_t mq)
                 b0 = !((double) p0 / dict->s[i0].len > .5);
                 b1 = !((double) p1 / dict->s[i1].len > .5);
                 b = (b0 << 1) | (!b1);
-                ++link[b * na + (long) (n * 2 - i0 - 1) * i0 / 2 + i1 - i0 - 1];
+                x = kh_put(inter_link, h, (uint64_t) i0 << 32 | i1, &absent);
+                if (absent) {
+                    kh_val(h, x) = pair.n;
+                    kv_push(uint64_t, pair, (uint64_t) i0 << 32 | i1);
+                    for (k = 0; k < 4; ++k)
+                        kv_push(uint32_t, link, 0);
+                }
+                ++link.a[(uint64_t) kh_val(h, x) << 2 | b];
                 
                 ++inter_c;
             }
 
             ++pair_c;
         }
-        if (m < BUFF_SIZE * 17) {
-            if (ferror(fp))
-                return 0;
-            break;
-        }
+    }
+    bin_cols_destroy(&cols);
+    free(si);
+    free(sp);
+    bin_reader_close(reader);
+    if (m < 0) {
+        kh_destroy(inter_link, h);
+        kv_destroy(link);
+        kv_destroy(pair);
+        return 0;
     }
 
 #ifdef DEBUG
     fprintf(stderr, "[DEBUG::%s] %ld read pairs processed, %ld inter links \n", __func__, pair_c, inter_c);
 #endif
-    fclose(fp);
     
-    directs = (int8_t *) malloc(na * sizeof(int8_t));
-    for (i = 0; i < na; ++i) {
+    directs = (link_directs_t *) malloc(sizeof(link_directs_t));
+    directs->n = pair.n;
+    directs->a = pair.a;
+    directs->d = (int8_t *) malloc(MAX(1, pair.n) * sizeof(int8_t));
+    // pairs are sorted for lookup by binary search
+    radix_sort_u64(directs->a, directs->a + directs->n);
+    for (i = 0; i < directs->n; ++i) {
+        x = kh_get(inter_link, h, directs->a[i]);
         ma = sma = n_ma = j = 0;
         for (k = 0; k < 4; ++k) {
-            l = link[k * na + i];
+            l = link.a[(uint64_t) kh_val(h, x) << 2 | k];
             if (l > ma) {
                 sma = ma;
                 ma = l;
@@ -1207,90 +2910,173 @@ int8_t *calc_link_directs_from_file(const char *f, asm_dict_t *dict, uint8_t mq)
                 sma = l;
             }
         }
-        
-        directs[i] = n_ma == 1 && ma * .9 > sma? j : -1;
+        directs->d[i] = n_ma == 1 && ma * .9 > sma? j : -1;
     }
-    free(link);
+    kh_destroy(inter_link, h);
+    kv_destroy(link);
 #ifdef DEBUG_ORIEN
-    int8_t d;
-    for (i0 = 0; i0 < n; ++i0) {
-        for (i1 = i0 + 1; i1 < n; ++i1) {
-            d = directs[(long) (n * 2 - i0 - 1) * i0 / 2 + i1 - i0 - 1];
-            if (d >=0)
-                fprintf(stderr, "[DEBUG_ORIEN::%s] #Oriens: %s %s %hhi \n", __func__, dict->s[i0].name, dict->s[i1].name, d);
-        }
-    }
+    for (i = 0; i < directs->n; ++i)
+        if (directs->d[i] >= 0)
+            fprintf(stderr, "[DEBUG_ORIEN::%s] #Oriens: %s %s %hhi \n", __func__, dict->s[directs->a[i] >> 32].name, dict->s[(uint32_t) directs->a[i]].name, directs->d[i]);
 #endif
     return directs;
 }
 
-void calc_link_directs(inter_link_mat_t *link_mat, double min_norm, asm_dict_t *dict, int8_t *directs)
+// get the link direction of the sequence pair (i, j) from calc_link_directs_from_file
+// return -1 if undetermined or there is no link between them
+int8_t get_link_direct(link_directs_t *directs, uint32_t i, uint32_t j)
+{
+    uint64_t key, lo, hi, mid;
+
+    if (i > j)
+        SWAP(uint32_t, i, j);
+    key = (uint64_t) i << 32 | j;
+    lo = 0;
+    hi = directs->n;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (directs->a[mid] < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < directs->n && directs->a[lo] == key? directs->d[lo] : -1;
+}
+
+void link_directs_destroy(link_directs_t *directs)
+{
+    if (!directs)
+        return;
+    free(directs->a);
+    free(directs->d);
+    free(directs);
+}
+
+typedef struct {
+    inter_link_mat_t *link_mat;
+    double min_norm;
+    asm_dict_t *dict;
+} link_directs_step_t;
+
+static void calc_link_directs_worker(void *data, long i, int tid)
 {
-    uint32_t i, j, k, n, b, b0, b1, r, n_ma;
+    link_directs_step_t *step = (link_directs_step_t *) data;
+    inter_link_mat_t *link_mat = step->link_mat;
+    inter_link_t *inter_link = &link_mat->links[i];
+    uint32_t j, k, b, x, y, b0, b1, r, n_ma;
     int8_t t;
-    inter_link_t *inter_link;
     double area[4]; // area under the cumsum of linkb
-    double ma, sma;
-    uint32_t max_b = UINT32_MAX;
-
-    r = link_mat->r;
-    for (i = 0; i < link_mat->n; ++i) {
-        inter_link = &link_mat->links[i];
-        n = inter_link->n;
-        if (n == 0)
-            continue;
-        b0 = inter_link->b0;
-        b1 = inter_link->b1;
-        for (j = 0; j < n; ++j) {
-            b = j / b1 + j % b1;
-            if (b <= b0 && b <= b1 && b <= max_b && b < r)
-                for (k = 0; k < 4; ++k)
-                    if (inter_link->link[k][j] > .0)
-                        inter_link->linkb[k][b] += inter_link->link[k][j];
-        }
-    }
+    double a, l, ma, sma;
+#ifdef DEBUG_ORIEN
+    asm_dict_t *dict = step->dict;
+#endif
 
-    for (i = 0; i < link_mat->n; ++i) {
-        inter_link = &link_mat->links[i];
-        if (inter_link->n == 0)
-            continue;
-        r = inter_link->r;
-        memset(area, 0, sizeof(area));
-        for (j = 0; j < r; ++j)
+    if (inter_link->n == 0)
+        return;
+    b0 = inter_link->b0;
+    b1 = inter_link->b1;
+    r = link_mat->r;
+    // cells row by row, j = x * b1 + y is in band x + y
+    for (x = 0, j = 0; x < b0 && x <= b1 && x < r; ++x, j += b1) {
+        for (y = 0; y < b1 && (b = x + y) <= b0 && b <= b1 && b < r; ++y) {
+            a = inter_link_cell_area_xy(link_mat, inter_link->c0, inter_link->c1, x, y);
             for (k = 0; k < 4; ++k)
-                area[k] += inter_link->linkb[k][j]; //* (r - j);
-        // select the one with maximum cumsum area as linkt
-        t = 0;
-        ma = sma = 0;
-        n_ma = 0;
-        for (k = 0; k < 4; ++k) {
-            if (area[k] > ma) {
-                sma = ma;
-                ma = area[k];
-                n_ma = 1;
-                t = k;
-            } else if (area[k] == ma) {
-                ++n_ma;
-            } else if (area[k] > sma) {
-                sma = area[k];
-            }
+                if ((l = link_norm(inter_link->link[k][j + y], a)) > .0)
+                    inter_link->linkb[k][b] += l;
         }
-        if (n_ma == 1 && ma * .9 > sma) {
-            inter_link->linkt = 1 << t;
-        } else {
-            t = 0;
-            for (k = 0; k < 4; ++k)
-                if (inter_link->norms[k] >= min_norm)
-                    t |= (1 << k);
-            inter_link->linkt = t;
+    }
+
+    r = inter_link->r;
+    memset(area, 0, sizeof(area));
+    for (j = 0; j < r; ++j)
+        for (k = 0; k < 4; ++k)
+            area[k] += inter_link->linkb[k][j]; //* (r - j);
+    // select the one with maximum cumsum area as linkt
+    t = 0;
+    ma = sma = 0;
+    n_ma = 0;
+    for (k = 0; k < 4; ++k) {
+        if (area[k] > ma) {
+            sma = ma;
+            ma = area[k];
+            n_ma = 1;
+            t = k;
+        } else if (area[k] == ma) {
+            ++n_ma;
+        } else if (area[k] > sma) {
+            sma = area[k];
         }
+    }
+    if (n_ma == 1 && ma * .9 > sma) {
+        inter_link->linkt = 1 << t;
+    } else {
+        t = 0;
+        for (k = 0; k < 4; ++k)
+            if (inter_link->norms[k] >= step->min_norm)
+                t |= (1 << k);
+        inter_link->linkt = t;
+    }
 
 #ifdef DEBUG_ORIEN
-        fprintf(stderr, "[DEBUG_ORIEN::%s] %d %.0f %.0f %d %d [%.3f %.3f %.3f %.3f] [%.0f  %.0f  %.0f  %.0f] %s %s\n", __func__, inter_link->linkt, ma, sma, inter_link->b0, inter_link->b1, inter_link->norms[0], inter_link->norms[1], inter_link->norms[2], inter_link->norms[3], area[0], area[1], area[2], area[3], dict->s[inter_link->c0].name, dict->s[inter_link->c1].name);
+    fprintf(stderr, "[DEBUG_ORIEN::%s] %d %.0f %.0f %d %d [%.3f %.3f %.3f %.3f] [%.0f  %.0f  %.0f  %.0f] %s %s\n", __func__, inter_link->linkt, ma, sma, inter_link->b0, inter_link->b1, inter_link->norms[0], inter_link->norms[1], inter_link->norms[2], inter_link->norms[3], area[0], area[1], area[2], area[3], dict->s[inter_link->c0].name, dict->s[inter_link->c1].name);
 #endif
-    }
 }
 
+void calc_link_directs(inter_link_mat_t *link_mat, double min_norm, asm_dict_t *dict, link_directs_t *directs, int n_threads)
+{
+    link_directs_step_t step;
+
+    step.link_mat = link_mat;
+    step.min_norm = min_norm;
+    step.dict = dict;
+    kt_for(n_threads, calc_link_directs_worker, &step, link_mat->n);
+}
+
+#define BAM_BATCH_SIZE 0x10000 // number of BAM records in each batch of the BAM conversion pipeline
+
+// a BAM record parsed for pairing
+// for BAM files sorted by read names x[0] and x[1] are the alignment start and end, -1 if below the mapping quality
+// for other BAM files x[0] and x[1] are the start of the read and its mate
+typedef struct {
+    char *rname;
+    char *cname[2];
+    uint32_t i[2]; // sequence id of cname, UINT32_MAX if absent
+    int32_t x[2];
+    uint8_t q;
+    int8_t ok; // passed the flag filter
+} bam_link_rec_t;
+
+// batches are recycled, record buffers are reused so that no memory is allocated per record
+typedef struct bam_link_batch_s {
+    int n;
+    bam1_t *b;
+    bam_link_rec_t *r;
+    uint32_t n_pair;
+    uint32_t *pair; // i0, p0, i1, p1 of each read pair [4 x n_pair]
+    uint8_t *q;
+    struct bam_link_batch_s *next;
+} bam_link_batch_t;
+
+typedef struct {
+    bamFile fp;
+    bam_header_t *h;
+    sdict_t *dict;
+    bin_writer_t *fo;
+    uint8_t mq;
+    int by_name; // BAM sorted by read names
+    int n_threads;
+    bam_link_batch_t *batch; // batch being parsed
+    bam_link_batch_t *free_batch; // batches written and ready for reuse
+    pthread_mutex_t lock;
+    // last unpaired record carried over to the next batch
+    bam_link_rec_t r0;
+    char *rname0;
+    size_t rname0_m;
+    int8_t buff;
+    khash_t(str) *hmseq; // for absent sequences
+    long rec_c, pair_c, inter_c, intra_c;
+} bam_link_pipeline_t;
+
 static int32_t get_target_end(uint32_t *cigar, int n_cigar, int32_t s)
 {
     int i;
@@ -1303,236 +3089,322 @@ static int32_t get_target_end(uint32_t *cigar, int n_cigar, int32_t s)
     return s;
 }
 
-static char *parse_bam_rec(bam1_t *b, bam_header_t *h, uint8_t mq, int32_t *s, int32_t *e, uint8_t *q, char **cname)
+static void parse_bam_rec(bam1_t *b, bam_header_t *h, sdict_t *dict, uint8_t mq, bam_link_rec_t *r)
 {
     // 0x4 0x100 0x200 0x400 0x800
-    if (b->core.flag & 0xF04)
-        return 0;
-    *cname = h->target_name[b->core.tid];
+    r->ok = !(b->core.flag & 0xF04);
+    if (!r->ok)
+        return;
+    r->rname = bam1_qname(b);
+    r->cname[0] = h->target_name[b->core.tid];
+    r->i[0] = sd_get(dict, r->cname[0]);
     if (b->core.qual < mq) {
-        *s = -1;
-        *e = -1;
-        *q = 0;
+        r->x[0] = -1;
+        r->x[1] = -1;
+        r->q = 0;
     } else {
-        *s = b->core.pos + 1;
-        *e = get_target_end(bam1_cigar(b), b->core.n_cigar, b->core.pos) + 1;
-        *q = b->core.qual;
+        r->x[0] = b->core.pos + 1;
+        r->x[1] = get_target_end(bam1_cigar(b), b->core.n_cigar, b->core.pos) + 1;
+        r->q = b->core.qual;
     }
-    
-    return strdup(bam1_qname(b));
 }
 
-static char *parse_bam_rec1(bam1_t *b, bam_header_t *h, char **cname0, int32_t *s0, char **cname1, int32_t *s1)
+static void parse_bam_rec1(bam1_t *b, bam_header_t *h, sdict_t *dict, bam_link_rec_t *r)
 {
     // 0x4 0x8 0x40 0x100 0x200 0x400 0x800
-    if (b->core.flag & 0xF4C)
-        return 0;
-    *cname0 = h->target_name[b->core.tid];
-    *s0 = b->core.pos + 1;
-    *cname1 = h->target_name[b->core.mtid];
-    *s1 = b->core.mpos + 1;
+    r->ok = !(b->core.flag & 0xF4C);
+    if (!r->ok)
+        return;
+    r->rname = bam1_qname(b);
+    r->cname[0] = h->target_name[b->core.tid];
+    r->x[0] = b->core.pos + 1;
+    r->cname[1] = h->target_name[b->core.mtid];
+    r->x[1] = b->core.mpos + 1;
+    r->i[0] = sd_get(dict, r->cname[0]);
+    r->i[1] = sd_get(dict, r->cname[1]);
+}
 
-    return bam1_qname(b);
+static bam_link_batch_t *bam_link_batch_init(void)
+{
+    bam_link_batch_t *batch;
+    batch = (bam_link_batch_t *) calloc(1, sizeof(bam_link_batch_t));
+    batch->b = (bam1_t *) calloc(BAM_BATCH_SIZE, sizeof(bam1_t));
+    batch->r = (bam_link_rec_t *) malloc(BAM_BATCH_SIZE * sizeof(bam_link_rec_t));
+    batch->pair = (uint32_t *) malloc(BAM_BATCH_SIZE * 4 * sizeof(uint32_t));
+    batch->q = (uint8_t *) malloc(BAM_BATCH_SIZE);
+    return batch;
 }
 
-void dump_links_from_bam_file(const char *f, const char *fai, uint32_t ml, uint8_t mq, const char *out)
+static void bam_link_batch_destroy(bam_link_batch_t *batch)
+{
+    int i;
+    for (i = 0; i < BAM_BATCH_SIZE; ++i)
+        free(batch->b[i].data);
+    free(batch->b);
+    free(batch->r);
+    free(batch->pair);
+    free(batch->q);
+    free(batch);
+}
+
+// check if either sequence of a read pair is absent and warn once for each absent sequence
+static int link_seq_absent(khash_t(str) *hmseq, const char *func, uint32_t i0, char *cname0, uint32_t i1, char *cname1)
 {
-    bamFile fp;
-    FILE *fo;
-    bam_header_t *h;
-    bam1_t *b;
-    char *cname0, *cname1, *rname0, *rname1;
-    int32_t s0, s1, e0, e1;
-    uint32_t i0, i1, p0, p1;
-    uint8_t q, q0, q1;
-    int8_t buff;
-    long rec_c, pair_c, inter_c, intra_c;
-    enum bam_sort_order so;
-    
-    khash_t(str) *hmseq; // for absent sequences
     khint_t k;
     int absent;
-    hmseq = kh_init(str);
 
-    sdict_t *dict = make_sdict_from_index(fai, ml);
-    
-    fp = bam_open(f, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "[E::%s] cannot open file %s for reading\n", __func__, f);
-        exit(EXIT_FAILURE);
+    if (i0 == UINT32_MAX) {
+        k = kh_put(str, hmseq, cname0, &absent);
+        if (absent) {
+            kh_key(hmseq, k) = strdup(cname0);
+            fprintf(stderr, "[W::%s] sequence \"%s\" not found \n", func, cname0);
+        }
+        return 1;
     }
-    
-    fo = fopen(out, "w");
-    if (fo == NULL) {
-        fprintf(stderr, "[E::%s] cannot open file %s for writing\n", __func__, out);
-        exit(EXIT_FAILURE);
+    if (i1 == UINT32_MAX) {
+        k = kh_put(str, hmseq, cname1, &absent);
+        if (absent) {
+            kh_key(hmseq, k) = strdup(cname1);
+            fprintf(stderr, "[W::%s] sequence \"%s\" not found \n", func, cname1);
+        }
+        return 1;
     }
-    write_bin_header(fo);
+    return 0;
+}
 
-    h = bam_header_read(fp);
-    b = bam_init1();
-    so = bam_hrecs_sort_order(h);
-    cname0 = cname1 = rname0 = rname1 = 0;
-    s0 = s1 = e0 = e1 = 0;
-    i0 = i1 = p0 = p1 = 0;
-    q0 = q1 = 0;
-    rec_c = pair_c = inter_c = intra_c = 0;
-    buff = 0;
+static void bam_link_add_pair(bam_link_batch_t *batch, uint32_t i0, uint32_t p0, uint32_t i1, uint32_t p1, uint8_t q)
+{
+    uint32_t *pair;
+    if (i0 > i1) {
+        SWAP(uint32_t, i0, i1);
+        SWAP(uint32_t, p0, p1);
+    }
+    pair = batch->pair + (uint64_t) batch->n_pair * 4;
+    pair[0] = i0;
+    pair[1] = p0;
+    pair[2] = i1;
+    pair[3] = p1;
+    batch->q[batch->n_pair++] = q;
+}
 
-    if (so == ORDER_NAME) {
-        // sorted by read names
-        while (bam_read1(fp, b) >= 0 ) {
-            
-            if (++rec_c % 1000000 == 0)
-                fprintf(stderr, "[I::%s] %ld million records processed, %ld read pairs \n", __func__, rec_c / 1000000, pair_c);
+static void bam_link_parse_worker(void *data, long i, int tid)
+{
+    bam_link_pipeline_t *pl = (bam_link_pipeline_t *) data;
+    bam_link_batch_t *batch = pl->batch;
 
-            if (buff == 0) {
-                rname0 = parse_bam_rec(b, h, mq, &s0, &e0, &q0, &cname0);
-                if (!rname0)
-                    continue;
-                ++buff;
-            } else if (buff == 1) {
-                rname1 = parse_bam_rec(b, h, mq, &s1, &e1, &q1, &cname1);
-                if (!rname1)
-                    continue;
-                if (strcmp(rname0, rname1) == 0) {
-                    buff = 0;
-
-                    if (s0 >= 0 && s1 >= 0) {
-                        i0 = sd_get(dict, cname0);
-                        i1 = sd_get(dict, cname1);
-
-                        if (i0 == UINT32_MAX) {
-                            k = kh_put(str, hmseq, cname0, &absent);
-                            if (absent) {
-                                kh_key(hmseq, k) = strdup(cname0);
-                                fprintf(stderr, "[W::%s] sequence \"%s\" not found \n", __func__, cname0);
-                            }
-                        } else if (i1 == UINT32_MAX) {
-                            k = kh_put(str, hmseq, cname1, &absent);
-                            if (absent) {
-                                kh_key(hmseq, k) = strdup(cname1);
-                                fprintf(stderr, "[W::%s] sequence \"%s\" not found \n", __func__, cname1);
-                            }
-                        } else {
-                            p0 = s0 / 2 + e0 / 2 + (s0 & 1 && e0 & 1);
-                            p1 = s1 / 2 + e1 / 2 + (s1 & 1 && e1 & 1);
-                            if (i0 > i1) {
-                                SWAP(uint32_t, i0, i1);
-                                SWAP(uint32_t, p0, p1);
-                            }
-                            q = MIN(q0, q1);
-                            fwrite(&i0, sizeof(uint32_t), 1, fo);
-                            fwrite(&p0, sizeof(uint32_t), 1, fo);
-                            fwrite(&i1, sizeof(uint32_t), 1, fo);
-                            fwrite(&p1, sizeof(uint32_t), 1, fo);
-                            fwrite(&q, sizeof(uint8_t), 1, fo);
-
-                            if (i0 == i1)
-                                ++intra_c;
-                            else
-                                ++inter_c;
-                            
-                            ++pair_c;
-                        }
-                    }
-                    
-                    free(rname0);
-                    free(rname1);
-                    rname0 = 0;
-                    rname1 = 0;
-                } else {
-                    buff = 1;
-
-                    cname0 = cname1;
-                    s0 = s1;
-                    e0 = e1;
-                    q0 = q1;
-                    free(rname0);
-                    rname0 = rname1;
-                    rname1 = 0;
-                }
-            }
+    if (pl->by_name)
+        parse_bam_rec(&batch->b[i], pl->h, pl->dict, pl->mq, &batch->r[i]);
+    else
+        parse_bam_rec1(&batch->b[i], pl->h, pl->dict, &batch->r[i]);
+}
+
+// pair records of a batch in file order, the last unpaired record is carried over to the next batch
+static void bam_link_pair_batch(bam_link_pipeline_t *pl, bam_link_batch_t *batch)
+{
+    int j;
+    size_t l;
+    bam_link_rec_t *r0, *r1;
+
+    r0 = &pl->r0;
+    for (j = 0; j < batch->n; ++j) {
+        r1 = &batch->r[j];
+        if (!r1->ok)
+            continue;
+
+        if (!pl->by_name) {
+            if (r1->x[0] >= 0 && r1->x[1] >= 0 && !link_seq_absent(pl->hmseq, "dump_links_from_bam", r1->i[0], r1->cname[0], r1->i[1], r1->cname[1]))
+                bam_link_add_pair(batch, r1->i[0], r1->x[0], r1->i[1], r1->x[1], 255);
+            continue;
         }
-    } else {
-        // sorted by coordinates or others
-        if (mq > 0)
-            fprintf(stderr, "[W::%s] BAM file is not sorted by read name. Filtering by mapping quality %hhu suppressed \n", __func__, mq);
-        q = 255;
 
-        while (bam_read1(fp, b) >= 0) {
-            
-            if (++rec_c % 1000000 == 0)
-                fprintf(stderr, "[I::%s] %ld million records processed, %ld read pairs \n", __func__, rec_c / 1000000, pair_c);
+        if (pl->buff == 1 && strcmp(r0->rname, r1->rname) == 0) {
+            pl->buff = 0;
+            if (r0->x[0] >= 0 && r1->x[0] >= 0 && !link_seq_absent(pl->hmseq, "dump_links_from_bam", r0->i[0], r0->cname[0], r1->i[0], r1->cname[0]))
+                bam_link_add_pair(batch, r0->i[0], r0->x[0] / 2 + r0->x[1] / 2 + (r0->x[0] & 1 && r0->x[1] & 1),
+                        r1->i[0], r1->x[0] / 2 + r1->x[1] / 2 + (r1->x[0] & 1 && r1->x[1] & 1), MIN(r0->q, r1->q));
+        } else {
+            pl->buff = 1;
+            *r0 = *r1;
+            // the record data is freed with the batch
+            l = strlen(r1->rname) + 1;
+            if (l > pl->rname0_m) {
+                pl->rname0_m = l;
+                pl->rname0 = (char *) realloc(pl->rname0, l);
+            }
+            memcpy(pl->rname0, r1->rname, l);
+            r0->rname = pl->rname0;
+        }
+    }
+}
 
-            if(!parse_bam_rec1(b, h, &cname0, &s0, &cname1, &s1))
-                continue;
+static void *bam_link_pipeline(void *data, int step, void *in)
+{
+    bam_link_pipeline_t *pl = (bam_link_pipeline_t *) data;
+    bam_link_batch_t *batch;
+    uint32_t i, *pair;
+    long rec_c;
+
+    if (step == 0) {
+        // read a batch of records
+        pthread_mutex_lock(&pl->lock);
+        batch = pl->free_batch;
+        if (batch)
+            pl->free_batch = batch->next;
+        pthread_mutex_unlock(&pl->lock);
+        if (batch == 0)
+            batch = bam_link_batch_init();
+        batch->n = batch->n_pair = 0;
+        while (batch->n < BAM_BATCH_SIZE && bam_read1(pl->fp, &batch->b[batch->n]) >= 0)
+            ++batch->n;
+        if (batch->n == 0) {
+            bam_link_batch_destroy(batch);
+            return 0;
+        }
+        return batch;
+    } else if (step == 1) {
+        // parse records on all threads and pair them in order
+        batch = (bam_link_batch_t *) in;
+        pl->batch = batch;
+        kt_for(pl->n_threads, bam_link_parse_worker, pl, batch->n);
+        pl->batch = 0;
+        bam_link_pair_batch(pl, batch);
+        return batch;
+    } else if (step == 2) {
+        // write read pairs
+        batch = (bam_link_batch_t *) in;
+        for (i = 0; i < batch->n_pair; ++i) {
+            pair = batch->pair + (uint64_t) i * 4;
+            bin_writer_add(pl->fo, pair[0], pair[1], pair[2], pair[3], batch->q[i]);
+            bin_file_rec_add(pair[0], pair[2]);
+            if (pair[0] == pair[2])
+                ++pl->intra_c;
+            else
+                ++pl->inter_c;
+        }
+        rec_c = pl->rec_c;
+        pl->rec_c += batch->n;
+        pl->pair_c += batch->n_pair;
+        if (pl->rec_c / 1000000 > rec_c / 1000000)
+            fprintf(stderr, "[I::dump_links_from_bam] %ld million records processed, %ld read pairs \n", pl->rec_c / 1000000, pl->pair_c);
+        pthread_mutex_lock(&pl->lock);
+        batch->next = pl->free_batch;
+        pl->free_batch = batch;
+        pthread_mutex_unlock(&pl->lock);
+        return 0;
+    }
 
-            if (s0 >= 0 && s1 >= 0) {
-                i0 = sd_get(dict, cname0);
-                i1 = sd_get(dict, cname1);
+    return 0;
+}
 
-                if (i0 == UINT32_MAX) {
-                    k = kh_put(str, hmseq, cname0, &absent);
-                    if (absent) {
-                        kh_key(hmseq, k) = strdup(cname0);
-                        fprintf(stderr, "[W::%s] sequence \"%s\" not found \n", __func__, cname0);
-                    }
-                } else if (i1 == UINT32_MAX) {
-                    k = kh_put(str, hmseq, cname1, &absent);
-                    if (absent) {
-                        kh_key(hmseq, k) = strdup(cname1);
-                        fprintf(stderr, "[W::%s] sequence \"%s\" not found \n", __func__, cname1);
-                    }
-                } else {
-                    if (i0 > i1) {
-                        SWAP(uint32_t, i0, i1);
-                        SWAP(uint32_t, s0, s1);
-                    }
-                    fwrite(&i0, sizeof(uint32_t), 1, fo);
-                    fwrite(&s0, sizeof(uint32_t), 1, fo);
-                    fwrite(&i1, sizeof(uint32_t), 1, fo);
-                    fwrite(&s1, sizeof(uint32_t), 1, fo);
-                    fwrite(&q, sizeof(uint8_t), 1, fo);
+// records are read, parsed and paired, and written in a three-step pipeline
+// the BAM file is closed on return
+static void dump_links_from_bam(bamFile fp, const char *fai, uint32_t ml, uint8_t mq, const char *out, int bin_version, int n_threads)
+{
+    bam_link_pipeline_t pl;
+    bam_link_batch_t *batch;
+    khint_t k;
 
-                    if (i0 == i1)
-                        ++intra_c;
-                    else
-                        ++inter_c;
+    memset(&pl, 0, sizeof(bam_link_pipeline_t));
+    pl.fp = fp;
+    pl.mq = mq;
+    pl.n_threads = n_threads;
+    pl.h = bam_header_read(pl.fp);
+    if (pl.h == NULL)
+        exit(EXIT_FAILURE);
+    pl.hmseq = kh_init(str);
+    pl.dict = make_sdict_from_index(fai, ml);
+    
+    pl.fo = bin_writer_open(out, bin_version);
+    if (pl.fo == NULL)
+        exit(EXIT_FAILURE);
+    bin_file_rec_init(pl.dict->n);
+
+    pl.by_name = bam_hrecs_sort_order(pl.h) == ORDER_NAME;
+    if (!pl.by_name && mq > 0)
+        fprintf(stderr, "[W::%s] BAM file is not sorted by read name. Filtering by mapping quality %hhu suppressed \n", __func__, mq);
+
+    pthread_mutex_init(&pl.lock, 0);
+    kt_pipeline(n_threads > 1? 3 : 1, bam_link_pipeline, &pl, 3);
+    pthread_mutex_destroy(&pl.lock);
+    while ((batch = pl.free_batch) != 0) {
+        pl.free_batch = batch->next;
+        bam_link_batch_destroy(batch);
+    }
 
-                    ++pair_c;
-                }
-            }
-        }
+    for (k = 0; k < kh_end(pl.hmseq); ++k)
+        if (kh_exist(pl.hmseq, k))
+            free((char *) kh_key(pl.hmseq, k));
+    kh_destroy(str, pl.hmseq);
+
+    free(pl.rname0);
+    bam_header_destroy(pl.h);
+    sd_destroy(pl.dict);
+    bam_close(pl.fp);
+    if (bin_writer_close(pl.fo)) {
+        fprintf(stderr, "[E::%s] failed to write file %s\n", __func__, out);
+        exit(EXIT_FAILURE);
     }
+    bin_file_rec_done(out, 0);
 
-    for (k = 0; k < kh_end(hmseq); ++k)
-        if (kh_exist(hmseq, k))
-            free((char *) kh_key(hmseq, k));
-    kh_destroy(str, hmseq);
+    fprintf(stderr, "[I::%s] dumped %ld read pairs from %ld records: %ld intra links + %ld inter links \n", __func__, pl.pair_c, pl.rec_c, pl.intra_c, pl.inter_c);
+}
 
-    if (rname0)
-        free(rname0);
-    if (rname1)
-        free(rname1);
-    bam_destroy1(b);
-    bam_header_destroy(h);
-    sd_destroy(dict);
-    bam_close(fp);
-    fclose(fo);
+void dump_links_from_bam_file(const char *f, const char *fai, uint32_t ml, uint8_t mq, const char *out, int bin_version, int n_threads)
+{
+    bamFile fp;
+    fp = bam_open_mt(f, n_threads);
+    if (fp == NULL) {
+        fprintf(stderr, "[E::%s] cannot open file %s for reading\n", __func__, f);
+        exit(EXIT_FAILURE);
+    }
+    dump_links_from_bam(fp, fai, ml, mq, out, bin_version, n_threads);
+}
 
-    fprintf(stderr, "[I::%s] dumped %ld read pairs from %ld records: %ld intra links + %ld inter links \n", __func__, pair_c, rec_c, intra_c, inter_c);
+// a BED record with fields pointing into the line
+typedef struct {
+    char *cname, *rname;
+    uint32_t s, e;
+    uint8_t q;
+} bed_link_rec_t;
+
+// split the first five whitespace separated fields of a BED line in place
+// return the number of fields parsed
+static int parse_bed_rec(char *line, bed_link_rec_t *r)
+{
+    char *p, *f[5];
+    int n;
+
+    p = line;
+    for (n = 0; n < 5; ++n) {
+        while (*p == ' ' || *p == '\t')
+            ++p;
+        if (*p == '\0' || *p == '\n' || *p == '\r')
+            break;
+        f[n] = p;
+        while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+            ++p;
+        if (*p != '\0')
+            *p++ = '\0';
+    }
+    if (n < 4)
+        return n;
+    r->cname = f[0];
+    r->s = strtoul(f[1], NULL, 10);
+    r->e = strtoul(f[2], NULL, 10);
+    r->rname = f[3];
+    r->q = n > 4? strtoul(f[4], NULL, 10) : 0;
+    return n;
 }
 
-void dump_links_from_bed_file(const char *f, const char *fai, uint32_t ml, uint8_t mq, const char *out)
+// the stream is read to the end but not closed
+static void dump_links_from_bed(kstream_t *ks, const char *fai, uint32_t ml, uint8_t mq, const char *out, int bin_version)
 {
-    FILE *fp, *fo;
-    char *line = NULL;
-    size_t ln = 0;
-    ssize_t read;
-    char cname0[4096], cname1[4096], rname0[4096], rname1[4096];
-    uint32_t s0, s1, e0, e1, i0, i1, p0, p1;
-    uint8_t q, q0, q1;
+    bin_writer_t *fo;
+    kstring_t line[2];
+    int l;
+    bed_link_rec_t r0, r1;
+    uint32_t i0, i1, p0, p1;
+    uint8_t q;
     int8_t buff;
     long rec_c, pair_c, inter_c, intra_c;
 
@@ -1543,66 +3415,59 @@ void dump_links_from_bed_file(const char *f, const char *fai, uint32_t ml, uint8
 
     sdict_t *dict = make_sdict_from_index(fai, ml);
 
-    fp = fopen(f, "r");
-    if (fp == NULL) {
-        fprintf(stderr, "[E::%s] cannot open file %s for reading\n", __func__, f);
-        exit(EXIT_FAILURE);
-    }
-
-    fo = fopen(out, "w");
-    if (fo == NULL) {
-        fprintf(stderr, "[E::%s] cannot open file %s for writing\n", __func__, out);
+    fo = bin_writer_open(out, bin_version);
+    if (fo == NULL)
         exit(EXIT_FAILURE);
-    }
-    write_bin_header(fo);
+    bin_file_rec_init(dict->n);
 
-    s0 = s1 = e0 = e1 = 0;
+    // two line buffers are used in turn so that the unpaired record stays in place
+    memset(line, 0, sizeof(line));
+    l = 0;
     i0 = i1 = p0 = p1 = 0;
-    q0 = q1 = 0;
     rec_c = pair_c = inter_c = intra_c = 0;
     buff = 0;
-    while ((read = getline(&line, &ln, fp)) != -1) {
+    while (ks_getuntil(ks, KS_SEP_LINE, &line[l], 0) >= 0) {
         
         if (++rec_c % 1000000 == 0)
             fprintf(stderr, "[I::%s] %ld million records processed, %ld read pairs \n", __func__, rec_c / 1000000, pair_c);
     
         if (buff == 0) {
-            sscanf(line, "%s %u %u %s %hhu %*s", cname0, &s0, &e0, rname0, &q0);
+            if (parse_bed_rec(line[l].s, &r0) < 4)
+                continue;
+            l ^= 1;
             ++buff;
         } else if (buff == 1) {
-            sscanf(line, "%s %u %u %s %hhu %*s", cname1, &s1, &e1, rname1, &q1);
-            if (is_read_pair(rname0, rname1)) {
+            if (parse_bed_rec(line[l].s, &r1) < 4)
+                continue;
+            if (is_read_pair(r0.rname, r1.rname)) {
                 buff = 0;
 
-                i0 = sd_get(dict, cname0);
-                i1 = sd_get(dict, cname1);
+                i0 = sd_get(dict, r0.cname);
+                i1 = sd_get(dict, r1.cname);
 
                 if (i0 == UINT32_MAX) {
-                    k = kh_put(str, hmseq, cname0, &absent);
+                    k = kh_put(str, hmseq, r0.cname, &absent);
                     if (absent) {
-                        kh_key(hmseq, k) = strdup(cname0);
-                        fprintf(stderr, "[W::%s] sequence \"%s\" not found \n", __func__, cname0);
+                        kh_key(hmseq, k) = strdup(r0.cname);
+                        fprintf(stderr, "[W::%s] sequence \"%s\" not found \n", __func__, r0.cname);
                     }
                 } else if (i1 == UINT32_MAX) {
-                    k = kh_put(str, hmseq, cname1, &absent);
+                    k = kh_put(str, hmseq, r1.cname, &absent);
                     if (absent) {
-                        kh_key(hmseq, k) = strdup(cname1);
-                        fprintf(stderr, "[W::%s] sequence \"%s\" not found \n", __func__, cname1);
+                        kh_key(hmseq, k) = strdup(r1.cname);
+                        fprintf(stderr, "[W::%s] sequence \"%s\" not found \n", __func__, r1.cname);
                     }
                 } else {
                     // from zero-based to one-based
-                    p0 = s0 / 2 + e0 / 2 + (s0 & 1 && e0 & 1) + 1;
-                    p1 = s1 / 2 + e1 / 2 + (s1 & 1 && e1 & 1) + 1;
+                    p0 = r0.s / 2 + r0.e / 2 + (r0.s & 1 && r0.e & 1) + 1;
+                    p1 = r1.s / 2 + r1.e / 2 + (r1.s & 1 && r1.e & 1) + 1;
                     if (i0 > i1) {
                         SWAP(uint32_t, i0, i1);
                         SWAP(uint32_t, p0, p1);
                     }
-                    q = MIN(q0, q1);
-                    fwrite(&i0, sizeof(uint32_t), 1, fo);
-                    fwrite(&p0, sizeof(uint32_t), 1, fo);
-                    fwrite(&i1, sizeof(uint32_t), 1, fo);
-                    fwrite(&p1, sizeof(uint32_t), 1, fo);
-                    fwrite(&q, sizeof(uint8_t), 1, fo);
+                    q = MIN(r0.q, r1.q);
+                    bin_writer_add(fo, i0, p0, i1, p1, q);
+                    bin_file_rec_add(i0, i1);
                 
                     if (i0 == i1)
                         ++intra_c;
@@ -1612,13 +3477,8 @@ void dump_links_from_bed_file(const char *f, const char *fai, uint32_t ml, uint8
                     ++pair_c;
                 }
             } else {
-                buff = 1;
-
-                strcpy(cname0, cname1);
-                s0 = s1;
-                e0 = e1;
-                q0 = q1;
-                strcpy(rname0, rname1);
+                r0 = r1;
+                l ^= 1;
             }
         }
     }
@@ -1628,12 +3488,442 @@ void dump_links_from_bed_file(const char *f, const char *fai, uint32_t ml, uint8
             free((char *) kh_key(hmseq, k));
     kh_destroy(str, hmseq);
 
-    if (line)
-        free(line);
+    free(line[0].s);
+    free(line[1].s);
     sd_destroy(dict);
-    fclose(fp);
-    fclose(fo);
+    if (bin_writer_close(fo)) {
+        fprintf(stderr, "[E::%s] failed to write file %s\n", __func__, out);
+        exit(EXIT_FAILURE);
+    }
+    bin_file_rec_done(out, 0);
 
     fprintf(stderr, "[I::%s] dumped %ld read pairs from %ld records: %ld intra links + %ld inter links \n", __func__, pair_c, rec_c, intra_c, inter_c);
 }
 
+void dump_links_from_bed_file(const char *f, const char *fai, uint32_t ml, uint8_t mq, const char *out, int bin_version)
+{
+    gzFile fp;
+    kstream_t *ks;
+    void *ko;
+    int fd;
+
+    ko = kopen(f, &fd);
+    if (ko == 0) {
+        fprintf(stderr, "[E::%s] cannot open file %s for reading\n", __func__, f);
+        exit(EXIT_FAILURE);
+    }
+    fp = gzdopen(fd, "r");
+    ks = ks_init(fp);
+    dump_links_from_bed(ks, fai, ml, mq, out, bin_version);
+    ks_destroy(ks);
+    gzclose(fp);
+    kclose(ko);
+}
+
+#define PAIRS_BATCH_SIZE 0x10000 // number of lines in each batch of the pairs conversion pipeline
+#define PAIRS_MAX_COLS 64
+
+// lines of a pairs file parsed into read pairs
+typedef struct pairs_link_batch_s {
+    int n;
+    kstring_t buf; // lines separated by '\0'
+    size_t *off; // offset of each line in buf
+    int8_t *st; // 0 for a read pair, 1 for a line skipped, 2 for a pair with absent sequences
+    char **cname; // sequence names of each line [2 x n]
+    uint32_t *i; // sequence ids of each line [2 x n]
+    uint32_t n_pair;
+    uint32_t *pair; // i0, p0, i1, p1 of each read pair [4 x n_pair]
+    uint8_t *q;
+    struct pairs_link_batch_s *next;
+} pairs_link_batch_t;
+
+typedef struct {
+    kstream_t *ks;
+    sdict_t *dict;
+    bin_writer_t *fo;
+    int n_threads;
+    // column indices of chr1, pos1, chr2, pos2, mapq1 and mapq2, -1 if absent
+    int col[6];
+    int n_col; // number of columns to parse
+    kstring_t line;
+    pairs_link_batch_t *batch; // batch being parsed
+    pairs_link_batch_t *free_batch; // batches written and ready for reuse
+    pthread_mutex_t lock;
+    khash_t(str) *hmseq; // for absent sequences
+    long rec_c, pair_c, inter_c, intra_c;
+} pairs_link_pipeline_t;
+
+// set column indices from the "#columns:" header line
+// column names follow the 4DN pairs specification, chrom1 and chrom2 are accepted for chr1 and chr2
+static void pairs_parse_columns(pairs_link_pipeline_t *pl, char *line)
+{
+    static const char *names[6] = {"chr1", "pos1", "chr2", "pos2", "mapq1", "mapq2"};
+    static const char *alias[6] = {"chrom1", 0, "chrom2", 0, 0, 0};
+    char *p, *q;
+    int i, c;
+    size_t l;
+
+    for (i = 0; i < 6; ++i)
+        pl->col[i] = -1;
+    p = line + 9;
+    c = 0;
+    while (*p) {
+        while (*p == ' ' || *p == '\t')
+            ++p;
+        if (*p == '\0')
+            break;
+        q = p;
+        while (*q && *q != ' ' && *q != '\t')
+            ++q;
+        l = q - p;
+        for (i = 0; i < 6; ++i)
+            if ((strlen(names[i]) == l && strncmp(names[i], p, l) == 0) || (alias[i] && strlen(alias[i]) == l && strncmp(alias[i], p, l) == 0))
+                pl->col[i] = c;
+        ++c;
+        p = q;
+    }
+    for (i = 0; i < 4; ++i) {
+        if (pl->col[i] < 0) {
+            fprintf(stderr, "[E::dump_links_from_pairs] column \"%s\" not found in pairs header\n", names[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    // mapping quality is only used if given for both reads
+    if (pl->col[4] < 0 || pl->col[5] < 0)
+        pl->col[4] = pl->col[5] = -1;
+    pl->n_col = 0;
+    for (i = 0; i < 6; ++i)
+        pl->n_col = MAX(pl->n_col, pl->col[i] + 1);
+    if (pl->n_col > PAIRS_MAX_COLS) {
+        fprintf(stderr, "[E::dump_links_from_pairs] more than %d columns in pairs file are not supported\n", PAIRS_MAX_COLS);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static pairs_link_batch_t *pairs_link_batch_init(void)
+{
+    pairs_link_batch_t *batch;
+    batch = (pairs_link_batch_t *) calloc(1, sizeof(pairs_link_batch_t));
+    batch->off = (size_t *) malloc(PAIRS_BATCH_SIZE * sizeof(size_t));
+    batch->st = (int8_t *) malloc(PAIRS_BATCH_SIZE);
+    batch->cname = (char **) malloc(PAIRS_BATCH_SIZE * 2 * sizeof(char *));
+    batch->i = (uint32_t *) malloc(PAIRS_BATCH_SIZE * 2 * sizeof(uint32_t));
+    batch->pair = (uint32_t *) malloc(PAIRS_BATCH_SIZE * 4 * sizeof(uint32_t));
+    batch->q = (uint8_t *) malloc(PAIRS_BATCH_SIZE);
+    return batch;
+}
+
+static void pairs_link_batch_destroy(pairs_link_batch_t *batch)
+{
+    free(batch->buf.s);
+    free(batch->off);
+    free(batch->st);
+    free(batch->cname);
+    free(batch->i);
+    free(batch->pair);
+    free(batch->q);
+    free(batch);
+}
+
+static void pairs_link_parse_worker(void *data, long i, int tid)
+{
+    pairs_link_pipeline_t *pl = (pairs_link_pipeline_t *) data;
+    pairs_link_batch_t *batch = pl->batch;
+    char *p, *f[PAIRS_MAX_COLS];
+    uint32_t *pair, x0, x1;
+    int n;
+
+    // split tab separated fields in place
+    p = batch->buf.s + batch->off[i];
+    for (n = 0; n < pl->n_col; ++n) {
+        f[n] = p;
+        while (*p && *p != '\t')
+            ++p;
+        if (*p == '\0') {
+            ++n;
+            break;
+        }
+        *p++ = '\0';
+    }
+    batch->st[i] = 1;
+    if (n < pl->n_col)
+        return;
+    x0 = strtoul(f[pl->col[1]], NULL, 10);
+    x1 = strtoul(f[pl->col[3]], NULL, 10);
+    // unmapped reads are marked by '!' and position 0
+    if (x0 == 0 || x1 == 0 || strcmp(f[pl->col[0]], "!") == 0 || strcmp(f[pl->col[2]], "!") == 0)
+        return;
+    batch->cname[i * 2] = f[pl->col[0]];
+    batch->cname[i * 2 + 1] = f[pl->col[2]];
+    batch->i[i * 2] = sd_get(pl->dict, batch->cname[i * 2]);
+    batch->i[i * 2 + 1] = sd_get(pl->dict, batch->cname[i * 2 + 1]);
+    if (batch->i[i * 2] == UINT32_MAX || batch->i[i * 2 + 1] == UINT32_MAX) {
+        batch->st[i] = 2;
+        return;
+    }
+    batch->st[i] = 0;
+    pair = batch->pair + (uint64_t) i * 4;
+    pair[0] = batch->i[i * 2];
+    pair[1] = x0;
+    pair[2] = batch->i[i * 2 + 1];
+    pair[3] = x1;
+    if (pair[0] > pair[2]) {
+        SWAP(uint32_t, pair[0], pair[2]);
+        SWAP(uint32_t, pair[1], pair[3]);
+    }
+    batch->q[i] = pl->col[4] < 0? 255 : MIN((uint8_t) strtoul(f[pl->col[4]], NULL, 10), (uint8_t) strtoul(f[pl->col[5]], NULL, 10));
+}
+
+static void *pairs_link_pipeline(void *data, int step, void *in)
+{
+    pairs_link_pipeline_t *pl = (pairs_link_pipeline_t *) data;
+    pairs_link_batch_t *batch;
+    uint32_t i, *pair;
+    long rec_c;
+
+    if (step == 0) {
+        // read a batch of lines
+        pthread_mutex_lock(&pl->lock);
+        batch = pl->free_batch;
+        if (batch)
+            pl->free_batch = batch->next;
+        pthread_mutex_unlock(&pl->lock);
+        if (batch == 0)
+            batch = pairs_link_batch_init();
+        batch->n = batch->n_pair = 0;
+        batch->buf.l = 0;
+        while (batch->n < PAIRS_BATCH_SIZE && ks_getuntil(pl->ks, KS_SEP_LINE, &pl->line, 0) >= 0) {
+            if (pl->line.l == 0)
+                continue;
+            if (pl->line.s[0] == '#') {
+                if (strncmp(pl->line.s, "#columns:", 9) == 0)
+                    pairs_parse_columns(pl, pl->line.s);
+                continue;
+            }
+            if (batch->buf.l + pl->line.l + 1 > batch->buf.m) {
+                batch->buf.m = batch->buf.l + pl->line.l + 1;
+                kroundup64(batch->buf.m);
+                batch->buf.s = (char *) realloc(batch->buf.s, batch->buf.m);
+            }
+            batch->off[batch->n++] = batch->buf.l;
+            memcpy(batch->buf.s + batch->buf.l, pl->line.s, pl->line.l + 1);
+            batch->buf.l += pl->line.l + 1;
+        }
+        if (batch->n == 0) {
+            pairs_link_batch_destroy(batch);
+            return 0;
+        }
+        return batch;
+    } else if (step == 1) {
+        // parse lines on all threads and collect read pairs in order
+        batch = (pairs_link_batch_t *) in;
+        pl->batch = batch;
+        kt_for(pl->n_threads, pairs_link_parse_worker, pl, batch->n);
+        pl->batch = 0;
+        for (i = 0; i < (uint32_t) batch->n; ++i) {
+            if (batch->st[i] == 2) {
+                link_seq_absent(pl->hmseq, "dump_links_from_pairs", batch->i[i * 2], batch->cname[i * 2], batch->i[i * 2 + 1], batch->cname[i * 2 + 1]);
+            } else if (batch->st[i] == 0) {
+                if (batch->n_pair < i) {
+                    memcpy(batch->pair + (uint64_t) batch->n_pair * 4, batch->pair + (uint64_t) i * 4, 4 * sizeof(uint32_t));
+                    batch->q[batch->n_pair] = batch->q[i];
+                }
+                ++batch->n_pair;
+            }
+        }
+        return batch;
+    } else if (step == 2) {
+        // write read pairs
+        batch = (pairs_link_batch_t *) in;
+        for (i = 0; i < batch->n_pair; ++i) {
+            pair = batch->pair + (uint64_t) i * 4;
+            bin_writer_add(pl->fo, pair[0], pair[1], pair[2], pair[3], batch->q[i]);
+            bin_file_rec_add(pair[0], pair[2]);
+            if (pair[0] == pair[2])
+                ++pl->intra_c;
+            else
+                ++pl->inter_c;
+        }
+        rec_c = pl->rec_c;
+        pl->rec_c += batch->n;
+        pl->pair_c += batch->n_pair;
+        if (pl->rec_c / 1000000 > rec_c / 1000000)
+            fprintf(stderr, "[I::dump_links_from_pairs] %ld million records processed, %ld read pairs \n", pl->rec_c / 1000000, pl->pair_c);
+        pthread_mutex_lock(&pl->lock);
+        batch->next = pl->free_batch;
+        pl->free_batch = batch;
+        pthread_mutex_unlock(&pl->lock);
+        return 0;
+    }
+
+    return 0;
+}
+
+// 4DN pairs file, plain or gzipped
+// columns are taken from the "#columns:" header, or readID chr1 pos1 chr2 pos2 ... if absent
+// mapping quality of a read pair is the smaller of mapq1 and mapq2 if both columns are present, 255 otherwise
+// the stream is read to the end but not closed
+static void dump_links_from_pairs(kstream_t *ks, const char *fai, uint32_t ml, const char *out, int bin_version, int n_threads)
+{
+    pairs_link_pipeline_t pl;
+    pairs_link_batch_t *batch;
+    khint_t k;
+
+    memset(&pl, 0, sizeof(pairs_link_pipeline_t));
+    pl.ks = ks;
+    pl.n_threads = n_threads;
+    pl.col[0] = 1;
+    pl.col[1] = 2;
+    pl.col[2] = 3;
+    pl.col[3] = 4;
+    pl.col[4] = pl.col[5] = -1;
+    pl.n_col = 5;
+    pl.hmseq = kh_init(str);
+    pl.dict = make_sdict_from_index(fai, ml);
+
+    pl.fo = bin_writer_open(out, bin_version);
+    if (pl.fo == NULL)
+        exit(EXIT_FAILURE);
+    bin_file_rec_init(pl.dict->n);
+
+    pthread_mutex_init(&pl.lock, 0);
+    kt_pipeline(n_threads > 1? 3 : 1, pairs_link_pipeline, &pl, 3);
+    pthread_mutex_destroy(&pl.lock);
+    while ((batch = pl.free_batch) != 0) {
+        pl.free_batch = batch->next;
+        pairs_link_batch_destroy(batch);
+    }
+
+    for (k = 0; k < kh_end(pl.hmseq); ++k)
+        if (kh_exist(pl.hmseq, k))
+            free((char *) kh_key(pl.hmseq, k));
+    kh_destroy(str, pl.hmseq);
+
+    free(pl.line.s);
+    sd_destroy(pl.dict);
+    if (bin_writer_close(pl.fo)) {
+        fprintf(stderr, "[E::%s] failed to write file %s\n", __func__, out);
+        exit(EXIT_FAILURE);
+    }
+    bin_file_rec_done(out, 0);
+
+    fprintf(stderr, "[I::%s] dumped %ld read pairs from %ld records: %ld intra links + %ld inter links \n", __func__, pl.pair_c, pl.rec_c, pl.intra_c, pl.inter_c);
+}
+
+void dump_links_from_pairs_file(const char *f, const char *fai, uint32_t ml, const char *out, int bin_version, int n_threads)
+{
+    gzFile fp;
+    kstream_t *ks;
+    void *ko;
+    int fd;
+
+    ko = kopen(f, &fd);
+    if (ko == 0) {
+        fprintf(stderr, "[E::%s] cannot open file %s for reading\n", __func__, f);
+        exit(EXIT_FAILURE);
+    }
+    fp = gzdopen(fd, "r");
+    ks = ks_init(fp);
+    dump_links_from_pairs(ks, fai, ml, out, bin_version, n_threads);
+    ks_destroy(ks);
+    gzclose(fp);
+    kclose(ko);
+}
+
+// detect the link format from the first bytes of a stream, the bytes read are pushed back
+// compressed streams are detected by their content
+static int link_stream_format(gzFile fp)
+{
+    unsigned char buf[16];
+    int i, n, fmt;
+    int64_t magic_number;
+
+    n = gzread(fp, buf, sizeof(buf));
+    if (n < 0)
+        return LINK_FMT_UNKNOWN;
+    if (n >= 8)
+        memcpy(&magic_number, buf, sizeof(int64_t));
+    if (n >= 8 && bin_header_version(magic_number))
+        fmt = LINK_FMT_BIN;
+    else if (n >= 4 && memcmp(buf, "BAM\001", 4) == 0)
+        fmt = LINK_FMT_BAM;
+    else if (n >= 15 && memcmp(buf, "## pairs format", 15) == 0)
+        fmt = LINK_FMT_PAIRS;
+    else
+        fmt = LINK_FMT_BED;
+    for (i = n - 1; i >= 0; --i) {
+        if (gzungetc(buf[i], fp) < 0)
+            return LINK_FMT_UNKNOWN;
+    }
+    return fmt;
+}
+
+int link_file_format(const char *f)
+{
+    gzFile fp;
+    int fmt;
+
+    fp = gzopen(f, "r");
+    if (fp == NULL)
+        return LINK_FMT_UNKNOWN;
+    fmt = link_stream_format(fp);
+    gzclose(fp);
+    return fmt;
+}
+
+// dump links from a stream of any format to a BIN file in a single pass, BIN streams are copied
+// return the format of the stream
+int dump_links_from_stream(const char *f, const char *fai, uint32_t ml, const char *out, int bin_version, int n_threads)
+{
+    gzFile fp;
+    kstream_t *ks;
+    FILE *fo;
+    void *ko;
+    int fd, fmt, n;
+    char buf[0x10000];
+
+    ko = kopen(f, &fd);
+    if (ko == 0) {
+        fprintf(stderr, "[E::%s] cannot open file %s for reading\n", __func__, f);
+        exit(EXIT_FAILURE);
+    }
+    fp = gzdopen(fd, "r");
+    fmt = link_stream_format(fp);
+    if (fmt == LINK_FMT_BAM) {
+        fprintf(stderr, "[I::%s] read hic links (BAM) from stream %s\n", __func__, f);
+        // closed with the BAM file
+        dump_links_from_bam(bam_dopen(fp), fai, ml, 0, out, bin_version, n_threads);
+        fp = 0;
+    } else if (fmt == LINK_FMT_BED || fmt == LINK_FMT_PAIRS) {
+        fprintf(stderr, "[I::%s] read hic links (%s) from stream %s\n", __func__, fmt == LINK_FMT_BED? "BED" : "PAIRS", f);
+        ks = ks_init(fp);
+        if (fmt == LINK_FMT_BED)
+            dump_links_from_bed(ks, fai, ml, 0, out, bin_version);
+        else
+            dump_links_from_pairs(ks, fai, ml, out, bin_version, n_threads);
+        ks_destroy(ks);
+    } else if (fmt == LINK_FMT_BIN) {
+        fprintf(stderr, "[I::%s] copy hic links (BIN) from stream %s\n", __func__, f);
+        bin_idx_remove(out);
+        fo = fopen(out, "wb");
+        if (fo == NULL) {
+            fprintf(stderr, "[E::%s] cannot open file %s for writing\n", __func__, out);
+            exit(EXIT_FAILURE);
+        }
+        while ((n = gzread(fp, buf, sizeof(buf))) > 0)
+            fwrite(buf, 1, n, fo);
+        if (n < 0 || fclose(fo)) {
+            fprintf(stderr, "[E::%s] failed to write file %s\n", __func__, out);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        fprintf(stderr, "[E::%s] cannot read file %s\n", __func__, f);
+        exit(EXIT_FAILURE);
+    }
+    if (fp)
+        gzclose(fp);
+    kclose(ko);
+
+    return fmt;
+}
+
@@ -33,16 +33,25 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#include "khash.h"
 #include "sdict.h"
 #include "enzyme.h"
 
 #define SQRT2 1.41421356237
 #define SQRT2_2 .70710678118
 
+KHASH_MAP_INIT_INT64(inter_link, uint32_t)
+
+// link cells only hold link counts
+// the relative area of a cell adjusted by restriction site density is derived from its bins
+// and link counts are normalised by cell areas when they are read (see link_norm in link.c)
 typedef struct {
     uint32_t c;
-    uint32_t n;
-    double *link;
+    uint32_t n; // number of bins
+    uint32_t r; // number of bands stored MIN(n, intra_link_mat_t.r)
+    double a; // relative size of the last bin
+    double *re; // restriction site density of each bin, NULL if not used
+    uint32_t *link; // link counts of the first r bands, band by band [(n * 2 - r + 1) * r / 2]
 } intra_link_t;
 
 typedef struct {
@@ -55,23 +64,56 @@ typedef struct {
     // link[1]: i0(-) -> i1(-)
     // link[2]: i0(+) -> i1(+)
     // link[3]: i0(+) -> i1(-)
-    double *link[4]; // size 4 x n
+    uint32_t *link[4]; // link counts, size 4 x n
     double *linkb[4]; // total number of links in each band, of size 4 x r
     double norms[4];
 } inter_link_t;
 
+// only the first r bands of intra links are stored as only these are used for norms
+// links in the other bands are only added to the total link count
+// under a RAM limit only the intra links of a sample of sequences are stored (r = 0 for the others)
+// and links of the other sequences in the first r bands are only added to the link count of each band
 typedef struct {
     uint32_t n;
+    uint32_t r; // maximum number of bands stored
     intra_link_t *links;
+    uint32_t *cells; // link counts of all intra links in one block
+    uint64_t far_c; // normalised links in bands not stored, in fixed point
+    uint64_t far_x; // cells in bands not stored too small to normalise
+    uint64_t *band_c; // normalised links of the sequences not sampled in each band [0, r), in fixed point, NULL if all stored
+    uint64_t *band_x; // cells of the sequences not sampled in each band [0, r) too small to normalise
 } intra_link_mat_t;
 
+// inter links are only stored for sequence pairs receiving links within the radius
+// cells of the other pairs hold no links and are accounted for by their areas
 typedef struct {
-    uint32_t n;
+    uint32_t n, m; // number of sequence pairs stored
     uint32_t r; // radius
     double noise; // noise
-    inter_link_t *links;
+    inter_link_t *links; // sorted by (c0, c1) once collected
+    khash_t(inter_link) *h; // c0 << 32 | c1 -> index in links
+    uint32_t s; // number of sequences
+    uint32_t *b; // number of bins of each sequence MIN(r, div_ceil(len, 2 * resolution)), 0 for short sequences
+    double *a; // relative size of the last bin of each sequence
+    double **re_dens; // restriction site density of each bin, NULL if not used
 } inter_link_mat_t;
 
+// link file formats detected from the file content
+enum link_format {
+    LINK_FMT_UNKNOWN = 0,
+    LINK_FMT_BIN,
+    LINK_FMT_BAM,
+    LINK_FMT_BED,
+    LINK_FMT_PAIRS
+};
+
+// link directions of sequence pairs with links
+typedef struct {
+    uint64_t n;
+    uint64_t *a; // sorted c0 << 32 | c1
+    int8_t *d; // link direction 0...3, -1 if undetermined
+} link_directs_t;
+
 typedef struct {
     uint32_t n; // number of bands
     uint32_t *bs; // number of cells in each band [1 x n]
@@ -81,19 +123,85 @@ typedef struct {
     uint32_t r; // number of first r bands contains at least 90% links adjusted by norms
 } norm_t;
 
+// raw inter link counts collected at an upper bound radius
+// cells are indexed by the exact bin pair (b0, b1) so that links can be rebinned to any radius <= r
+// counts of sequence pairs not changed since one of the last two rounds are summed from the raw counts of that round
+// if the resolution is an integer multiple of the one of that round (see inter_link_raw_lift)
+typedef struct {
+    uint32_t n; // number of sequences
+    uint32_t r; // radius
+    uint32_t resolution;
+    uint32_t *b; // number of bins of each sequence MIN(r, div_ceil(len, 2 * resolution)), 0 for short sequences
+    uint32_t np, mp; // number of sequence pairs with links
+    uint64_t *pair; // c0 << 32 | c1 of each pair
+    uint32_t **cnt; // link counts of each pair [4 x b0 x b1]
+    khash_t(inter_link) *h; // c0 << 32 | c1 -> index in pair
+    long inter_c, radius_c;
+    uint32_t k; // resolution over the resolution of the round counts are lifted from, 0 if not lifted
+    uint32_t r0; // radius of the round counts are lifted from
+    uint32_t *f; // number of bins of that round needed for each sequence, 0 if the sequence is changed
+} inter_link_raw_t;
+
+// a link pair in contig coordinates (c, x) and converted to assembly coordinates (i, p)
+typedef struct {
+    uint32_t c0, x0, c1, x1;
+    uint32_t i0, i1;
+    uint64_t p0, p1;
+} link_pair_t;
+
+// tid is the index of the calling scan thread, 0 <= tid < n_threads, for per-thread scratch space
+typedef void (*link_acc_f)(void *data, link_pair_t *pairs, uint32_t n, int tid);
+
+typedef struct {
+    link_acc_f add;
+    void (*free)(void *data);
+    void *data;
+} link_acc_t;
+
+// link scan engine: read each BIN record once and dispatch it to all registered accumulators
+typedef struct {
+    asm_dict_t *dict;
+    uint8_t mq;
+    int n_threads; // accumulators are called concurrently if n_threads > 1
+    int intra_only; // accumulators only use links within scaffolds, records of other contig pairs are skipped if the file is indexed
+    int (*keep)(uint32_t c0, uint32_t c1, void *data); // contig pairs used by accumulators, records of other pairs are skipped if the file is indexed
+    void *keep_data;
+    uint32_t n, m; // number of accumulators
+    link_acc_t *acc;
+    long pair_c, link_c; // read pairs processed and passed the mapping quality filter
+} link_scan_t;
+
 #ifdef __cplusplus 
 extern "C" {
 #endif
 
-intra_link_mat_t *intra_link_mat_init(asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution);
-intra_link_mat_t *intra_link_mat_init_sdict(sdict_t *dict, re_cuts_t *re_cuts, uint32_t resolution);
+intra_link_mat_t *intra_link_mat_init(asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, long rss_limit);
+intra_link_mat_t *intra_link_mat_init_sdict(sdict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, long rss_limit);
 inter_link_mat_t *inter_link_mat_init(asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, uint32_t radius);
 intra_link_mat_t *intra_link_mat_from_file(const char *f, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, int use_gap_seq, uint8_t mq);
-inter_link_mat_t *inter_link_mat_from_file(const char *f, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, uint32_t radius, uint8_t mq);
+intra_link_mat_t *intra_link_mat_from_file_raw(const char *f, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, int use_gap_seq, uint8_t mq, inter_link_raw_t *inter_raw, long rss_limit, int n_threads);
+inter_link_mat_t *inter_link_mat_from_file(const char *f, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t resolution, uint32_t radius, uint8_t mq, int n_threads);
+inter_link_raw_t *inter_link_raw_init(asm_dict_t *dict, uint32_t resolution, uint32_t radius);
+void inter_link_raw_destroy(inter_link_raw_t *raw);
+void inter_link_raw_keep(inter_link_raw_t *raw, asm_dict_t *dict);
+long inter_link_raw_kept_rss(void);
+void inter_link_raw_lift(inter_link_raw_t *raw, asm_dict_t *dict);
+void inter_link_raw_clear(void);
+inter_link_mat_t *inter_link_mat_from_raw(inter_link_raw_t *raw, asm_dict_t *dict, re_cuts_t *re_cuts, uint32_t radius);
+uint32_t estimate_max_radius(asm_dict_t *dict, uint32_t resolution);
+long estimate_inter_link_raw_rss(const char *f, asm_dict_t *dict, uint32_t resolution, uint32_t radius, uint8_t mq);
+void bin_file_rec_clear(void);
+link_scan_t *link_scan_init(asm_dict_t *dict, uint8_t mq, int n_threads);
+void link_scan_add(link_scan_t *scan, link_acc_f add, void (*free)(void *), void *data);
+int link_scan_file(link_scan_t *scan, const char *f);
+void link_scan_destroy(link_scan_t *scan);
+void link_scan_add_intra_link_mat(link_scan_t *scan, intra_link_mat_t *link_mat, uint32_t resolution, int use_gap_seq);
+void link_scan_add_inter_link_mat(link_scan_t *scan, inter_link_mat_t *link_mat, uint32_t resolution);
+void link_scan_add_inter_link_raw(link_scan_t *scan, inter_link_raw_t *raw);
 intra_link_t *get_intra_link(intra_link_mat_t *link_mat, uint32_t i, uint32_t j);
 inter_link_t *get_inter_link(inter_link_mat_t *link_mat, uint32_t i, uint32_t j);
 norm_t *calc_norms(intra_link_mat_t *link_mat);
-void inter_link_norms(inter_link_mat_t *link_mat, norm_t *norm, int use_estimated_noise, double *la);
+void inter_link_norms(inter_link_mat_t *link_mat, norm_t *norm, int use_estimated_noise, double *la, int n_threads);
 void inter_link_weighted_norms(inter_link_mat_t *link_mat, norm_t *norm);
 void print_norms(FILE *fp, norm_t *norm);
 void print_intra_links(FILE *fp, intra_link_mat_t *link_mat, sdict_t *dict);
@@ -104,11 +212,16 @@ void intra_link_mat_destroy(intra_link_mat_t *link_mat);
 void inter_link_mat_destroy(inter_link_mat_t *link_mat);
 void norm_destroy(norm_t *norm);
 double *get_max_inter_norms(inter_link_mat_t *link_mat, asm_dict_t *dict);
-int8_t *calc_link_directs_from_file(const char *f, asm_dict_t *dict, uint8_t mq);
-void calc_link_directs(inter_link_mat_t *link_mat, double min_norm, asm_dict_t *dict, int8_t *directs);
-void dump_links_from_bam_file(const char *f, const char *fai, uint32_t ml, uint8_t mq, const char *out);
-void dump_links_from_bed_file(const char *f, const char *fai, uint32_t ml, uint8_t mq, const char *out);
-long estimate_inter_link_mat_init_rss(asm_dict_t *dict, uint32_t resolution, uint32_t radius);
+link_directs_t *calc_link_directs_from_file(const char *f, asm_dict_t *dict, uint8_t mq);
+int8_t get_link_direct(link_directs_t *directs, uint32_t i, uint32_t j);
+void link_directs_destroy(link_directs_t *directs);
+void calc_link_directs(inter_link_mat_t *link_mat, double min_norm, asm_dict_t *dict, link_directs_t *directs, int n_threads);
+void dump_links_from_bam_file(const char *f, const char *fai, uint32_t ml, uint8_t mq, const char *out, int bin_version, int n_threads);
+void dump_links_from_bed_file(const char *f, const char *fai, uint32_t ml, uint8_t mq, const char *out, int bin_version);
+void dump_links_from_pairs_file(const char *f, const char *fai, uint32_t ml, const char *out, int bin_version, int n_threads);
+int link_file_format(const char *f);
+int dump_links_from_stream(const char *f, const char *fai, uint32_t ml, const char *out, int bin_version, int n_threads);
+long estimate_inter_link_mat_init_rss(const char *f, asm_dict_t *dict, uint32_t resolution, uint32_t radius, uint8_t mq);
 long estimate_intra_link_mat_init_rss(asm_dict_t *dict, uint32_t resolution);
 long estimate_intra_link_mat_init_sdict_rss(sdict_t *dict, uint32_t resolution);
 #ifdef __cplusplus
@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <zlib.h>
+#include <sys/stat.h>
 
 #include "khash.h"
 #include "asset.h"
@@ -67,6 +68,7 @@ asm_dict_t *asm_init(sdict_t *sdict)
     d->v = 16;
     d->seg = (sd_seg_t *) malloc(d->v * sizeof(sd_seg_t));
     d->a = (uint32_t *) malloc(sdict->n * sizeof(uint32_t));
+    d->na = (uint32_t *) calloc(sdict->n, sizeof(uint32_t));
     d->index = 0;
     d->sdict = sdict;
     return d;
@@ -104,6 +106,8 @@ void asm_destroy(asm_dict_t *d)
         free(d->seg);
     if (d->a)
         free(d->a);
+    if (d->na)
+        free(d->na);
     if (d->index)
         free(d->index);
     if (d->h)
@@ -317,6 +321,7 @@ asm_dict_t *make_asm_dict_from_sdict(sdict_t *sdict)
         asm_put(d, sdict->s[i].name, sdict->s[i].len, 1, i);
         seg_put(d, i, 0, 0, i<<1, 0, sdict->s[i].len);
         a[i] = i;
+        d->na[i] = 1;
         d->index[i] = (uint64_t) sdict->s[i].len << 32 | i;
     }
     return d;
@@ -354,6 +359,7 @@ void asm_index(asm_dict_t *d)
         free(d->index);
     d->index = (uint64_t *) malloc(s * sizeof(uint64_t));
     a = d->a;
+    memset(d->na, 0, d->sdict->n * sizeof(uint32_t));
     c1 = INT32_MAX;
     for (i = 0; i < s; ++i) {
         d->index[i] = c_pairs[i].y;
@@ -362,11 +368,114 @@ void asm_index(asm_dict_t *d)
             a[c] = i;
             c1 = c;
         }
+        ++d->na[c];
     }
 
     free(c_pairs);
 }
 
+// assembly dictionaries of the AGP files written in this run
+// a file is not parsed again if it has not changed since it was written
+#define ASM_AGP_CACHE_SIZE 4
+
+typedef struct {
+    char *f;
+    off_t size;
+    struct timespec mtime;
+    uint32_t sn; // number of sequences in the sequence dictionary
+    uint32_t *slen; // sequence lengths
+    asm_dict_t *d;
+} asm_agp_t;
+
+static asm_agp_t asm_agp_cache[ASM_AGP_CACHE_SIZE];
+
+static void asm_agp_free(asm_agp_t *e)
+{
+    free(e->f);
+    free(e->slen);
+    asm_destroy(e->d);
+    memset(e, 0, sizeof(asm_agp_t));
+}
+
+// keep the assembly dictionary d of AGP file f which has just been written
+// the dictionary is owned by the cache afterwards
+void asm_agp_put(const char *f, asm_dict_t *d)
+{
+    uint32_t i;
+    struct stat st;
+    asm_agp_t *e;
+
+    for (i = 0; i < ASM_AGP_CACHE_SIZE; ++i)
+        if (asm_agp_cache[i].f && strcmp(asm_agp_cache[i].f, f) == 0)
+            asm_agp_free(&asm_agp_cache[i]);
+    if (stat(f, &st)) {
+        asm_destroy(d);
+        return;
+    }
+    // the oldest entry is dropped
+    if (asm_agp_cache[ASM_AGP_CACHE_SIZE - 1].f)
+        asm_agp_free(&asm_agp_cache[ASM_AGP_CACHE_SIZE - 1]);
+    memmove(asm_agp_cache + 1, asm_agp_cache, (ASM_AGP_CACHE_SIZE - 1) * sizeof(asm_agp_t));
+    e = &asm_agp_cache[0];
+    e->f = strdup(f);
+    e->size = st.st_size;
+    e->mtime = st.st_mtim;
+    e->sn = d->sdict->n;
+    e->slen = (uint32_t *) malloc(MAX(1, e->sn) * sizeof(uint32_t));
+    for (i = 0; i < e->sn; ++i)
+        e->slen[i] = d->sdict->s[i].len;
+    // the sequence dictionary may be freed by its owner
+    d->sdict = 0;
+    e->d = d;
+}
+
+void asm_agp_clear(void)
+{
+    uint32_t i;
+    for (i = 0; i < ASM_AGP_CACHE_SIZE; ++i)
+        if (asm_agp_cache[i].f)
+            asm_agp_free(&asm_agp_cache[i]);
+}
+
+// a copy of the cached assembly dictionary of AGP file f on sequence dictionary sdict
+// return NULL if f is not cached, has changed or was made on another sequence dictionary
+static asm_dict_t *asm_agp_get(sdict_t *sdict, const char *f)
+{
+    uint32_t i, n;
+    struct stat st;
+    asm_agp_t *e;
+    asm_dict_t *d, *d0;
+
+    for (i = 0; i < ASM_AGP_CACHE_SIZE; ++i)
+        if (asm_agp_cache[i].f && strcmp(asm_agp_cache[i].f, f) == 0)
+            break;
+    if (i == ASM_AGP_CACHE_SIZE || stat(f, &st))
+        return 0;
+    e = &asm_agp_cache[i];
+    if (e->size != st.st_size || e->mtime.tv_sec != st.st_mtim.tv_sec || e->mtime.tv_nsec != st.st_mtim.tv_nsec ||
+            e->sn != sdict->n)
+        return 0;
+    for (i = 0; i < e->sn; ++i)
+        if (e->slen[i] != sdict->s[i].len)
+            return 0;
+
+    d0 = e->d;
+    d = asm_init(sdict);
+    for (i = 0; i < d0->n; ++i)
+        asm_put(d, d0->s[i].name, d0->s[i].len, d0->s[i].n, d0->s[i].s);
+    d->u = d->v = d0->u;
+    d->seg = (sd_seg_t *) realloc(d->seg, MAX(1, d->v) * sizeof(sd_seg_t));
+    memcpy(d->seg, d0->seg, d0->u * sizeof(sd_seg_t));
+    memcpy(d->a, d0->a, sdict->n * sizeof(uint32_t));
+    memcpy(d->na, d0->na, sdict->n * sizeof(uint32_t));
+    for (i = n = 0; i < d0->n; ++i)
+        n += d0->s[i].n;
+    d->index = (uint64_t *) malloc(MAX(1, n) * sizeof(uint64_t));
+    memcpy(d->index, d0->index, n * sizeof(uint64_t));
+
+    return d;
+}
+
 asm_dict_t *make_asm_dict_from_agp(sdict_t *sdict, const char *f)
 {
     FILE *fp;
@@ -378,6 +487,12 @@ asm_dict_t *make_asm_dict_from_agp(sdict_t *sdict, const char *f)
     uint64_t a;
     uint32_t l, cstart, cend;
     uint32_t c, s, n;
+    asm_dict_t *d;
+
+    // AGP files written in this run are not parsed again
+    d = asm_agp_get(sdict, f);
+    if (d)
+        return d;
 
     fp = fopen(f, "r");
     if (fp == NULL) {
@@ -385,7 +500,6 @@ asm_dict_t *make_asm_dict_from_agp(sdict_t *sdict, const char *f)
         exit(EXIT_FAILURE);
     }
 
-    asm_dict_t *d;
     d = asm_init(sdict);
     a = 0;
     s = n = 0;
@@ -454,25 +568,148 @@ void add_unplaced_short_seqs(asm_dict_t *d, uint32_t min_len)
 
 /* contig coordinates to scaffold coordinates */
 // one-based
+// segment of a sub sequence containing a position
+// the first segment ending at or after pos by a branchless binary search over the segment ends
+// a single segment sub sequence needs no search
+static inline sd_seg_t *sd_seg_lookup(asm_dict_t *d, uint32_t id, uint32_t pos)
+{
+    uint32_t n, h;
+    uint64_t *index;
+
+    index = d->index + d->a[id];
+    n = d->na[id];
+    while (n > 1) {
+        h = n >> 1;
+        index += (index[h - 1] >> 32 < pos) * h;
+        n -= h;
+    }
+    // positions beyond the sub sequence end move on as the linear walk did
+    while (*index >> 32 < pos)
+        ++index;
+    return &d->seg[(uint32_t) *index];
+}
+
 int sd_coordinate_conversion(asm_dict_t *d, uint32_t id, uint32_t pos, uint32_t *s, uint64_t *p, int count_gap)
 {
     if (id == UINT32_MAX) {
         *s = UINT32_MAX;
         return 1;
     }
-    uint32_t i;
-    uint64_t *index = d->index;
-    i = d->a[id];
-    while (index[i]>>32 < pos) 
-        ++i;
-    sd_seg_t seg = d->seg[(uint32_t) index[i]];
-    *s = seg.s;
-    *p = seg.c & 1? seg.a + seg.x + seg.y - pos + 1 : seg.a + pos - seg.x;
+    sd_seg_t *seg = sd_seg_lookup(d, id, pos);
+    *s = seg->s;
+    *p = seg->c & 1? seg->a + seg->x + seg->y - pos + 1 : seg->a + pos - seg->x;
     if (count_gap)
-        *p = *p + seg.k * GAP_SZ;
+        *p = *p + seg->k * GAP_SZ;
     return 0;
 }
 
+// convert n contig positions (id[i], pos[i]) to scaffold positions (s[i], p[i])
+// s[i] is UINT32_MAX if id[i] is UINT32_MAX
+void sd_coordinate_conversion_batch(asm_dict_t *d, uint32_t n, const uint32_t *id, const uint32_t *pos, uint32_t *s, uint64_t *p, int count_gap)
+{
+    uint32_t i;
+    uint64_t gap;
+    sd_seg_t *seg;
+
+    gap = count_gap? GAP_SZ : 0;
+    for (i = 0; i < n; ++i) {
+        if (id[i] == UINT32_MAX) {
+            s[i] = UINT32_MAX;
+            continue;
+        }
+        seg = sd_seg_lookup(d, id[i], pos[i]);
+        s[i] = seg->s;
+        p[i] = (seg->c & 1? seg->a + seg->x + seg->y - pos[i] + 1 : seg->a + pos[i] - seg->x) + seg->k * gap;
+    }
+}
+
+// append a segment to the scaffold being built, the one after the last scaffold put
+void asm_put_seg(asm_dict_t *d, uint32_t c, uint32_t x, uint32_t y)
+{
+    uint32_t s, k;
+    s = d->n? d->s[d->n - 1].s + d->s[d->n - 1].n : 0;
+    k = d->u - s;
+    seg_put(d, d->n, k, k? d->seg[d->u - 1].a + d->seg[d->u - 1].y : 0, c, x, y);
+}
+
+// finish the scaffold of the segments appended since the last scaffold
+// the dictionary is the same as read from an AGP file of the scaffolds
+uint32_t asm_put_scaf(asm_dict_t *d, const char *name)
+{
+    uint32_t s, n;
+    s = d->n? d->s[d->n - 1].s + d->s[d->n - 1].n : 0;
+    n = d->u - s;
+    return asm_put(d, name, n? d->seg[d->u - 1].a + d->seg[d->u - 1].y : 0, n, s);
+}
+
+// index an assembly dictionary made of pieces of the segments of d0
+// pieces are bucketed by the position of their source segment in the index of d0
+// and ordered by their start within a bucket, so no sort is needed
+// fall back to asm_index if a piece is not within a segment of d0
+void asm_index_lift(asm_dict_t *d, asm_dict_t *d0)
+{
+    uint32_t i, j, k, n, n0, c, x;
+    uint32_t *rank, *bucket, *cnt, *order;
+    sd_seg_t *seg;
+
+    for (i = n0 = 0; i < d0->n; ++i)
+        n0 += d0->s[i].n;
+    for (i = n = 0; i < d->n; ++i)
+        n += d->s[i].n;
+    rank = (uint32_t *) malloc(MAX(1, d0->u) * sizeof(uint32_t));
+    for (i = 0; i < n0; ++i)
+        rank[(uint32_t) d0->index[i]] = i;
+    bucket = (uint32_t *) malloc(MAX(1, n) * sizeof(uint32_t));
+    cnt = (uint32_t *) calloc(n0 + 1, sizeof(uint32_t));
+    for (i = 0; i < n; ++i) {
+        c = d->seg[i].c >> 1;
+        x = d->seg[i].x;
+        if (c >= d0->sdict->n || d0->na[c] == 0)
+            break;
+        seg = sd_seg_lookup(d0, c, x + 1);
+        if (seg->c >> 1 != c || x < seg->x || x + d->seg[i].y > seg->x + seg->y)
+            break;
+        bucket[i] = rank[seg - d0->seg];
+        ++cnt[bucket[i] + 1];
+    }
+    if (i < n) {
+        free(rank);
+        free(bucket);
+        free(cnt);
+        asm_index(d);
+        return;
+    }
+    for (i = 0; i < n0; ++i)
+        cnt[i + 1] += cnt[i];
+    order = (uint32_t *) malloc(MAX(1, n) * sizeof(uint32_t));
+    for (i = 0; i < n; ++i)
+        order[cnt[bucket[i]]++] = i;
+    // pieces of a segment are few, insertion sort by start within each bucket
+    for (i = 1; i < n; ++i) {
+        j = order[i];
+        for (k = i; k > 0 && bucket[order[k - 1]] == bucket[j] && d->seg[order[k - 1]].x > d->seg[j].x; --k)
+            order[k] = order[k - 1];
+        order[k] = j;
+    }
+
+    if (d->index)
+        free(d->index);
+    d->index = (uint64_t *) malloc(MAX(1, n) * sizeof(uint64_t));
+    memset(d->na, 0, d->sdict->n * sizeof(uint32_t));
+    for (i = 0; i < n; ++i) {
+        seg = &d->seg[order[i]];
+        d->index[i] = (uint64_t) (seg->x + seg->y) << 32 | order[i];
+        c = seg->c >> 1;
+        if (d->na[c]++ == 0)
+            d->a[c] = i;
+    }
+
+    free(rank);
+    free(bucket);
+    free(cnt);
+    free(order);
+}
+
 /* scaffold coordinates to contig coordinates */
 // one-based
 int sd_coordinate_rev_conversion(asm_dict_t *d, uint32_t id, uint64_t pos, uint32_t *s, uint32_t *p, int count_gap)
@@ -76,6 +76,7 @@ typedef struct {
     uint32_t u, v; // u: seg number, v: seg memory allocated
     sd_seg_t *seg; // segments
     uint32_t *a; // sub sequence index map: id -> start pos, need this to deal with sub seq breaks
+    uint32_t *na; // number of segments of each sub sequence in index
     uint64_t *index; // sub seq end << 32 | seg index, used to find the seg index given a sub seq position
     sdict_t *sdict; // sub sequence dictionary
 } asm_dict_t;
@@ -97,10 +98,16 @@ sdict_t *make_sdict_from_gfa(const char *f, uint32_t min_len);
 asm_dict_t *make_asm_dict_from_sdict(sdict_t *sdict);
 uint32_t asm_put(asm_dict_t *d, const char *name, uint64_t len, uint32_t n, uint32_t s);
 asm_dict_t *make_asm_dict_from_agp(sdict_t *sdict, const char *f);
+void asm_agp_put(const char *f, asm_dict_t *d);
+void asm_agp_clear(void);
+void asm_put_seg(asm_dict_t *d, uint32_t c, uint32_t x, uint32_t y);
+uint32_t asm_put_scaf(asm_dict_t *d, const char *name);
+void asm_index_lift(asm_dict_t *d, asm_dict_t *d0);
 void add_unplaced_short_seqs(asm_dict_t *d, uint32_t min_len);
 char *get_asm_seq(asm_dict_t *d, char *name);
 uint32_t asm_sd_get(asm_dict_t *d, const char *name);
 int sd_coordinate_conversion(asm_dict_t *d, uint32_t id, uint32_t pos, uint32_t *s, uint64_t *p, int count_gap);
+void sd_coordinate_conversion_batch(asm_dict_t *d, uint32_t n, const uint32_t *id, const uint32_t *pos, uint32_t *s, uint64_t *p, int count_gap);
 int sd_coordinate_rev_conversion(asm_dict_t *d, uint32_t id, uint64_t pos, uint32_t *s, uint32_t *p, int count_gap);
 void sd_stats(sdict_t *d, uint64_t *n_stats, uint32_t *l_stats);
 void asm_sd_stats(asm_dict_t *d, uint64_t *n_stats, uint32_t *l_stats);
@@ -0,0 +1,141 @@
+// tests of counting the valid cells of all sequence pairs in the inter link matrix
+// the counts must be exactly the cells valid in inter_link_empty_cells summed over all sequence pairs,
+// with and without restriction site densities and norms, including densities at the threshold,
+// relative sizes of the last bin reaching .5 only as a product, and bands without norms
+// usage: test/area_test
+
+// the counts are static
+#include "../link.c"
+
+static uint64_t rs = 0x853C49E6748FEA9BULL;
+static uint32_t rnd(void)
+{
+    rs ^= rs << 13;
+    rs ^= rs >> 7;
+    rs ^= rs << 17;
+    return (uint32_t) (rs >> 16);
+}
+
+// values of a few levels so that many products are equal or at the thresholds
+static double rnd_level(const double *v, uint32_t n)
+{
+    return rnd() % 2? v[rnd() % n] : (double) (rnd() % 1000 + 1) / 1000;
+}
+
+static inter_link_mat_t *mat_gen(uint32_t s, uint32_t r, int re)
+{
+    static const double as[] = {.5, .6, .7, SQRT2_2, .8, 1.};
+    static const double ds[] = {.0, .1, .2, .25, .3, .5, 1., 2.};
+    uint32_t i, x;
+    inter_link_mat_t *link_mat;
+
+    link_mat = (inter_link_mat_t *) calloc(1, sizeof(inter_link_mat_t));
+    link_mat->s = s;
+    link_mat->r = r;
+    link_mat->b = (uint32_t *) calloc(s, sizeof(uint32_t));
+    link_mat->a = (double *) calloc(s, sizeof(double));
+    if (re)
+        link_mat->re_dens = (double **) calloc(s, sizeof(double *));
+    for (i = 0; i < s; ++i) {
+        link_mat->b[i] = rnd() % 8 == 0? 0 : rnd() % r + 1;
+        link_mat->a[i] = link_mat->b[i]? rnd_level(as, sizeof(as) / sizeof(as[0])) : .0;
+        if (re) {
+            link_mat->re_dens[i] = (double *) calloc(MAX(1, link_mat->b[i]), sizeof(double));
+            for (x = 0; x < link_mat->b[i]; ++x)
+                link_mat->re_dens[i][x] = rnd_level(ds, sizeof(ds) / sizeof(ds[0]));
+        }
+    }
+    return link_mat;
+}
+
+static void mat_destroy(inter_link_mat_t *link_mat)
+{
+    uint32_t i;
+
+    if (link_mat->re_dens) {
+        for (i = 0; i < link_mat->s; ++i)
+            free(link_mat->re_dens[i]);
+        free(link_mat->re_dens);
+    }
+    free(link_mat->b);
+    free(link_mat->a);
+    free(link_mat);
+}
+
+// all sequence pairs enumerated
+static uint64_t area_enum(inter_link_mat_t *link_mat, double *norms)
+{
+    uint32_t i, j, c, n0;
+    uint64_t a;
+
+    a = 0;
+    for (i = 0; i < link_mat->s; ++i) {
+        if (link_mat->b[i] == 0)
+            continue;
+        for (j = i + 1; j < link_mat->s; ++j) {
+            if (link_mat->b[j] == 0)
+                continue;
+            c = inter_link_empty_cells(link_mat, i, j, norms, &n0);
+            if (!norms || n0 > 0)
+                a += c;
+        }
+    }
+    return a;
+}
+
+int main(void)
+{
+    static const uint32_t ss[] = {0, 1, 2, 3, 10, 50, 300};
+    static const uint32_t radii[] = {1, 2, 5, 12};
+    uint32_t i, j, k, b;
+    int re, t;
+    uint64_t a0, a1;
+    double *norms;
+    inter_link_mat_t *link_mat;
+
+    for (i = 0; i < sizeof(ss) / sizeof(ss[0]); ++i) {
+        for (j = 0; j < sizeof(radii) / sizeof(radii[0]); ++j) {
+            for (re = 0; re < 2; ++re) {
+                link_mat = mat_gen(ss[i], radii[j], re);
+                norms = (double *) malloc((radii[j] + 1) * sizeof(double));
+                // no norms, all norms, some bands without norms, and band 0 without norms
+                for (t = 0; t < 4; ++t) {
+                    for (b = 0; b <= radii[j]; ++b)
+                        norms[b] = t == 1 || (t == 2 && rnd() % 3)? 1. : .0;
+                    if (t == 2)
+                        norms[1] = 1.;
+                    if (t == 3)
+                        for (b = 2; b <= radii[j]; ++b)
+                            norms[b] = 1.;
+                    a0 = area_enum(link_mat, t? norms : 0);
+                    a1 = re? inter_link_area_re(link_mat, t? norms : 0) : inter_link_area(link_mat, t? norms : 0);
+                    if (a0 != a1) {
+                        printf("FAIL: area %u sequences, radius %u, %s, norms %d: %lu counted, %lu enumerated\n",
+                                ss[i], radii[j], re? "densities" : "no densities", t, a1, a0);
+                        return 1;
+                    }
+                }
+                free(norms);
+                mat_destroy(link_mat);
+            }
+        }
+    }
+    // repeated random matrices
+    for (k = 0; k < 200; ++k) {
+        link_mat = mat_gen(rnd() % 40 + 2, rnd() % 10 + 1, 1);
+        norms = (double *) malloc((link_mat->r + 1) * sizeof(double));
+        for (b = 0; b <= link_mat->r; ++b)
+            norms[b] = rnd() % 4? 1. : .0;
+        norms[1] = 1.;
+        if (area_enum(link_mat, norms) != inter_link_area_re(link_mat, norms) ||
+                area_enum(link_mat, 0) != inter_link_area_re(link_mat, 0)) {
+            printf("FAIL: area random matrix %u\n", k);
+            return 1;
+        }
+        free(norms);
+        mat_destroy(link_mat);
+    }
+
+    printf("PASS: area\n");
+    return 0;
+}
@@ -0,0 +1,112 @@
+#!/bin/sh
+# end-to-end test of sorted and indexed BIN files
+# scaffolding from a BIN file sorted with --sort-bin, of either version, must give the same AGP
+# as from the unsorted BIN file, also with a mapping quality cutoff that ends within the runs of records read
+# a BIN file dumped again under the same output prefix must not use the index of the sorted file before
+# usage: test/bin.sh [yahs]
+
+YAHS=${1:-./yahs}
+D=$(mktemp -d)
+trap 'rm -rf "$D"' EXIT
+
+fail() {
+    echo "FAIL: sort-bin $1"
+    [ -f "$2" ] && cat "$2"
+    exit 1
+}
+
+# four chromosomes cut into contigs of 100-300kb in shuffled order
+# read pairs within chromosomes decay with distance, one in five has a mapping quality below 60
+awk -v D="$D" 'BEGIN {
+    srand(5);
+    n = 0;
+    for (c = 1; c <= 4; ++c) {
+        len[c] = 1000000;
+        for (p = 0; p < len[c]; p += l) {
+            l = 100000 + int(rand() * 200000);
+            if (len[c] - p - l < 100000)
+                l = len[c] - p;
+            ++n;
+            pc[n] = c; ps[n] = p; pl[n] = l;
+        }
+    }
+    for (i = 1; i <= n; ++i)
+        ord[i] = i;
+    for (i = n; i > 1; --i) {
+        j = int(rand() * i) + 1;
+        t = ord[i]; ord[i] = ord[j]; ord[j] = t;
+    }
+    for (i = 1; i <= n; ++i) {
+        k = ord[i];
+        name[k] = sprintf("ctg%02d", i);
+        printf(">%s\n", name[k]) > D "/ref.fa";
+        for (x = 0; x < pl[k]; x += 60) {
+            l = x + 60 <= pl[k]? 60 : pl[k] - x;
+            t = "";
+            for (j = 0; j < l; ++j)
+                t = t substr("ACGT", int(rand() * 4) + 1, 1);
+            print t > D "/ref.fa";
+        }
+    }
+    for (r = 0; r < 300000; ++r) {
+        c0 = int(rand() * 4) + 1;
+        g0 = int(rand() * len[c0]);
+        if (rand() < .9) {
+            c1 = c0;
+            d = int(exp(log(500) + rand() * (log(len[c0]) - log(500))));
+            g1 = rand() < .5? g0 + d : g0 - d;
+            if (g1 < 0 || g1 >= len[c0])
+                continue;
+        } else {
+            c1 = int(rand() * 4) + 1;
+            g1 = int(rand() * len[c1]);
+        }
+        for (k = 1; k <= n; ++k) {
+            if (pc[k] == c0 && g0 >= ps[k] && g0 < ps[k] + pl[k])
+                k0 = k;
+            if (pc[k] == c1 && g1 >= ps[k] && g1 < ps[k] + pl[k])
+                k1 = k;
+        }
+        # reads of 100bp within contigs
+        x0 = g0 - ps[k0];
+        if (x0 + 100 > pl[k0])
+            x0 = pl[k0] - 100;
+        x1 = g1 - ps[k1];
+        if (x1 + 100 > pl[k1])
+            x1 = pl[k1] - 100;
+        q0 = rand() < .8? 60 : int(rand() * 60);
+        q1 = rand() < .8? 60 : int(rand() * 60);
+        printf("%s\t%d\t%d\tr%d/1\t%d\t+\n", name[k0], x0, x0 + 100, r, q0) > D "/hic.bed";
+        printf("%s\t%d\t%d\tr%d/2\t%d\t-\n", name[k1], x1, x1 + 100, r, q1) > D "/hic.bed";
+    }
+}'
+awk '/^>/ { if (n) printf("%s\t%d\t%d\t60\t61\n", n, l, o); n = substr($0, 2); l = 0; o += length($0) + 1; s = o; next }
+    { if (l == 0) o = s; l += length($0); s += length($0) + 1 }
+    END { printf("%s\t%d\t%d\t60\t61\n", n, l, o) }' "$D/ref.fa" > "$D/ref.fa.fai"
+
+# unsorted BIN files of both versions
+$YAHS -o "$D/u1" "$D/ref.fa" "$D/hic.bed" > "$D/u1.log" 2>&1 || fail "unsorted version 1 run failed" "$D/u1.log"
+$YAHS --bin-version 2 -o "$D/u2" "$D/ref.fa" "$D/hic.bed" > "$D/u2.log" 2>&1 || fail "unsorted version 2 run failed" "$D/u2.log"
+cmp -s "$D/u1_scaffolds_final.agp" "$D/u2_scaffolds_final.agp" || fail "version 2 AGP differs from version 1" "$D/u2.log"
+
+# sorted BIN files of both versions
+for v in 1 2; do
+    $YAHS --sort-bin -o "$D/s$v" "$D/ref.fa" "$D/u$v.bin" > "$D/s$v.log" 2>&1 || fail "sorted version $v run failed" "$D/s$v.log"
+    [ -f "$D/s$v.bin.idx" ] || fail "sorted version $v file not indexed" "$D/s$v.log"
+    cmp -s "$D/u1_scaffolds_final.agp" "$D/s${v}_scaffolds_final.agp" || fail "sorted version $v AGP differs" "$D/s$v.log"
+done
+
+# mapping quality cutoff within the records of contig pairs
+$YAHS -q 30 -o "$D/u1q" "$D/ref.fa" "$D/u1.bin" > "$D/u1q.log" 2>&1 || fail "unsorted run with -q 30 failed" "$D/u1q.log"
+for v in 1 2; do
+    $YAHS -q 30 -o "$D/s${v}q" "$D/ref.fa" "$D/s$v.bin" > "$D/s${v}q.log" 2>&1 || fail "sorted version $v run with -q 30 failed" "$D/s${v}q.log"
+    cmp -s "$D/u1q_scaffolds_final.agp" "$D/s${v}q_scaffolds_final.agp" || fail "sorted version $v AGP with -q 30 differs" "$D/s${v}q.log"
+done
+
+# a dump under the prefix of a sorted run replaces the sorted file and its index
+$YAHS --sort-bin -o "$D/x" "$D/ref.fa" "$D/hic.bed" > "$D/x.log" 2>&1 || fail "sorted run failed" "$D/x.log"
+$YAHS -o "$D/x" "$D/ref.fa" "$D/hic.bed" > "$D/x.log" 2>&1 || fail "run over a sorted run failed" "$D/x.log"
+[ -f "$D/x.bin.idx" ] && fail "index of the sorted file kept" "$D/x.log"
+cmp -s "$D/u1_scaffolds_final.agp" "$D/x_scaffolds_final.agp" || fail "AGP of a run over a sorted run differs" "$D/x.log"
+
+echo "PASS: sort-bin"
@@ -0,0 +1,223 @@
+// tests and microbenchmark of decoding BIN records into columns
+// the SSE2 and the scalar decoders must give the same columns for random records, including records below the
+// mapping quality cutoff and record numbers that are not a multiple of 4
+// with -b, decoding is timed against the per-record loop it replaced in the BIN readers
+// usage: test/bin_cols_test [-b]
+
+// the decoders are static
+#include "../asset.c"
+
+#define N_BENCH 50000
+
+static uint64_t rs = 0x9E3779B97F4A7C15ULL;
+static uint32_t rnd(void)
+{
+    rs ^= rs << 13;
+    rs ^= rs >> 7;
+    rs ^= rs << 17;
+    return (uint32_t) (rs >> 16);
+}
+
+// random records, one in q_low of them has a mapping quality below 60
+static uint8_t *rec_gen(uint32_t n, uint32_t q_low)
+{
+    uint32_t i, v[4];
+    uint8_t *a, *r;
+
+    // padded as records may be read 16 bytes at a time
+    a = (uint8_t *) calloc((size_t) n * BIN_RECORD_SIZE + 16, 1);
+    for (i = 0, r = a; i < n; ++i, r += BIN_RECORD_SIZE) {
+        v[0] = rnd() % 1000;
+        v[1] = rnd();
+        v[2] = rnd() % 1000;
+        v[3] = rnd();
+        memcpy(r, v, 16);
+        r[16] = rnd() % q_low == 0? rnd() % 60 : 60;
+    }
+    return a;
+}
+
+static int cols_cmp(bin_cols_t *a, bin_cols_t *b)
+{
+    uint32_t n;
+
+    n = a->n;
+    return n != b->n ||
+        memcmp(a->c0, b->c0, n * sizeof(uint32_t)) ||
+        memcmp(a->p0, b->p0, n * sizeof(uint32_t)) ||
+        memcmp(a->c1, b->c1, n * sizeof(uint32_t)) ||
+        memcmp(a->p1, b->p1, n * sizeof(uint32_t)) ||
+        memcmp(a->q, b->q, n);
+}
+
+// records passing the cutoff taken one by one
+static void cols_ref(bin_cols_t *cols, const uint8_t *rec, uint32_t n, uint8_t mq)
+{
+    uint32_t i, k, v[4];
+
+    for (i = k = 0; i < n; ++i, rec += BIN_RECORD_SIZE) {
+        if (rec[16] < mq)
+            continue;
+        memcpy(v, rec, 16);
+        cols->c0[k] = v[0];
+        cols->p0[k] = v[1];
+        cols->c1[k] = v[2];
+        cols->p1[k] = v[3];
+        cols->q[k++] = rec[16];
+    }
+    cols->n = k;
+}
+
+static int test(void)
+{
+    static const uint32_t ns[] = {0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 1001, BUFF_SIZE - 1, BUFF_SIZE};
+    static const uint8_t mqs[] = {0, 1, 10, 30, 59, 60, 61, 255};
+    static const uint32_t q_lows[] = {1, 2, 8, 100};
+    uint32_t i, j, k;
+    uint8_t *rec;
+    bin_cols_t ref, cols;
+
+    bin_cols_init(&ref, BUFF_SIZE);
+    bin_cols_init(&cols, BUFF_SIZE);
+    for (k = 0; k < sizeof(q_lows) / sizeof(q_lows[0]); ++k) {
+        for (i = 0; i < sizeof(ns) / sizeof(ns[0]); ++i) {
+            rec = rec_gen(ns[i], q_lows[k]);
+            for (j = 0; j < sizeof(mqs) / sizeof(mqs[0]); ++j) {
+                cols_ref(&ref, rec, ns[i], mqs[j]);
+                cols.n = bin_cols_decode_scalar(&cols, rec, ns[i], mqs[j], 0);
+                if (cols_cmp(&ref, &cols)) {
+                    printf("FAIL: bin_cols scalar decoder, %u records, cutoff %u\n", ns[i], mqs[j]);
+                    return 1;
+                }
+#ifdef BIN_COLS_SSE2
+                memset(cols.c0, 0xff, BUFF_SIZE * sizeof(uint32_t));
+                cols.n = bin_cols_decode_sse2(&cols, rec, ns[i], mqs[j], 0);
+                if (cols_cmp(&ref, &cols)) {
+                    printf("FAIL: bin_cols SSE2 decoder, %u records, cutoff %u\n", ns[i], mqs[j]);
+                    return 1;
+                }
+#endif
+                bin_cols_decode(&cols, rec, ns[i], mqs[j]);
+                if (cols_cmp(&ref, &cols)) {
+                    printf("FAIL: bin_cols_decode, %u records, cutoff %u\n", ns[i], mqs[j]);
+                    return 1;
+                }
+            }
+            free(rec);
+        }
+    }
+    bin_cols_destroy(&ref);
+    bin_cols_destroy(&cols);
+
+#ifdef BIN_COLS_SSE2
+    printf("PASS: bin_cols (scalar and SSE2)\n");
+#else
+    printf("PASS: bin_cols (scalar)\n");
+#endif
+    return 0;
+}
+
+typedef struct {
+    uint32_t c0, x0, c1, x1;
+} pair_t;
+
+static volatile uint64_t sink;
+
+// the loop of the BIN readers before records were decoded into columns
+static uint32_t loop_record(pair_t *pairs, const uint8_t *buffer, uint32_t n, uint8_t mq)
+{
+    uint32_t j, k;
+    pair_t *pair;
+
+    k = 0;
+    for (j = 0; j < n; ++j, buffer += BIN_RECORD_SIZE) {
+        if (*(uint8_t *) (buffer + 16) < mq)
+            continue;
+        pair = &pairs[k++];
+        pair->c0 = *(uint32_t *) (buffer);
+        pair->x0 = *(uint32_t *) (buffer + 4);
+        pair->c1 = *(uint32_t *) (buffer + 8);
+        pair->x1 = *(uint32_t *) (buffer + 12);
+    }
+    return k;
+}
+
+// decoding into columns and filling the pairs from them as in link_scan_worker
+static uint32_t loop_cols(pair_t *pairs, bin_cols_t *cols, uint32_t k)
+{
+    uint32_t j;
+    pair_t *pair;
+
+    for (j = 0; j < k; ++j) {
+        pair = &pairs[j];
+        pair->c0 = cols->c0[j];
+        pair->x0 = cols->p0[j];
+        pair->c1 = cols->c1[j];
+        pair->x1 = cols->p1[j];
+    }
+    return k;
+}
+
+static void bench(void)
+{
+    static const uint32_t q_lows[] = {1000000, 7, 2};
+    uint32_t i, j, k, m, l;
+    uint8_t *rec, mq;
+    double t[4];
+    pair_t *pairs;
+    bin_cols_t cols;
+
+    mq = 10;
+    pairs = (pair_t *) malloc(BUFF_SIZE * sizeof(pair_t));
+    bin_cols_init(&cols, BUFF_SIZE);
+    printf("%d records decoded %d times with mapping quality cutoff %u, ns per record\n", BUFF_SIZE, N_BENCH, mq);
+    printf("record loop: pairs filled from records one by one, the loop replaced by bin_cols_decode\n");
+    printf("scalar, SSE2: records decoded into columns\n");
+    printf("decode+pairs: bin_cols_decode, then pairs filled from the columns as in link_scan_worker\n");
+    printf("below cutoff\trecord loop\tscalar\tSSE2\tdecode+pairs\n");
+    for (i = 0; i < sizeof(q_lows) / sizeof(q_lows[0]); ++i) {
+        rec = rec_gen(BUFF_SIZE, q_lows[i]);
+        for (j = l = 0; j < BUFF_SIZE; ++j)
+            l += rec[j * BIN_RECORD_SIZE + 16] < mq;
+        for (m = 0; m < 4; ++m) {
+            t[m] = realtime();
+            for (j = 0; j < N_BENCH; ++j) {
+                if (m == 0) {
+                    k = loop_record(pairs, rec, BUFF_SIZE, mq);
+                    sink += pairs[k / 2].x0;
+                } else if (m == 1) {
+                    k = bin_cols_decode_scalar(&cols, rec, BUFF_SIZE, mq, 0);
+                    sink += cols.p0[k / 2];
+                } else if (m == 2) {
+#ifdef BIN_COLS_SSE2
+                    k = bin_cols_decode_sse2(&cols, rec, BUFF_SIZE, mq, 0);
+                    sink += cols.p0[k / 2];
+#endif
+                } else {
+                    k = loop_cols(pairs, &cols, bin_cols_decode(&cols, rec, BUFF_SIZE, mq));
+                    sink += pairs[k / 2].x0;
+                }
+            }
+            t[m] = (realtime() - t[m]) * 1e9 / ((double) N_BENCH * BUFF_SIZE);
+        }
+        printf("%.1f%%\t%.2f\t%.2f\t", 100. * l / BUFF_SIZE, t[0], t[1]);
+#ifdef BIN_COLS_SSE2
+        printf("%.2f\t", t[2]);
+#else
+        printf("-\t");
+#endif
+        printf("%.2f\n", t[3]);
+        free(rec);
+    }
+    bin_cols_destroy(&cols);
+    free(pairs);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        bench();
+        return 0;
+    }
+    return test();
+}
@@ -0,0 +1,232 @@
+// tests of the BIN formats
+// records written in version 1 and version 2 must be read back the same through bin_reader_read,
+// also after a version 1 to version 2 round trip,
+// and the records selected from sorted files must be exactly those passing the mapping quality filter
+// usage: test/bin_test
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "../asset.h"
+
+#define N_REC (3 * BIN_BLOCK_SIZE + 123)
+
+static char dir[] = "/tmp/bin_testXXXXXX";
+static const char *names[] = {"v1.bin", "v2.bin", "v12.bin", "s1.bin", "s2.bin"};
+
+static uint64_t rs = 0x2545F4914F6CDD1DULL;
+static uint32_t rnd(void)
+{
+    rs ^= rs << 13;
+    rs ^= rs >> 7;
+    rs ^= rs << 17;
+    return (uint32_t) (rs >> 16);
+}
+
+static int rec_cmp(const void *a, const void *b)
+{
+    return memcmp(a, b, BIN_RECORD_SIZE);
+}
+
+static void fail(const char *msg)
+{
+    printf("FAIL: bin %s\n", msg);
+    exit(1);
+}
+
+static void path(char *f, const char *name)
+{
+    sprintf(f, "%s/%s", dir, name);
+}
+
+static void cleanup(void)
+{
+    char f[80];
+    size_t i;
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        path(f, names[i]);
+        unlink(f);
+        strcat(f, ".idx");
+        unlink(f);
+    }
+    rmdir(dir);
+}
+
+// random records with runs of contig pairs, intra and inter pairs, and positions up to UINT32_MAX
+static uint8_t *rec_gen(long n)
+{
+    long i;
+    uint8_t *a, *r;
+    uint32_t v[4];
+
+    a = (uint8_t *) malloc(n * BIN_RECORD_SIZE);
+    v[0] = v[1] = v[2] = v[3] = 0;
+    for (i = 0, r = a; i < n; ++i, r += BIN_RECORD_SIZE) {
+        if (rnd() % 8 == 0)
+            v[0] = rnd() % 50;
+        v[1] = rnd() % 4 == 0? rnd() : rnd() % 100000;
+        v[2] = rnd() % 2? v[0] : v[0] + rnd() % 50;
+        v[3] = rnd() % 4 == 0? rnd() : rnd() % 100000;
+        memcpy(r, v, 16);
+        r[16] = rnd() % 4 == 0? 255 : rnd() % 61;
+    }
+    return a;
+}
+
+static void rec_write(const char *f, int version, const uint8_t *a, long n)
+{
+    long i;
+    uint32_t v[4];
+    bin_writer_t *w;
+
+    w = bin_writer_open(f, version);
+    if (w == NULL)
+        fail("cannot write file");
+    for (i = 0; i < n; ++i, a += BIN_RECORD_SIZE) {
+        memcpy(v, a, 16);
+        bin_writer_add(w, v[0], v[1], v[2], v[3], a[16]);
+    }
+    if (bin_writer_close(w))
+        fail("cannot write file");
+}
+
+// read all records in chunks of at most c records
+static uint8_t *rec_read(bin_reader_t *r, long c, long *n)
+{
+    long m;
+    uint8_t *a, *rec;
+
+    a = 0;
+    *n = 0;
+    while ((m = bin_reader_read(r, &rec, c)) > 0) {
+        if (m > c)
+            fail("more records than asked for");
+        a = (uint8_t *) realloc(a, (*n + m) * BIN_RECORD_SIZE);
+        memcpy(a + *n * BIN_RECORD_SIZE, rec, m * BIN_RECORD_SIZE);
+        *n += m;
+    }
+    if (m < 0)
+        fail("read error");
+    return a;
+}
+
+static uint8_t *rec_read_file(const char *f, int version, long c, long *n)
+{
+    bin_reader_t *r;
+    uint8_t *a;
+
+    r = bin_reader_open(f);
+    if (r == NULL)
+        fail("cannot open file");
+    if (r->version != version)
+        fail("wrong version");
+    a = rec_read(r, c, n);
+    bin_reader_close(r);
+    return a;
+}
+
+static void check_same(const uint8_t *a, long n, const uint8_t *b, long m, const char *msg)
+{
+    if (n != m || memcmp(a, b, n * BIN_RECORD_SIZE))
+        fail(msg);
+}
+
+// records of a sorted file selected with a mapping quality cutoff
+// compared as a set with the records passing the cutoff
+static void check_select(const char *f, const uint8_t *a, long n, uint8_t mq)
+{
+    long i, k, m;
+    bin_reader_t *r;
+    uint8_t *b, *s;
+
+    b = (uint8_t *) malloc(n * BIN_RECORD_SIZE);
+    for (i = k = 0; i < n; ++i)
+        if (a[i * BIN_RECORD_SIZE + 16] >= mq)
+            memcpy(b + k++ * BIN_RECORD_SIZE, a + i * BIN_RECORD_SIZE, BIN_RECORD_SIZE);
+    qsort(b, k, BIN_RECORD_SIZE, rec_cmp);
+
+    r = bin_reader_open(f);
+    if (r == NULL || r->idx == NULL)
+        fail("sorted file not indexed");
+    if (bin_reader_select(r, 0, 0, mq) < k)
+        fail("fewer records selected than passing the cutoff");
+    s = rec_read(r, 1000, &m);
+    bin_reader_close(r);
+    qsort(s, m, BIN_RECORD_SIZE, rec_cmp);
+    check_same(b, k, s, m, "selected records differ from records passing the cutoff");
+
+    free(b);
+    free(s);
+}
+
+int main(void)
+{
+    char f1[64], f2[64], f12[64], s1[64], s2[64], idx[80];
+    uint8_t *a, *b, *c;
+    long n, m, k;
+    int v;
+
+    if (mkdtemp(dir) == NULL)
+        fail("cannot create temporary directory");
+    atexit(cleanup);
+    path(f1, names[0]);
+    path(f2, names[1]);
+    path(f12, names[2]);
+    path(s1, names[3]);
+    path(s2, names[4]);
+
+    n = N_REC;
+    a = rec_gen(n);
+    rec_write(f1, 1, a, n);
+    rec_write(f2, 2, a, n);
+
+    // chunks smaller and larger than blocks
+    b = rec_read_file(f1, 1, 1000, &m);
+    check_same(a, n, b, m, "version 1 records differ");
+    free(b);
+    b = rec_read_file(f2, 2, 1000, &m);
+    check_same(a, n, b, m, "version 2 records differ");
+    free(b);
+    b = rec_read_file(f2, 2, BIN_BLOCK_SIZE * 2, &m);
+    check_same(a, n, b, m, "version 2 records in large chunks differ");
+    free(b);
+
+    // version 1 to version 2 round trip
+    b = rec_read_file(f1, 1, BIN_BLOCK_SIZE, &m);
+    rec_write(f12, 2, b, m);
+    c = rec_read_file(f12, 2, BIN_BLOCK_SIZE, &k);
+    check_same(a, n, c, k, "version 1 to version 2 round trip differs");
+    free(b);
+    free(c);
+
+    // sorted files of both versions keep all records and select those passing the cutoff
+    for (v = 1; v <= 2; ++v) {
+        if (bin_sort_file(v == 1? f1 : f2, v == 1? s1 : s2, v, -1))
+            fail("cannot sort file");
+        b = rec_read_file(v == 1? s1 : s2, v, 1000, &m);
+        qsort(b, m, BIN_RECORD_SIZE, rec_cmp);
+        c = (uint8_t *) malloc(n * BIN_RECORD_SIZE);
+        memcpy(c, a, n * BIN_RECORD_SIZE);
+        qsort(c, n, BIN_RECORD_SIZE, rec_cmp);
+        check_same(c, n, b, m, "sorted records differ");
+        free(b);
+        free(c);
+        check_select(v == 1? s1 : s2, a, n, 0);
+        check_select(v == 1? s1 : s2, a, n, 10);
+        check_select(v == 1? s1 : s2, a, n, 30);
+    }
+
+    // a file rewritten in place does not keep the index of the file before
+    rec_write(s2, 2, a, n);
+    sprintf(idx, "%s.idx", s2);
+    if (!access(idx, F_OK))
+        fail("index of a rewritten file kept");
+
+    free(a);
+    printf("PASS: bin\n");
+    return 0;
+}
@@ -0,0 +1,84 @@
+#!/bin/sh
+# end-to-end test of 4DN pairs input
+# read pairs given in a pairs file with the header of the 4DN pairs format specification
+# (https://github.com/4dn-dcic/pairix/blob/master/pairs_format_specification.md)
+# must be dumped to the same BIN file as the same read pairs given in BED format
+# usage: test/pairs.sh [yahs]
+
+YAHS=${1:-./yahs}
+D=$(mktemp -d)
+trap 'rm -rf "$D"' EXIT
+
+# three sequences named after the chromosomes of the specification
+awk 'BEGIN {
+    srand(11);
+    split("300000 200000 150000", len, " ");
+    for (c = 1; c <= 3; ++c) {
+        printf(">chr%d\n", c);
+        for (i = 0; i < len[c]; i += 60) {
+            s = "";
+            for (j = i; j < i + 60 && j < len[c]; ++j)
+                s = s substr("ACGT", int(rand() * 4) + 1, 1);
+            print s;
+        }
+    }
+}' > "$D/ref.fa"
+awk '/^>/ { if (n) printf("%s\t%d\t%d\t60\t61\n", n, l, o); n = substr($0, 2); l = 0; o += length($0) + 1; s = o; next }
+    { if (l == 0) o = s; l += length($0); s += length($0) + 1 }
+    END { printf("%s\t%d\t%d\t60\t61\n", n, l, o) }' "$D/ref.fa" > "$D/ref.fa.fai"
+
+# read pairs sorted as declared in the header, 1-based positions
+awk 'BEGIN {
+    srand(7);
+    split("300000 200000 150000", len, " ");
+    for (k = 0; k < 20000; ++k) {
+        c0 = int(rand() * 3) + 1;
+        p0 = int(rand() * len[c0]) + 1;
+        if (rand() < .9) {
+            c1 = c0;
+            p1 = p0 + int(rand() * 20000);
+            if (p1 > len[c1])
+                p1 = len[c1];
+        } else {
+            c1 = int(rand() * 3) + 1;
+            p1 = int(rand() * len[c1]) + 1;
+        }
+        if (c0 > c1 || (c0 == c1 && p0 > p1)) {
+            t = c0; c0 = c1; c1 = t;
+            t = p0; p0 = p1; p1 = t;
+        }
+        printf("read%05d\tchr%d\t%d\tchr%d\t%d\t+\t-\n", k, c0, p0, c1, p1);
+    }
+}' | sort -k2,2 -k4,4 -k3,3n -k5,5n > "$D/body.txt"
+
+{
+    printf '## pairs format v1.0\n'
+    printf '#sorted: chr1-chr2-pos1-pos2\n'
+    printf '#shape: upper triangle\n'
+    printf '#genome_assembly: hg38\n'
+    awk '{ printf("#chromsize: %s %d\n", $1, $2) }' "$D/ref.fa.fai"
+    printf '#columns: readID chr1 pos1 chr2 pos2 strand1 strand2\n'
+    cat "$D/body.txt"
+} > "$D/hic.pairs"
+gzip -c "$D/hic.pairs" > "$D/hic.pairs.gz"
+
+# BED records of one base at the same positions
+# mapping quality is 255 for pairs without mapq1 and mapq2 columns
+awk -v OFS='\t' '{ print $2, $3 - 1, $3, $1 "/1", 255, $6; print $4, $5 - 1, $5, $1 "/2", 255, $7 }' "$D/body.txt" > "$D/hic.bed"
+
+$YAHS -o "$D/bed" "$D/ref.fa" "$D/hic.bed" > "$D/bed.log" 2>&1
+for f in hic.pairs hic.pairs.gz; do
+    $YAHS -o "$D/pairs" "$D/ref.fa" "$D/$f" > "$D/pairs.log" 2>&1
+    if ! grep -q "dump hic links (PAIRS)" "$D/pairs.log"; then
+        echo "FAIL: $f not read as pairs"
+        cat "$D/pairs.log"
+        exit 1
+    fi
+    if ! cmp -s "$D/bed.bin" "$D/pairs.bin"; then
+        echo "FAIL: $f dumped differently from BED"
+        cat "$D/pairs.log"
+        exit 1
+    fi
+    rm -f "$D"/pairs*
+done
+echo "PASS: pairs"
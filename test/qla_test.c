@@ -0,0 +1,89 @@
+// tests and microbenchmark of the quantile thresholds memoized in graph building
+// the memoized thresholds must be exactly the thresholds computed by direct qbinom calls
+// with -b, the thresholds of 500k random links are timed with and without the memo
+// usage: test/qla_test [-b]
+
+// qla_get is static and yahs.c has its own main
+#define main yahs_main
+#include "../yahs.c"
+#undef main
+
+#define N_LINK 500000
+
+static uint64_t rs = 0xD1B54A32D192ED03ULL;
+static uint32_t rnd(void)
+{
+    rs ^= rs << 13;
+    rs ^= rs >> 7;
+    rs ^= rs << 17;
+    return (uint32_t) (rs >> 16);
+}
+
+static int test(void)
+{
+    static const double las[] = {1e-6, .001, .01, .05, .3};
+    static const uint32_t maxs[] = {10, 2000, 50000};
+    uint32_t i, j, k, n0;
+    double a, b;
+    khash_t(qla) *h;
+
+    for (i = 0; i < sizeof(las) / sizeof(las[0]); ++i) {
+        for (j = 0; j < sizeof(maxs) / sizeof(maxs[0]); ++j) {
+            h = kh_init(qla);
+            // repeated n0 are looked up, the others are computed
+            for (k = 0; k < 20000; ++k) {
+                n0 = rnd() % maxs[j] + 1;
+                a = qla_get(h, n0, las[i]);
+                b = qbinom(.99, n0, las[i], 1, 0) / n0;
+                if (memcmp(&a, &b, sizeof(double))) {
+                    printf("FAIL: qla n0 = %u, la = %g: %.17g memoized, %.17g direct\n", n0, las[i], a, b);
+                    return 1;
+                }
+            }
+            kh_destroy(qla, h);
+        }
+    }
+    printf("PASS: qla\n");
+    return 0;
+}
+
+static void bench(void)
+{
+    static const double las[] = {.001, .05};
+    static const uint32_t maxs[] = {2000, 50000};
+    uint32_t i, j, k, *n0;
+    double t0, t1, s0, s1;
+    khash_t(qla) *h;
+
+    n0 = (uint32_t *) malloc(N_LINK * sizeof(uint32_t));
+    printf("quantile thresholds of %d links, seconds\n", N_LINK);
+    printf("n0\tla\tqbinom\tmemoized\n");
+    for (i = 0; i < sizeof(las) / sizeof(las[0]); ++i) {
+        for (j = 0; j < sizeof(maxs) / sizeof(maxs[0]); ++j) {
+            for (k = 0; k < N_LINK; ++k)
+                n0[k] = rnd() % maxs[j] + 1;
+            s0 = s1 = .0;
+            t0 = realtime();
+            for (k = 0; k < N_LINK; ++k)
+                s0 += qbinom(.99, n0[k], las[i], 1, 0) / n0[k];
+            t0 = realtime() - t0;
+            t1 = realtime();
+            h = kh_init(qla);
+            for (k = 0; k < N_LINK; ++k)
+                s1 += qla_get(h, n0[k], las[i]);
+            kh_destroy(qla, h);
+            t1 = realtime() - t1;
+            printf("[1,%u]\t%g\t%.3f\t%.3f%s\n", maxs[j], las[i], t0, t1, s0 == s1? "" : "\tDIFF");
+        }
+    }
+    free(n0);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        bench();
+        return 0;
+    }
+    return test();
+}
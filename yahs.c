@@ -31,6 +31,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <ctype.h>
+#include <sys/stat.h>
 
 #include "ketopt.h"
 #include "kvec.h"
@@ -55,7 +56,8 @@
 #define ENOMEM_ERR 15
 #define ENOBND_ERR 14
 #define GB 0x40000000
-#define MAX_N_SEQ 45000
+// minimum fraction of intra link cells to estimate norms from if the full intra link matrix does not fit
+#define MIN_NORM_SAMPLE .1
 
 #ifndef DEBUG_GT4G
 static int ec_min_window = 1000000;
@@ -80,10 +82,25 @@ static uint32_t l_stats[10];
 
 double qbinom(double, double, double, int, int);
 
+KHASH_MAP_INIT_INT(qla, double)
+
 int VERBOSE = 0;
 
 static double ys_realtime0;
 
+// quantile threshold of the link norm of n0 cells
+// memoized by the number of cells, la is fixed within a graph so there are only a few distinct thresholds
+static double qla_get(khash_t(qla) *h, uint32_t n0, double la)
+{
+    khint_t k;
+    int absent;
+
+    k = kh_put(qla, h, n0, &absent);
+    if (absent)
+        kh_val(h, k) = qbinom(.99, n0, la, 1, 0) / n0;
+    return kh_val(h, k);
+}
+
 graph_t *build_graph_from_links(inter_link_mat_t *link_mat, asm_dict_t *dict, double min_norm, double la)
 {
     int32_t i, j, n, c0, c1;
@@ -92,9 +109,11 @@ graph_t *build_graph_from_links(inter_link_mat_t *link_mat, asm_dict_t *dict, do
     inter_link_t *link;
     graph_t *g;
     graph_arc_t *arc;
+    khash_t(qla) *qla_h;
 
     g = graph_init();
     g->sdict = dict;
+    qla_h = kh_init(qla);
 
     // build graph
     n = link_mat->n;
@@ -107,8 +126,8 @@ graph_t *build_graph_from_links(inter_link_mat_t *link_mat, asm_dict_t *dict, do
         t = link->linkt;
         if (!t)
             continue;
-        
-        qla = qbinom(.99, link->n0, la, 1, 0) / link->n0;
+
+        qla = qla_get(qla_h, link->n0, la);
         for (j = 0; j < 4; ++j) {
             if (1 << j & t) {
                 norm = link->norms[j];
@@ -125,6 +144,7 @@ graph_t *build_graph_from_links(inter_link_mat_t *link_mat, asm_dict_t *dict, do
             }
         }
     }
+    kh_destroy(qla, qla_h);
 
     graph_arc_sort(g);
     graph_arc_index(g);
@@ -132,7 +152,7 @@ graph_t *build_graph_from_links(inter_link_mat_t *link_mat, asm_dict_t *dict, do
     return g;
 }
 
-int run_scaffolding(char *fai, char *agp, char *link_file, uint32_t ml, uint8_t mq, re_cuts_t *re_cuts, char *out, int resolution, double *noise, long rss_limit, int no_mem_check)
+int run_scaffolding(char *fai, char *agp, char *link_file, uint32_t ml, uint8_t mq, re_cuts_t *re_cuts, char *out, int resolution, double *noise, long rss_limit, int no_mem_check, int n_threads)
 {
     //TODO: adjust wt thres by resolution
     sdict_t *sdict = make_sdict_from_index(fai, ml);
@@ -146,10 +166,11 @@ int run_scaffolding(char *fai, char *agp, char *link_file, uint32_t ml, uint8_t
     fprintf(stderr, "[DEBUG_GRAPH_PRUNE::%s] #sequences loaded %d = %lubp\n", __func__, dict->n, len);
 #endif
 
-    long rss_intra, rss_inter;
+    long rss_intra, rss_inter, rss_raw, rss_sample;
+    uint32_t radius;
 
     rss_intra = no_mem_check? 0 : estimate_intra_link_mat_init_rss(dict, resolution);
-    if ((rss_limit >= 0 && rss_intra > rss_limit) || rss_intra < 0) {
+    if ((rss_limit >= 0 && rss_intra * MIN_NORM_SAMPLE > rss_limit) || rss_intra < 0) {
         // no enough memory
         fprintf(stderr, "[I::%s] No enough memory. Try higher resolutions... End of scaffolding round.\n", __func__);
         fprintf(stderr, "[I::%s] RAM    limit: %.3fGB\n", __func__, (double) rss_limit / GB);
@@ -158,38 +179,73 @@ int run_scaffolding(char *fai, char *agp, char *link_file, uint32_t ml, uint8_t
         sd_destroy(sdict);
         return ENOMEM_ERR;
     }
+    // estimate norms from a sample of intra links within the RAM limit
+    rss_sample = -1;
+    if (rss_limit >= 0 && rss_intra > rss_limit)
+        rss_intra = rss_sample = rss_limit;
     rss_limit -= rss_intra;
+
+    // collect inter links in the same pass as intra links if memory allows
+    // raw counts are kept for the maximum possible radius and rebinned once the norms are known
+    inter_link_raw_t *inter_link_raw = 0;
+    radius = estimate_max_radius(dict, resolution);
+    rss_raw = no_mem_check? 0 : estimate_inter_link_raw_rss(link_file, dict, resolution, radius, mq);
+    rss_inter = no_mem_check? 0 : estimate_inter_link_mat_init_rss(link_file, dict, resolution, radius, mq);
+    if (radius > 0 && rss_raw >= 0 && rss_inter >= 0 && (rss_limit < 0 || rss_raw + rss_inter <= rss_limit)) {
+        inter_link_raw = inter_link_raw_init(dict, resolution, radius);
+        // counts of scaffold pairs not changed are lifted from the raw inter links of earlier rounds if they fit
+        if (rss_limit >= 0 && rss_raw + rss_inter + inter_link_raw_kept_rss() > rss_limit)
+            inter_link_raw_clear();
+        inter_link_raw_lift(inter_link_raw, dict);
+        rss_limit -= rss_raw;
+    } else {
+        inter_link_raw_clear();
+    }
+
     fprintf(stderr, "[I::%s] starting norm estimation...\n", __func__);
-    intra_link_mat_t *intra_link_mat = intra_link_mat_from_file(link_file, dict, re_cuts, resolution, 1, mq);
+    intra_link_mat_t *intra_link_mat = intra_link_mat_from_file_raw(link_file, dict, re_cuts, resolution, 1, mq, inter_link_raw, rss_sample, n_threads);
 
 #ifdef DEBUG_RAM_USAGE
     fprintf(stderr, "[DEBUG_RAM_USAGE::%s] RAM  peak: %.3fGB\n", __func__, (double) peakrss() / GB);
     fprintf(stderr, "[DEBUG_RAM_USAGE::%s] RAM intra: %.3fGB\n", __func__, (double) rss_intra / GB);
+    if (inter_link_raw)
+        fprintf(stderr, "[DEBUG_RAM_USAGE::%s] RAM   raw: %.3fGB\n", __func__, (double) rss_raw / GB);
     fprintf(stderr, "[DEBUG_RAM_USAGE::%s] RAM  free: %.3fGB\n", __func__, (double) rss_limit / GB);
 #endif
 
     norm_t *norm = calc_norms(intra_link_mat);
+    // intra links are only used for norms
+    intra_link_mat_destroy(intra_link_mat);
+    rss_limit += rss_intra;
     if (norm == 0) {
         fprintf(stderr, "[W::%s] No enough bands for norm calculation... End of scaffolding round.\n", __func__);
-        intra_link_mat_destroy(intra_link_mat);
+        if (inter_link_raw)
+            inter_link_raw_destroy(inter_link_raw);
         asm_destroy(dict);
         sd_destroy(sdict);
         return ENOBND_ERR;
     }
 
-    rss_inter = no_mem_check? 0 : estimate_inter_link_mat_init_rss(dict, resolution, norm->r);
+    rss_inter = no_mem_check? 0 : estimate_inter_link_mat_init_rss(link_file, dict, resolution, norm->r, mq);
     if ((rss_limit >= 0 && rss_inter > rss_limit) || rss_inter < 0) {
         // no enough memory
         fprintf(stderr, "[I::%s] No enough memory. Try higher resolutions... End of scaffolding round.\n", __func__);
         fprintf(stderr, "[I::%s] RAM    limit: %.3fGB\n", __func__, (double) rss_limit / GB);
         fprintf(stderr, "[I::%s] RAM required: %.3fGB\n", __func__, (double) rss_inter / GB);
+        if (inter_link_raw)
+            inter_link_raw_destroy(inter_link_raw);
         asm_destroy(dict);
         sd_destroy(sdict);
         return ENOMEM_ERR;
     }
     rss_limit -= rss_inter;
     fprintf(stderr, "[I::%s] starting link estimation...\n", __func__);
-    inter_link_mat_t *inter_link_mat = inter_link_mat_from_file(link_file, dict, re_cuts, resolution, norm->r, mq);
+    inter_link_mat_t *inter_link_mat;
+    if (inter_link_raw) {
+        inter_link_mat = inter_link_mat_from_raw(inter_link_raw, dict, re_cuts, norm->r);
+    } else {
+        inter_link_mat = inter_link_mat_from_file(link_file, dict, re_cuts, resolution, norm->r, mq, n_threads);
+    }
 
 #ifdef DEBUG_RAM_USAGE
     fprintf(stderr, "[DEBUG_RAM_USAGE::%s] RAM  peak: %.3fGB\n", __func__, (double) peakrss() / GB);
@@ -199,12 +255,12 @@ int run_scaffolding(char *fai, char *agp, char *link_file, uint32_t ml, uint8_t
 
     *noise = inter_link_mat->noise / resolution / resolution;
 
-    int8_t *directs = 0;
+    link_directs_t *directs = 0;
     double la;
     // directs = calc_link_directs_from_file(link_file, dict);
-    inter_link_norms(inter_link_mat, norm, 1, &la);
-    calc_link_directs(inter_link_mat, .1, dict, directs);
-    free(directs);
+    inter_link_norms(inter_link_mat, norm, 1, &la, n_threads);
+    calc_link_directs(inter_link_mat, .1, dict, directs, n_threads);
+    link_directs_destroy(directs);
 
 #ifdef DEBUG_LINK
     fprintf(stderr, "[DEBUG_LINK::%s] print_inter_link_norms\n", __func__);
@@ -261,35 +317,71 @@ int run_scaffolding(char *fai, char *agp, char *link_file, uint32_t ml, uint8_t
 
     search_graph_path(g, g->sdict, out);
 
-    intra_link_mat_destroy(intra_link_mat);
     inter_link_mat_destroy(inter_link_mat);
     norm_destroy(norm);
     graph_destroy(g);
-    asm_destroy(dict);
+    // raw inter links are kept for the next two rounds
+    if (inter_link_raw)
+        inter_link_raw_keep(inter_link_raw, dict);
+    else
+        asm_destroy(dict);
     sd_destroy(sdict);
 
     return 0;
 }
 
-int contig_error_break(char *fai, char *link_file, uint32_t ml, char *out)
+int contig_error_break(char *fai, char *link_file, uint32_t ml, char *out, long rss_limit, int no_mem_check, int n_threads)
 {
-    uint32_t i, ec_round, err_no, bp_n;
+    uint32_t i, j, ec_round, err_no, bp_n;
     sdict_t *sdict;
     asm_dict_t *dict;
     int dist_thres;
+    long rss_pos;
 
     sdict = make_sdict_from_index(fai, ml);
     dict = make_asm_dict_from_sdict(sdict);
-    dist_thres = estimate_dist_thres_from_file(link_file, dict, ec_min_frac, ec_resolution, 0);
+    dist_thres = estimate_dist_thres_from_file(link_file, dict, ec_min_frac, ec_resolution, 0, n_threads);
     dist_thres = MAX(dist_thres, ec_min_window);
     fprintf(stderr, "[I::%s] dist threshold for contig error break: %d\n", __func__, dist_thres);
-    asm_destroy(dict);
 
     char* out1 = (char *) malloc(strlen(out) + 35);
     ec_round = err_no = 0;
+
+    rss_pos = no_mem_check? 0 : estimate_link_pos_mat_rss(link_file, dict);
+#ifdef DEBUG_RAM_USAGE
+    fprintf(stderr, "[DEBUG_RAM_USAGE::%s] RAM  link positions: %.3fGB\n", __func__, (double) rss_pos / GB);
+#endif
+    if (rss_pos >= 0 && (rss_limit < 0 || rss_pos <= rss_limit)) {
+        // read links once and run break rounds of all contigs in memory
+        link_pos_mat_t *link_pos_mat = link_pos_mat_from_file(link_file, dict, dist_thres, ec_bin, 0, n_threads);
+        ec_round = link_pos_mat_break(link_pos_mat, ec_merge_thresh, ec_fold_thresh, ec_dual_break_thresh, ec_move_avg, n_threads, &err_no);
+        for (i = 1; i <= ec_round; ++i) {
+            bp_n = 0;
+            bp_t *breaks = link_pos_mat_break_points(link_pos_mat, i, &bp_n);
+            sprintf(out1, "%s_%02d.agp", out, i);
+            FILE *agp_out = fopen(out1, "w");
+            asm_dict_t *dict1 = write_break_agp(dict, breaks, bp_n, agp_out);
+            fclose(agp_out);
+            asm_agp_put(out1, dict1);
+            
+            for (j = 0; j < bp_n; ++j)
+                free(breaks[j].p);
+            free(breaks);
+        }
+        link_pos_mat_destroy(link_pos_mat);
+        asm_destroy(dict);
+        sd_destroy(sdict);
+        free(out1);
+
+        fprintf(stderr, "[I::%s] performed %u round assembly error correction. Made %u breaks \n", __func__, ec_round, err_no);
+
+        return ec_round;
+    }
+    asm_destroy(dict);
+
     while (1) {
         dict = ec_round? make_asm_dict_from_agp(sdict, out1) : make_asm_dict_from_sdict(sdict);
-        link_mat_t *link_mat = link_mat_from_file(link_file, dict, dist_thres, ec_bin, .0, ec_move_avg, 0);
+        link_mat_t *link_mat = link_mat_from_file(link_file, dict, dist_thres, ec_bin, .0, ec_move_avg, 0, n_threads);
 #ifdef DEBUG_ERROR_BREAK
         fprintf(stderr, "[DEBUG_ERROR_BREAK::%s] ec_round %u link matrix\n", __func__, ec_round);
         print_link_mat(link_mat, dict, stderr);
@@ -301,8 +393,9 @@ int contig_error_break(char *fai, char *link_file, uint32_t ml, char *out)
 #endif
         sprintf(out1, "%s_%02d.agp", out, ++ec_round);
         FILE *agp_out = fopen(out1, "w");
-        write_break_agp(dict, breaks, bp_n, agp_out);
+        asm_dict_t *dict1 = write_break_agp(dict, breaks, bp_n, agp_out);
         fclose(agp_out);
+        asm_agp_put(out1, dict1);
         
         link_mat_destroy(link_mat);
         asm_destroy(dict);
@@ -325,7 +418,7 @@ int contig_error_break(char *fai, char *link_file, uint32_t ml, char *out)
     return ec_round;
 }
 
-int scaffold_error_break(char *fai, char *link_file, uint32_t ml, uint8_t mq, char *agp, int flank_size, double noise, char *out)
+int scaffold_error_break(char *fai, char *link_file, uint32_t ml, uint8_t mq, char *agp, int flank_size, double noise, char *out, int n_threads)
 {
     int dist_thres;
     sdict_t *sdict = make_sdict_from_index(fai, ml);
@@ -335,7 +428,7 @@ int scaffold_error_break(char *fai, char *link_file, uint32_t ml, uint8_t mq, ch
     //dist_thres = estimate_dist_thres_from_file(link_file, dict, ec_min_frac, ec_resolution);
     //dist_thres = MAX(dist_thres, ec_min_window);
     //fprintf(stderr, "[I::%s] dist threshold for scaffold error break: %d\n", __func__, dist_thres);
-    link_mat_t *link_mat = link_mat_from_file(link_file, dict, dist_thres, ec_bin, noise, ec_move_avg, mq);
+    link_mat_t *link_mat = link_mat_from_file(link_file, dict, dist_thres, ec_bin, noise, ec_move_avg, mq, n_threads);
 
 #ifdef DEBUG_ERROR_BREAK
     fprintf(stderr, "[DEBUG_ERROR_BREAK::%s] link matrix\n", __func__);
@@ -349,8 +442,9 @@ int scaffold_error_break(char *fai, char *link_file, uint32_t ml, uint8_t mq, ch
 #endif
 
     FILE *agp_out = fopen(out, "w");
-    write_break_agp(dict, breaks, bp_n, agp_out);
+    asm_dict_t *dict1 = write_break_agp(dict, breaks, bp_n, agp_out);
     fclose(agp_out);
+    asm_agp_put(out, dict1);
     link_mat_destroy(link_mat);
     asm_destroy(dict);
     sd_destroy(sdict);
@@ -378,7 +472,7 @@ static void print_asm_stats(uint64_t *n_stats, uint32_t *l_stats, int all)
 #endif
 }
 
-int run_yahs(char *fai, char *agp, char *link_file, uint32_t ml, uint8_t mq, char *out, int *resolutions, int nr, re_cuts_t *re_cuts, int no_contig_ec, int no_scaffold_ec, int no_mem_check)
+int run_yahs(char *fai, char *agp, char *link_file, uint32_t ml, uint8_t mq, char *out, int *resolutions, int nr, re_cuts_t *re_cuts, int no_contig_ec, int no_scaffold_ec, int no_mem_check, int mem_links, int n_threads)
 {
     int ec_round, re, r, rc;
     char *out_fn, *out_agp, *out_agp_break;
@@ -386,7 +480,7 @@ int run_yahs(char *fai, char *agp, char *link_file, uint32_t ml, uint8_t mq, cha
     FILE *fo;
     sdict_t *sdict;
     asm_dict_t *dict;
-    long rss_total, rss_limit;  
+    long rss_total, rss_limit, rss_links;  
     
     ram_limit(&rss_total, &rss_limit);
     fprintf(stderr, "[I::%s] RAM total: %.3fGB\n", __func__, (double) rss_total / GB);
@@ -404,7 +498,7 @@ int run_yahs(char *fai, char *agp, char *link_file, uint32_t ml, uint8_t mq, cha
         fprintf(stderr, "[DEBUG::%s] perform contig error break...\n", __func__);
 #endif
         sprintf(out_agp_break, "%s_inital_break", out);
-        ec_round = contig_error_break(fai, link_file, ml, out_agp_break);
+        ec_round = contig_error_break(fai, link_file, ml, out_agp_break, rss_limit, no_mem_check, n_threads);
         sprintf(out_agp_break, "%s_inital_break_%02d.agp", out, ec_round);
 #ifdef DEBUG
         fprintf(stderr, "[DEBUG::%s] contig error break done\n", __func__);
@@ -431,16 +525,21 @@ int run_yahs(char *fai, char *agp, char *link_file, uint32_t ml, uint8_t mq, cha
         }
     }
 
+    if (mem_links) {
+        // links used by the scaffolding rounds are kept in memory if they take at most half of the RAM limit
+        rss_links = bin_mem_load(link_file, mq, no_mem_check || rss_limit < 0? -1 : rss_limit / 2);
+        if (rss_links < 0) {
+            fprintf(stderr, "[W::%s] not enough memory to keep HiC links in memory, read from file %s in each round\n", __func__, link_file);
+        } else {
+            fprintf(stderr, "[I::%s] HiC links kept in memory: %.3fGB\n", __func__, (double) rss_links / GB);
+            if (rss_limit >= 0)
+                rss_limit -= rss_links;
+        }
+    }
+
     r = rc = 0;
     
     dict = make_asm_dict_from_agp(sdict, out_agp_break);
-    if (dict->n > MAX_N_SEQ) {
-        fprintf(stderr, "[E::%s] sequence number exceeds limit (%d > %d)\n", __func__, dict->n, MAX_N_SEQ);
-        fprintf(stderr, "[E::%s] consider removing short sequences before scaffolding, or\n", __func__);
-        fprintf(stderr, "[E::%s] running without error correction (--no-contig-ec) if due to excessive contig error breaks\n", __func__);
-        fprintf(stderr, "[E::%s] program halted...\n", __func__);
-        return 1;
-    }
     asm_sd_stats(dict, n_stats, l_stats);
     print_asm_stats(n_stats, l_stats, 1);
     asm_destroy(dict);
@@ -461,7 +560,7 @@ int run_yahs(char *fai, char *agp, char *link_file, uint32_t ml, uint8_t mq, cha
 
         sprintf(out_fn, "%s_r%02d", out, r);
         // noise per unit
-        re = run_scaffolding(fai, out_agp_break, link_file, ml, mq, re_cuts, out_fn, resolutions[r - 1], &noise, rss_limit, no_mem_check);
+        re = run_scaffolding(fai, out_agp_break, link_file, ml, mq, re_cuts, out_fn, resolutions[r - 1], &noise, rss_limit, no_mem_check, n_threads);
         if (!re) {
             sprintf(out_agp, "%s_r%02d.agp", out, r);
             if (no_scaffold_ec == 0) {
@@ -470,7 +569,7 @@ int run_yahs(char *fai, char *agp, char *link_file, uint32_t ml, uint8_t mq, cha
 #endif
 
                 sprintf(out_agp_break, "%s_r%02d_break.agp", out, r);
-                scaffold_error_break(fai, link_file, ml, mq, out_agp, resolutions[r - 1], noise, out_agp_break);
+                scaffold_error_break(fai, link_file, ml, mq, out_agp, resolutions[r - 1], noise, out_agp_break, n_threads);
 #ifdef DEBUG
                 fprintf(stderr, "[DEBUG::%s] scaffold error break done\n", __func__);
 #endif
@@ -493,6 +592,8 @@ int run_yahs(char *fai, char *agp, char *link_file, uint32_t ml, uint8_t mq, cha
         asm_destroy(dict);
     }
 
+    bin_mem_unload();
+
 #ifdef DEBUG
     fprintf(stderr, "[DEBUG::%s] make final output...\n", __func__);
 #endif
@@ -522,6 +623,9 @@ int run_yahs(char *fai, char *agp, char *link_file, uint32_t ml, uint8_t mq, cha
     
     asm_destroy(dict);
     sd_destroy(sdict);
+    asm_agp_clear();
+    inter_link_raw_clear();
+    bin_file_rec_clear();
 
     free(out_agp);
     free(out_fn);
@@ -575,16 +679,20 @@ static int default_nr(char *fai, uint32_t ml)
 
 static void print_help(FILE *fp_help)
 {
-    fprintf(fp_help, "Usage: yahs [options] <contigs.fa> <hic.bed>|<hic.bam>|<hic.bin>\n");
+    fprintf(fp_help, "Usage: yahs [options] <contigs.fa> <hic.bed>|<hic.bam>|<hic.bin>|<hic.pairs[.gz]>|-\n");
     fprintf(fp_help, "Options:\n");
     fprintf(fp_help, "    -a FILE           AGP file (for rescaffolding) [none]\n");
     fprintf(fp_help, "    -r INT[,INT,...]  list of resolutions in ascending order [automate]\n");
     fprintf(fp_help, "    -e STR            restriction enzyme cutting sites [none]\n");
     fprintf(fp_help, "    -l INT            minimum length of a contig to scaffold [0]\n");
     fprintf(fp_help, "    -q INT            minimum mapping quality [10]\n");
+    fprintf(fp_help, "    -t INT            number of threads [1]\n");
     fprintf(fp_help, "    --no-contig-ec    do not do contig error correction\n");
     fprintf(fp_help, "    --no-scaffold-ec  do not do scaffold error correction\n");
     fprintf(fp_help, "    --no-mem-check    do not do memory check at runtime\n");
+    fprintf(fp_help, "    --bin-version INT version of the BIN file dumped from BED/BAM input (1 or 2) [1]\n");
+    fprintf(fp_help, "    --sort-bin        sort and index the BIN file to skip links between scaffolds where possible\n");
+    fprintf(fp_help, "    --links-in-mem    keep HiC links in memory for scaffolding rounds if within the RAM limit\n");
     fprintf(fp_help, "    -o STR            prefix of output files [yahs.out]\n");
     fprintf(fp_help, "    -v INT            verbose level [%d]\n", VERBOSE);
     fprintf(fp_help, "    --version         show version number\n");
@@ -594,6 +702,9 @@ static ko_longopt_t long_options[] = {
     { "no-contig-ec",   ko_no_argument, 301 },
     { "no-scaffold-ec", ko_no_argument, 302 },
     { "no-mem-check",   ko_no_argument, 303 },
+    { "bin-version",    ko_required_argument, 304 },
+    { "sort-bin",       ko_no_argument, 305 },
+    { "links-in-mem",   ko_no_argument, 306 },
     { "help",           ko_no_argument, 'h' },
     { "version",        ko_no_argument, 'V' },
     { 0, 0, 0 }
@@ -611,10 +722,11 @@ int main(int argc, char *argv[])
     liftrlimit();
     ys_realtime0 = realtime();
 
-    char *fa, *fai, *agp, *link_file, *out, *restr, *ecstr, *ext, *link_bin_file, *agp_final, *fa_final;
-    int *resolutions, nr, mq, ml, no_contig_ec, no_scaffold_ec, no_mem_check;
+    char *fa, *fai, *agp, *link_file, *out, *restr, *ecstr, *link_bin_file, *agp_final, *fa_final;
+    int *resolutions, nr, mq, ml, no_contig_ec, no_scaffold_ec, no_mem_check, n_threads, bin_version, sort_bin, mem_links, is_stream, fmt;
+    struct stat st;
 
-    const char *opt_str = "a:e:r:o:l:q:Vv:h";
+    const char *opt_str = "a:e:r:o:l:q:t:Vv:h";
     ketopt_t opt = KETOPT_INIT;
 
     int c, ret;
@@ -623,6 +735,10 @@ int main(int argc, char *argv[])
     no_contig_ec = no_scaffold_ec = no_mem_check = 0;
     mq = 10;
     ml = 0;
+    n_threads = 1;
+    bin_version = 1;
+    sort_bin = 0;
+    mem_links = 0;
     ecstr = 0;
 
     while ((c = ketopt(&opt, argc, argv, 1, opt_str, long_options)) >= 0) {
@@ -636,6 +752,8 @@ int main(int argc, char *argv[])
             ml = atoi(opt.arg);
         } else if (c == 'q') {
             mq = atoi(opt.arg);
+        } else if (c == 't') {
+            n_threads = atoi(opt.arg);
         } else if (c == 'e') {
             // make a copy of ecstr to make sure the CMD correct
             ecstr = strdup(opt.arg);
@@ -645,6 +763,12 @@ int main(int argc, char *argv[])
             no_scaffold_ec = 1;
         } else if (c == 303 ) {
             no_mem_check = 1;
+        } else if (c == 304) {
+            bin_version = atoi(opt.arg);
+        } else if (c == 305) {
+            sort_bin = 1;
+        } else if (c == 306) {
+            mem_links = 1;
         } else if (c == 'v') {
             VERBOSE = atoi(opt.arg);
         } else if (c == 'V') {
@@ -682,6 +806,16 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (bin_version != 1 && bin_version != 2) {
+        fprintf(stderr, "[E::%s] invalid BIN file version: %d\n", __func__, bin_version);
+        return 1;
+    }
+
+    if (n_threads < 1) {
+        fprintf(stderr, "[E::%s] invalid number of threads: %d\n", __func__, n_threads);
+        return 1;
+    }
+
     uint8_t mq8;
     mq8 = (uint8_t) mq;
 
@@ -771,27 +905,71 @@ int main(int argc, char *argv[])
     if (out == 0)
         out = "yahs.out";
 
-    ext = link_file + strlen(link_file) - 4;
-    if (strcmp(ext, ".bam") == 0) {
-        link_bin_file = malloc(strlen(out) + 5);
-        sprintf(link_bin_file, "%s.bin", out);
+    // the link file format is detected from the file content
+    // streams such as stdin and named pipes are dumped to a binary file in a single pass
+    is_stream = stat(link_file, &st) != 0 || !S_ISREG(st.st_mode);
+    fmt = is_stream? LINK_FMT_UNKNOWN : link_file_format(link_file);
+    if (is_stream || fmt != LINK_FMT_BIN) {
+        link_bin_file = malloc(strlen(out) + 9);
+        sprintf(link_bin_file, sort_bin? "%s.bin.tmp" : "%s.bin", out);
+    }
+    if (is_stream) {
+        fprintf(stderr, "[I::%s] dump hic links from stream %s to binary file %s\n", __func__, link_file, link_bin_file);
+        fmt = dump_links_from_stream(link_file, fai, ml, link_bin_file, bin_version, n_threads);
+    } else if (fmt == LINK_FMT_BAM) {
         fprintf(stderr, "[I::%s] dump hic links (BAM) to binary file %s\n", __func__, link_bin_file);
-        dump_links_from_bam_file(link_file, fai, ml, 0, link_bin_file);
-    } else if (strcmp(ext, ".bed") == 0) {
-        link_bin_file = malloc(strlen(out) + 5);
-        sprintf(link_bin_file, "%s.bin", out);
+        dump_links_from_bam_file(link_file, fai, ml, 0, link_bin_file, bin_version, n_threads);
+    } else if (fmt == LINK_FMT_BED) {
         fprintf(stderr, "[I::%s] dump hic links (BED) to binary file %s\n", __func__, link_bin_file);
-        dump_links_from_bed_file(link_file, fai, ml, 0, link_bin_file);
-    } else if (strcmp(ext, ".bin") == 0) {
+        dump_links_from_bed_file(link_file, fai, ml, 0, link_bin_file, bin_version);
+    } else if (fmt == LINK_FMT_PAIRS) {
+        fprintf(stderr, "[I::%s] dump hic links (PAIRS) to binary file %s\n", __func__, link_bin_file);
+        dump_links_from_pairs_file(link_file, fai, ml, link_bin_file, bin_version, n_threads);
+    } else if (fmt == LINK_FMT_BIN) {
         link_bin_file = malloc(strlen(link_file) + 1);
         sprintf(link_bin_file, "%s", link_file);
-        if (ml > 0)
-            fprintf(stderr, "[W::%s] contig length threshold %d applied, make sure the binary file %s is up to date\n", __func__, ml, link_bin_file);
     } else {
-        fprintf(stderr, "[E::%s] unknown link file format. File extension .bam, .bed or .bin is expected\n", __func__);
+        fprintf(stderr, "[E::%s] cannot read link file %s\n", __func__, link_file);
         exit(EXIT_FAILURE);
     }
 
+    if (fmt == LINK_FMT_BIN) {
+        if (ml > 0)
+            fprintf(stderr, "[W::%s] contig length threshold %d applied, make sure the binary file %s is up to date\n", __func__, ml, link_bin_file);
+        if (sort_bin) {
+            bin_reader_t *reader = bin_reader_open(link_bin_file);
+            if (reader == NULL)
+                exit(EXIT_FAILURE);
+            if (reader->idx) {
+                fprintf(stderr, "[I::%s] binary file %s is sorted and indexed\n", __func__, link_bin_file);
+                sort_bin = 0;
+            } else {
+                bin_version = reader->version;
+            }
+            bin_reader_close(reader);
+        }
+    }
+
+    if (sort_bin) {
+        long rss_total, rss_limit;
+        char *link_sorted_file = malloc(strlen(out) + 5);
+        sprintf(link_sorted_file, "%s.bin", out);
+        if (strcmp(link_sorted_file, link_bin_file) == 0) {
+            fprintf(stderr, "[E::%s] cannot sort binary file %s in place, use a different output prefix\n", __func__, link_bin_file);
+            exit(EXIT_FAILURE);
+        }
+        ram_limit(&rss_total, &rss_limit);
+        fprintf(stderr, "[I::%s] sort and index binary file %s\n", __func__, link_sorted_file);
+        if (bin_sort_file(link_bin_file, link_sorted_file, bin_version, rss_limit < 0? -1 : rss_limit / 2)) {
+            fprintf(stderr, "[E::%s] failed to sort binary file %s\n", __func__, link_bin_file);
+            exit(EXIT_FAILURE);
+        }
+        if (is_stream || fmt != LINK_FMT_BIN)
+            remove(link_bin_file);
+        free(link_bin_file);
+        link_bin_file = link_sorted_file;
+    }
+
 #ifdef DEBUG_OPTIONS
     fprintf(stderr, "[DEBUG_OPTIONS::%s] list of options:\n", __func__);
     fprintf(stderr, "[DEBUG_OPTIONS::%s] fa:    %s\n", __func__, fa);
@@ -802,6 +980,7 @@ int main(int argc, char *argv[])
     fprintf(stderr, "[DEBUG_OPTIONS::%s] RE:    %s\n", __func__, ecstr);
     fprintf(stderr, "[DEBUG_OPTIONS::%s] minl:  %d\n", __func__, ml);
     fprintf(stderr, "[DEBUG_OPTIONS::%s] minq:  %hhu\n", __func__, mq8);
+    fprintf(stderr, "[DEBUG_OPTIONS::%s] threads: %d\n", __func__, n_threads);
     fprintf(stderr, "[DEBUG_OPTIONS::%s] nr:    %d\n", __func__, nr);
     int i;
     for (i = 0; i < nr; ++i)
@@ -811,7 +990,7 @@ int main(int argc, char *argv[])
     fprintf(stderr, "[DEBUG_OPTIONS::%s] ec[S]: %d\n", __func__, no_scaffold_ec);
 #endif
 
-    ret = run_yahs(fai, agp, link_bin_file, ml, mq8, out, resolutions, nr, re_cuts, no_contig_ec, no_scaffold_ec, no_mem_check);
+    ret = run_yahs(fai, agp, link_bin_file, ml, mq8, out, resolutions, nr, re_cuts, no_contig_ec, no_scaffold_ec, no_mem_check, mem_links, n_threads);
     
     if (ret == 0) {
         agp_final = (char *) malloc(strlen(out) + 35);